@@ -8,6 +8,8 @@
 
 #include "config.h"
 #include "trie.h"
+#include "marshal.h"
+#include "pythread.h"
 
 // globals
 static PyObject *TriezError;
@@ -37,7 +39,39 @@ size_t TriezUnicode_CharSize(PyObject *o)
 #define TriezUnicode_CharSize(o) sizeof(Py_UNICODE)
 #endif
 
+// char size of the keys written by the trie. (See _TKEY_AS_PyUnicode)
+#ifdef IS_PEP393_AVAILABLE
+#define TRIEZ_KEY_CHAR_SIZE sizeof(Py_UCS4)
+#else
+#define TRIEZ_KEY_CHAR_SIZE sizeof(Py_UNICODE)
+#endif
+
+// per-trie reader-writer lock. Traversals take it for reading with the GIL
+// released, writers take it for writing with the GIL held.
+#ifdef _WIN32
+#include <windows.h>
+typedef SRWLOCK trie_rwlock_t;
+#define RWLOCK_INIT(l) (InitializeSRWLock(l), 0)
+#define RWLOCK_DESTROY(l)
+#define RWLOCK_RDLOCK(l) AcquireSRWLockShared(l)
+#define RWLOCK_RDUNLOCK(l) ReleaseSRWLockShared(l)
+#define RWLOCK_TRYWRLOCK(l) TryAcquireSRWLockExclusive(l)
+#define RWLOCK_WRLOCK(l) AcquireSRWLockExclusive(l)
+#define RWLOCK_WRUNLOCK(l) ReleaseSRWLockExclusive(l)
+#else
+#include <pthread.h>
+typedef pthread_rwlock_t trie_rwlock_t;
+#define RWLOCK_INIT(l) pthread_rwlock_init(l, NULL)
+#define RWLOCK_DESTROY(l) pthread_rwlock_destroy(l)
+#define RWLOCK_RDLOCK(l) pthread_rwlock_rdlock(l)
+#define RWLOCK_RDUNLOCK(l) pthread_rwlock_unlock(l)
+#define RWLOCK_TRYWRLOCK(l) (pthread_rwlock_trywrlock(l) == 0)
+#define RWLOCK_WRLOCK(l) pthread_rwlock_wrlock(l)
+#define RWLOCK_WRUNLOCK(l) pthread_rwlock_unlock(l)
+#endif
+
 // forwards
+static void _Trie_value_free(TRIE_DATA value);
 
 // module functions
 
@@ -69,31 +103,290 @@ trie_key_t _PyUnicode_AS_TKEY(PyObject *s)
     k.s = (char *)TriezUnicode(s);
     k.size = TriezUnicode_Size(s);
     k.char_size = TriezUnicode_CharSize(s);
+    k.max_char = NULL;
 
     //debug_print_key(&k);
 
     return k;
 }
 
+#ifdef IS_PEP393_AVAILABLE
+// byte count of a char in the narrowest string kind that can hold maxchar.
+unsigned char _kind_char_size(TRIE_CHAR maxchar)
+{
+    return maxchar < 0x100 ? 1 : (maxchar < 0x10000 ? 2 : 4);
+}
+
+// Copies the UCS4 chars of k to dst, narrowing them to char_size bytes.
+void _key_narrow(char *dst, unsigned char char_size, trie_key_t *k)
+{
+    const Py_UCS4 *src;
+    unsigned long i;
+
+    src = (const Py_UCS4 *)k->s;
+    if (char_size == 1) {
+        for (i=0;i<k->size;i++) {
+            ((Py_UCS1 *)dst)[i] = (Py_UCS1)src[i];
+        }
+    } else if (char_size == 2) {
+        for (i=0;i<k->size;i++) {
+            ((Py_UCS2 *)dst)[i] = (Py_UCS2)src[i];
+        }
+    } else {
+        memcpy(dst, src, k->size * sizeof(Py_UCS4));
+    }
+}
+#endif
+
 PyObject *_TKEY_AS_PyUnicode(trie_key_t *k)
 {
     PyObject *r;
 #ifdef IS_PEP393_AVAILABLE
     // If PEP393 is available, we always work on UCS4 buffers for 
-    // suffix/prefix/correct functions.
-    r = PyUnicode_FromKindAndData(PyUnicode_4BYTE_KIND, k->s, k->size);
+    // suffix/prefix/correct functions. The string is built in the narrowest 
+    // kind right away, the max. char is tracked while the key is written.
+    r = PyUnicode_New(k->size, trie_key_max_char(k));
+    if (r) {
+        _key_narrow((char *)PyUnicode_DATA(r), 
+            (unsigned char)PyUnicode_KIND(r), k);
+    }
 #else
     r = PyUnicode_FromUnicode((const Py_UNICODE *)k->s, k->size);
 #endif
     return r;
 }
 
+// Keys found by a traversal are collected here while the GIL is released, 
+// and turned into Python objects after it is taken back. Keys are written 
+// back to back to s, ends[i] is where the ith key ends. With PEP393, every 
+// key is stored in the narrowest kind for its max. char, maxs[i], so that 
+// strings are made by a single copy. A key starts at the end of the previous 
+// one rounded up to its char size, so its chars are aligned. (See 
+// _keybuf_start)
+typedef struct {
+    char *s;
+    unsigned long *ends;
+    unsigned long *dists;
+    TRIE_CHAR *maxs;
+    unsigned long count, alloc; // key count
+    unsigned long size, salloc; // byte count of s
+    unsigned char char_size;
+    int nomem;
+} keybuf_t;
+
+// Offset of a key of char_size bytes chars that follows a key ending at end.
+unsigned long _keybuf_start(unsigned long end, unsigned char char_size)
+{
+    return (end + char_size - 1) & ~(unsigned long)(char_size - 1);
+}
+
+int _keybuf_add(keybuf_t *kb, trie_key_t *k, unsigned long dist)
+{
+    unsigned long n, start, alloc;
+    unsigned char char_size;
+    TRIE_CHAR maxchar;
+    void *p;
+
+    if (kb->nomem) {
+        return 0;
+    }
+
+#ifdef IS_PEP393_AVAILABLE
+    maxchar = trie_key_max_char(k);
+    char_size = _kind_char_size(maxchar);
+#else
+    maxchar = 0;
+    char_size = k->char_size;
+#endif
+    n = k->size * char_size;
+    start = _keybuf_start(kb->size, char_size);
+    if (start + n > kb->salloc) {
+        alloc = (start + n) * 2;
+        p = TRIE_RAW_REALLOC(kb->s, alloc);
+        if (!p) {
+            kb->nomem = 1;
+            return 0;
+        }
+        kb->s = (char *)p;
+        kb->salloc = alloc;
+    }
+    if (kb->count == kb->alloc) {
+        alloc = kb->alloc ? kb->alloc * 2 : 16;
+        p = TRIE_RAW_REALLOC(kb->ends, alloc * sizeof(unsigned long));
+        if (!p) {
+            kb->nomem = 1;
+            return 0;
+        }
+        kb->ends = (unsigned long *)p;
+        p = TRIE_RAW_REALLOC(kb->dists, alloc * sizeof(unsigned long));
+        if (!p) {
+            kb->nomem = 1;
+            return 0;
+        }
+        kb->dists = (unsigned long *)p;
+        p = TRIE_RAW_REALLOC(kb->maxs, alloc * sizeof(TRIE_CHAR));
+        if (!p) {
+            kb->nomem = 1;
+            return 0;
+        }
+        kb->maxs = (TRIE_CHAR *)p;
+        kb->alloc = alloc;
+    }
+
+    if (n) {
+#ifdef IS_PEP393_AVAILABLE
+        _key_narrow(kb->s + start, char_size, k);
+#else
+        memcpy(kb->s + start, k->s, n);
+#endif
+    }
+    kb->size = start + n;
+    kb->char_size = char_size;
+    kb->ends[kb->count] = kb->size;
+    kb->dists[kb->count] = dist;
+    kb->maxs[kb->count] = maxchar;
+    kb->count++;
+
+    return 0;
+}
+
+int _collect_keys(trie_key_t *k, void *arg)
+{
+    return _keybuf_add((keybuf_t *)arg, k, 0);
+}
+
+int _collect_distances(trie_key_t *k, unsigned long dist, void *arg)
+{
+    return _keybuf_add((keybuf_t *)arg, k, dist);
+}
+
+// Adds the collected keys to r, which is an empty set, dict or list. Keys are
+// mapped to their distances if r is a dict. kb is freed, and so is r on 
+// error.
+PyObject *_keybuf_result(keybuf_t *kb, PyObject *r)
+{
+#ifndef IS_PEP393_AVAILABLE
+    trie_key_t k;
+#endif
+    PyObject *ks, *d;
+    unsigned long i, start, n;
+    int err;
+
+    if (r && kb->nomem) {
+        PyErr_NoMemory();
+        Py_CLEAR(r);
+    }
+
+    start = 0;
+    for (i=0;r && i<kb->count;i++) {
+#ifdef IS_PEP393_AVAILABLE
+        start = _keybuf_start(start, _kind_char_size(kb->maxs[i]));
+        n = kb->ends[i] - start;
+        ks = PyUnicode_New(n / _kind_char_size(kb->maxs[i]), kb->maxs[i]);
+        if (ks && n) {
+            memcpy(PyUnicode_DATA(ks), kb->s + start, n);
+        }
+#else
+        start = _keybuf_start(start, kb->char_size);
+        n = kb->ends[i] - start;
+        k.s = kb->s + start;
+        k.size = n / kb->char_size;
+        k.char_size = kb->char_size;
+        k.max_char = NULL;
+        ks = _TKEY_AS_PyUnicode(&k);
+#endif
+        start = kb->ends[i];
+        if (!ks) {
+            Py_CLEAR(r);
+            break;
+        }
+        if (PyDict_Check(r)) {
+            d = PyLong_FromUnsignedLong(kb->dists[i]);
+            err = !d || PyDict_SetItem(r, ks, d);
+            Py_XDECREF(d);
+        } else if (PyList_Check(r)) {
+            err = PyList_Append(r, ks);
+        } else {
+            err = PySet_Add(r, ks);
+        }
+        Py_DECREF(ks);
+        if (err) {
+            Py_CLEAR(r);
+        }
+    }
+
+    if (kb->s) {
+        TRIE_RAW_FREE(kb->s);
+    }
+    if (kb->ends) {
+        TRIE_RAW_FREE(kb->ends);
+        TRIE_RAW_FREE(kb->dists);
+    }
+    if (kb->maxs) {
+        TRIE_RAW_FREE(kb->maxs);
+    }
+    return r;
+}
+
 // module custom types
 typedef struct {
     PyObject_HEAD
     trie_t *ptrie;
+    trie_rwlock_t lock;
+    PyObject *origin; // the trie of a snapshot, NULL otherwise
 } TrieObject;
 
+// Snapshots share the nodes of their origin, but not its lock: writers of the
+// origin never change a node that a snapshot reaches. (See Note 9 in trie.h)
+static int _Trie_writable(TrieObject *self)
+{
+    if (self->origin) {
+        PyErr_SetString(PyExc_TypeError, "a snapshot is read-only.");
+        return 0;
+    }
+    return 1;
+}
+
+// Takes the trie lock for writing. A writer holds the GIL, but it does not 
+// wait for the lock with it, so that other threads can run until the readers 
+// are done. Returns 0 if the GIL is released while waiting, Python code might 
+// have run meanwhile. The trie is only changed by a thread holding both.
+static int _Trie_wrlock(TrieObject *self)
+{
+    if (RWLOCK_TRYWRLOCK(&self->lock)) {
+        return 1;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    RWLOCK_WRLOCK(&self->lock);
+    Py_END_ALLOW_THREADS
+    return 0;
+}
+
+// Called with the GIL released. Readers of uncompressed tries do not exclude
+// the writer, they only enter an epoch of the trie. (See Note 7 in trie.h) 
+// Returns what _Trie_rdunlock() needs.
+static unsigned long _Trie_rdlock(TrieObject *self)
+{
+#ifdef TRIE_LOCKFREE_READS
+    if (!(self->ptrie->flags & TRIE_COMPRESSED)) {
+        return trie_read_begin(self->ptrie);
+    }
+#endif
+    RWLOCK_RDLOCK(&self->lock);
+    return 0;
+}
+
+static void _Trie_rdunlock(TrieObject *self, unsigned long epoch)
+{
+#ifdef TRIE_LOCKFREE_READS
+    if (!(self->ptrie->flags & TRIE_COMPRESSED)) {
+        trie_read_end(self->ptrie, epoch);
+        return;
+    }
+#endif
+    RWLOCK_RDUNLOCK(&self->lock);
+}
+
 typedef struct {
     PyObject_HEAD
 
@@ -105,10 +398,13 @@ typedef struct {
 
     TrieObject *_trieobj; // used for Reference Count
     iter_t *_iter;
+    unsigned long chunk; // if not zero, keys are returned in lists of chunk
+    int items; // return (key, value) tuples instead of keys
 } TrieIteratorObject;
 
 static void Trieiter_dealloc(TrieIteratorObject *tio)
 {
+    PyObject_GC_UnTrack(tio);
     if (tio->_iter) {
         tio->iter_deinit_func(tio->_iter);
     }
@@ -116,15 +412,14 @@ static void Trieiter_dealloc(TrieIteratorObject *tio)
     PyObject_GC_Del(tio);
 }
 
-static PyObject *Trieiter_next(TrieIteratorObject *tio)
+// Returns the next key, or (key, value) if items is set. Returns NULL at the 
+// end and on error, the exception is set for the latter. The iterator stays 
+// at the end until it is reset.
+static PyObject *_Trieiter_step(TrieIteratorObject *tio)
 {
-    PyObject *ks;
+    PyObject *ks, *r;
     iter_t *iter;
 
-    if (!tio->_iter) {
-        return NULL;
-    }
-    
     iter = tio->iter_next_func(tio->_iter);
     if (iter->fail) {
         PyErr_SetString(PyExc_RuntimeError, "trie changed during iteration.");
@@ -132,13 +427,75 @@ static PyObject *Trieiter_next(TrieIteratorObject *tio)
     }
     
     if (iter->last) {
-        tio->iter_reset_func(tio->_iter);
         return NULL;
     }
 
     ks = _TKEY_AS_PyUnicode(iter->key);
+    if (!ks || !tio->items) {
+        return ks;
+    }
+
+    r = PyTuple_New(2);
+    if (!r) {
+        Py_DECREF(ks);
+        return NULL;
+    }
+    Py_INCREF((PyObject *)iter->value);
+    PyTuple_SET_ITEM(r, 0, ks);
+    PyTuple_SET_ITEM(r, 1, (PyObject *)iter->value);
+
+    return r;
+}
+
+// A chunked iterator fills a list of up to chunk keys per call, so walking 
+// many keys does not go through the interpreter for every one of them. The
+// iterator is reset once it is exhausted, so that it can be iterated again.
+static PyObject *Trieiter_next(TrieIteratorObject *tio)
+{
+    PyObject *r, *item;
+    unsigned long i;
+
+    if (!tio->_iter) {
+        return NULL;
+    }
+    if (!tio->chunk) {
+        r = _Trieiter_step(tio);
+        if (!r && tio->_iter->last) {
+            tio->iter_reset_func(tio->_iter);
+        }
+        return r;
+    }
+
+    r = PyList_New(tio->chunk);
+    if (!r) {
+        return NULL;
+    }
+    for (i=0;i<tio->chunk;i++) {
+        item = _Trieiter_step(tio);
+        if (!item) {
+            break;
+        }
+        PyList_SET_ITEM(r, i, item);
+    }
+    if (i < tio->chunk && (PyErr_Occurred() || 
+        PyList_SetSlice(r, i, tio->chunk, NULL))) {
+        Py_DECREF(r);
+        return NULL;
+    }
+    if (!i) {
+        Py_DECREF(r);
+        tio->iter_reset_func(tio->_iter);
+        return NULL;
+    }
+
+    return r;
+}
 
-    return ks;
+static int Trieiter_traverse(TrieIteratorObject *tio, visitproc visit, 
+    void *arg)
+{
+    Py_VISIT(tio->_trieobj);
+    return 0;
 }
 
 PyObject *Trieiter_selfiter(PyObject *obj)
@@ -180,7 +537,7 @@ PyTypeObject TrieIteratorType = {
     0,                              /* tp_as_buffer */
     Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
     0,                              /* tp_doc */
-    0,                              /* tp_traverse */
+    (traverseproc)Trieiter_traverse, /* tp_traverse */
     0,                              /* tp_clear */
     0,                              /* tp_richcompare */
     0,                              /* tp_weaklistoffset */
@@ -190,6 +547,146 @@ PyTypeObject TrieIteratorType = {
     0,
 };
 
+// Buffers for the keys written by the ordered queries (trie_successor...), 
+// grown to hold size chars.
+static int _order_key_grow(trie_key_t *k, unsigned long size)
+{
+    char *s;
+
+    if (k->s && size <= k->alloc_size) {
+        return 1;
+    }
+    s = (char *)PyMem_Realloc(k->s, (size ? size : 1) * TRIEZ_KEY_CHAR_SIZE);
+    if (!s) {
+        PyErr_NoMemory();
+        return 0;
+    }
+    k->s = s;
+    k->alloc_size = size;
+    k->char_size = TRIEZ_KEY_CHAR_SIZE;
+    k->max_char = NULL;
+    return 1;
+}
+
+// Iterates the keys in [lo, hi) in order, each step is a trie_successor() 
+// call from the last key. Unlike the other iterators, it does not fail if the
+// trie changes meanwhile: every step sees the trie as it is then.
+typedef struct {
+    PyObject_HEAD
+    TrieObject *_trieobj;
+    PyObject *hi; // NULL if there is no upper bound
+    trie_key_t key; // last key returned, lo before the first step.
+    trie_key_t next; // successor of key is written here, then they are swapped
+    int started;
+    int done;
+    int items;
+} TrieRangeIteratorObject;
+
+static void Trierange_dealloc(TrieRangeIteratorObject *tro)
+{
+    PyObject_GC_UnTrack(tro);
+    PyMem_Free(tro->key.s);
+    PyMem_Free(tro->next.s);
+    Py_XDECREF(tro->hi);
+    Py_XDECREF(tro->_trieobj);
+    PyObject_GC_Del(tro);
+}
+
+static PyObject *Trierange_next(TrieRangeIteratorObject *tro)
+{
+    PyObject *ks, *r;
+    trie_node_t *nd;
+    trie_key_t tmp;
+    trie_t *t;
+
+    if (tro->done) {
+        return NULL;
+    }
+    t = tro->_trieobj->ptrie;
+    if (!_order_key_grow(&tro->next, t->height > tro->key.size ? t->height : 
+        tro->key.size)) {
+        return NULL;
+    }
+    nd = trie_successor(t, &tro->key, !tro->started, &tro->next);
+    tro->started = 1;
+    if (!nd) {
+        tro->done = 1;
+        return NULL;
+    }
+    tmp = tro->key;
+    tro->key = tro->next;
+    tro->next = tmp;
+
+    ks = _TKEY_AS_PyUnicode(&tro->key);
+    if (!ks) {
+        return NULL;
+    }
+    if (tro->hi && PyUnicode_Compare(ks, tro->hi) >= 0) {
+        Py_DECREF(ks);
+        tro->done = 1;
+        return NULL;
+    }
+    if (!tro->items) {
+        return ks;
+    }
+
+    r = PyTuple_New(2);
+    if (!r) {
+        Py_DECREF(ks);
+        return NULL;
+    }
+    Py_INCREF((PyObject *)nd->value);
+    PyTuple_SET_ITEM(r, 0, ks);
+    PyTuple_SET_ITEM(r, 1, (PyObject *)nd->value);
+
+    return r;
+}
+
+static int Trierange_traverse(TrieRangeIteratorObject *tro, visitproc visit, 
+    void *arg)
+{
+    Py_VISIT(tro->_trieobj);
+    Py_VISIT(tro->hi);
+    return 0;
+}
+
+PyTypeObject TrieRangeIteratorType = {
+#ifdef IS_PY3K
+    PyVarObject_HEAD_INIT(NULL, 0)
+#else
+    PyObject_HEAD_INIT(NULL)
+    0,                              /*ob_size*/
+#endif
+    "TrieRange",                    /* tp_name */
+    sizeof(TrieRangeIteratorObject), /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)Trierange_dealloc,  /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_reserved */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    PyObject_GenericGetAttr,        /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+    0,                              /* tp_doc */
+    (traverseproc)Trierange_traverse, /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    PyObject_SelfIter,              /* tp_iter */
+    (iternextfunc)Trierange_next,   /* tp_iternext */
+    0,                              /* tp_methods */
+    0,
+};
+
 // Trie methods
 static Py_ssize_t Trie_length(TrieObject *mp)
 {
@@ -223,27 +720,37 @@ static PyObject *Trie_subscript(TrieObject *mp, PyObject *key)
 static int Trie_ass_sub(TrieObject *mp, PyObject *key, PyObject *val)
 {
     trie_key_t k;
-    trie_node_t *w;
+    TRIE_DATA old;
+    int r;
     
     if (!_IsValid_Unicode(key)) {
         PyErr_SetString(TriezError, "key must be a valid unicode string.");
         return -1;
     }
     
+    if (!_Trie_writable(mp)) {
+        return -1;
+    }
+
     k = _PyUnicode_AS_TKEY(key);
     if (val == NULL) {
-        //search and dec. ref. count
-        w = trie_search(mp->ptrie, &k);
-        if(!w) {
+        // the value is found by the same descent that deletes the key.
+        _Trie_wrlock(mp);
+        r = trie_del(mp->ptrie, &k, &old);
+        RWLOCK_WRUNLOCK(&mp->lock);
+        if (!r) {
             PyErr_SetObject(PyExc_KeyError, key);
             return -1;
         }
-        Py_DECREF((PyObject *)w->value);
-        
-        trie_del(mp->ptrie, &k);// no need for ret check as we already done above.
+
+        // the value might run Python code when released, so after the unlock.
+        Py_DECREF((PyObject *)old);
     } else {
         Py_INCREF(val);
-        if(!trie_add(mp->ptrie, &k, (TRIE_DATA)val)) {
+        _Trie_wrlock(mp);
+        r = trie_add(mp->ptrie, &k, (TRIE_DATA)val);
+        RWLOCK_WRUNLOCK(&mp->lock);
+        if(!r) {
             PyErr_SetString(TriezError, "key cannot be added.");
             return -1;
         }
@@ -251,61 +758,1386 @@ static int Trie_ass_sub(TrieObject *mp, PyObject *key, PyObject *val)
     return 0;
 }
 
-static PyObject* Trie_mem_usage(TrieObject* self)
+// T.add() is T[key] = val which also sets the weight of the key. See 
+// T.top_k_suffixes().
+static PyObject *Trie_add(TrieObject *self, PyObject *args, PyObject *kwds)
 {
-    return Py_BuildValue("l", trie_mem_usage(self->ptrie));
-}
+    PyObject *key, *val;
+    trie_key_t k;
+    trie_node_t *w;
+    TRIE_DATA old;
+    double weight;
+    int r;
+    static char *kwlist[] = {"key", "value", "weight", NULL};
+
+    weight = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|d", kwlist, &key, &val, 
+        &weight)) {
+        return NULL;
+    }
+    // NaN breaks the max_weight comparisons top_k_suffixes() relies on.
+    if (!Py_IS_FINITE(weight)) {
+        PyErr_SetString(PyExc_ValueError, "weight must be a finite number.");
+        return NULL;
+    }
+    if (!_IsValid_Unicode(key)) {
+        PyErr_SetString(TriezError, "key must be a valid unicode string.");
+        return NULL;
+    }
+    if (!_Trie_writable(self)) {
+        return NULL;
+    }
 
-static PyObject* Trie_node_count(TrieObject* self)
-{
-    return Py_BuildValue("l", self->ptrie->node_count);
+    k = _PyUnicode_AS_TKEY(key);
+    Py_INCREF(val);
+    // the replaced value is read under the lock, another writer might have 
+    // replaced it while the GIL is released by _Trie_wrlock().
+    _Trie_wrlock(self);
+    w = trie_search(self->ptrie, &k);
+    old = w ? w->value : 0;
+    r = trie_add_weighted(self->ptrie, &k, (TRIE_DATA)val, weight);
+    RWLOCK_WRUNLOCK(&self->lock);
+    if (!r) {
+        Py_DECREF(val);
+        PyErr_SetString(TriezError, "key cannot be added.");
+        return NULL;
+    }
+    if (old) {
+        Py_DECREF((PyObject *)old);
+    }
+
+    Py_RETURN_NONE;
 }
 
-static void Trie_dealloc(TrieObject* self)
+static PyObject *Trie_top_k_suffixes(TrieObject *self, PyObject *args)
 {
-    trie_destroy(self->ptrie);
+    PyObject *pfx;
+    trie_key_t k;
+    unsigned long count, e;
+    keybuf_t kb;
+
+    if (!PyArg_ParseTuple(args, "Ok", &pfx, &count)) {
+        return NULL;
+    }
+    if (!_IsValid_Unicode(pfx)) {
+        PyErr_SetString(TriezError, "key must be a valid unicode string.");
+        return NULL;
+    }
+
+    k = _PyUnicode_AS_TKEY(pfx);
+    memset(&kb, 0, sizeof(keybuf_t));
+    Py_BEGIN_ALLOW_THREADS
+    e = _Trie_rdlock(self);
+    trie_top_suffixes(self->ptrie, &k, count, _collect_keys, &kb);
+    _Trie_rdunlock(self, e);
+    Py_END_ALLOW_THREADS
+
+    return _keybuf_result(&kb, PyList_New(0));
 }
 
-static PyObject *Trie_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+// Searches all keys in seq(a list or tuple) in one go. Results are written to
+// out. Keys that are not valid unicode strings are not found, or if strict is
+// set, an error is raised for them. Sorting the keys first makes the search 
+// walk the common prefixes once, which only pays off if there are many keys 
+// sharing prefixes. If nogil is set, the search runs with the GIL released, 
+// so the found nodes must not be dereferenced afterwards.
+static int _Trie_search_many(TrieObject *self, PyObject *seq, 
+    trie_node_t **out, int strict, int sort, int nogil)
 {
-    TrieObject *self;
+    trie_key_t *keys;
+    PyObject *key;
+    Py_ssize_t i, n;
+    unsigned long e;
+    int r;
+
+    n = PySequence_Fast_GET_SIZE(seq);
+    keys = (trie_key_t *)PyMem_Malloc((n ? n : 1)*sizeof(trie_key_t));
+    if (!keys) {
+        PyErr_NoMemory();
+        return 0;
+    }
 
-    self = (TrieObject *)type->tp_alloc(type, 0);
-    if (self != NULL) {
-        self->ptrie = trie_create();
-        if (!self->ptrie) {
-            return NULL;
+    for (i=0;i<n;i++) {
+        key = PySequence_Fast_GET_ITEM(seq, i);
+        if (!_IsValid_Unicode(key)) {
+            if (strict) {
+                PyErr_SetString(TriezError, "key must be a valid unicode string.");
+                PyMem_Free(keys);
+                return 0;
+            }
+            PyErr_Clear();
+            keys[i].s = "";
+            keys[i].size = 0;
+            keys[i].char_size = 1;
+            keys[i].max_char = NULL;
+            continue;
         }
+        keys[i] = _PyUnicode_AS_TKEY(key);
+    }
+
+    if (nogil) {
+        Py_BEGIN_ALLOW_THREADS
+        e = _Trie_rdlock(self);
+        r = trie_search_many(self->ptrie, keys, n, out, sort);
+        _Trie_rdunlock(self, e);
+        Py_END_ALLOW_THREADS
+    } else {
+        r = trie_search_many(self->ptrie, keys, n, out, sort);
+    }
+    PyMem_Free(keys);
+    if (!r) {
+        PyErr_NoMemory();
+        return 0;
+    }
+
+    for (i=0;i<n;i++) {
+        if (!PyUnicode_Check(PySequence_Fast_GET_ITEM(seq, i))) {
+            out[i] = NULL;
+        }
+    }
+    return 1;
+}
+
+static PyObject *Trie_get_many(TrieObject *self, PyObject *args, 
+    PyObject *kwds)
+{
+    PyObject *keys, *def, *seq, *r, *v;
+    trie_node_t **out;
+    Py_ssize_t i, n;
+    int sort;
+    static char *kwlist[] = {"keys", "default", "sort", NULL};
+
+    def = Py_None;
+    sort = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|Oi", kwlist, &keys, &def, 
+        &sort)) {
+        return NULL;
+    }
+    seq = PySequence_Fast(keys, "get_many() needs an iterable of keys.");
+    if (!seq) {
+        return NULL;
+    }
+    n = PySequence_Fast_GET_SIZE(seq);
+    out = (trie_node_t **)PyMem_Malloc((n ? n : 1)*sizeof(trie_node_t *));
+    if (!out) {
+        Py_DECREF(seq);
+        return PyErr_NoMemory();
+    }
+
+    r = NULL;
+    // values are increfed, so the nodes are dereferenced with the GIL held.
+    if (_Trie_search_many(self, seq, out, 1, sort, 0)) {
+        r = PyList_New(n);
+    }
+    if (r) {
+        for (i=0;i<n;i++) {
+            v = out[i] ? (PyObject *)out[i]->value : def;
+            Py_INCREF(v);
+            PyList_SET_ITEM(r, i, v);
+        }
+    }
+
+    PyMem_Free(out);
+    Py_DECREF(seq);
+    return r;
+}
+
+static PyObject *Trie_contains_many(TrieObject *self, PyObject *args, 
+    PyObject *kwds)
+{
+    PyObject *keys, *seq, *r, *v;
+    trie_node_t **out;
+    Py_ssize_t i, n;
+    int sort;
+    static char *kwlist[] = {"keys", "sort", NULL};
+
+    sort = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", kwlist, &keys, &sort)) {
+        return NULL;
+    }
+
+    seq = PySequence_Fast(keys, "contains_many() needs an iterable of keys.");
+    if (!seq) {
+        return NULL;
+    }
+    n = PySequence_Fast_GET_SIZE(seq);
+    out = (trie_node_t **)PyMem_Malloc((n ? n : 1)*sizeof(trie_node_t *));
+    if (!out) {
+        Py_DECREF(seq);
+        return PyErr_NoMemory();
+    }
+
+    r = NULL;
+    if (_Trie_search_many(self, seq, out, 0, sort, 1)) {
+        r = PyList_New(n);
+    }
+    if (r) {
+        for (i=0;i<n;i++) {
+            v = out[i] ? Py_True : Py_False;
+            Py_INCREF(v);
+            PyList_SET_ITEM(r, i, v);
+        }
+    }
+
+    PyMem_Free(out);
+    Py_DECREF(seq);
+    return r;
+}
+
+// Gets the key and value of the ith element of items for _Trie_build. If val 
+// is not NULL, items are keys and all of them get val. Otherwise, the element 
+// is unpacked to pair, a new reference which keeps key and value alive.
+static int _build_item(PyObject *items, Py_ssize_t i, PyObject *val, 
+    PyObject **pair, PyObject **key, PyObject **v)
+{
+    PyObject *item;
+
+    item = PySequence_Fast_GET_ITEM(items, i);
+    *pair = NULL;
+    if (val) {
+        *key = item;
+        *v = val;
+    } else {
+        *pair = PySequence_Fast(item, "update() needs an iterable of (key, value) pairs.");
+        if (!*pair) {
+            return 0;
+        }
+        if (PySequence_Fast_GET_SIZE(*pair) != 2) {
+            PyErr_SetString(PyExc_ValueError, "update() needs an iterable of (key, value) pairs.");
+            return 0;
+        }
+        *key = PySequence_Fast_GET_ITEM(*pair, 0);
+        *v = PySequence_Fast_GET_ITEM(*pair, 1);
+    }
+
+    if (!_IsValid_Unicode(*key)) {
+        PyErr_SetString(TriezError, "key must be a valid unicode string.");
+        return 0;
+    }
+    return 1;
+}
+
+// A parallel build partitions the keys by their first char. Each partition is
+// built to a trie of its own by a thread that does not hold the GIL, and 
+// these are attached to the root at the end. (See trie_attach) First chars are
+// hashed to buckets, and buckets are spread over partitions by key count.
+#define BUILD_BUCKETS 1024
+#define BUILD_MAX_THREADS 64
+
+typedef struct {
+    Py_ssize_t count;
+    unsigned int id;
+} build_bucket_t;
+
+typedef struct {
+    trie_t *t;
+    trie_key_t *keys; // shared by all partitions
+    TRIE_DATA *values; // shared by all partitions
+    Py_ssize_t *order; // indexes of the keys of the partition, in given order
+    Py_ssize_t count;
+    int ok;
+    PyThread_type_lock done; // released when the partition is built
+} build_part_t;
+
+int _build_bucket_cmp(const void *a, const void *b)
+{
+    const build_bucket_t *x = (const build_bucket_t *)a;
+    const build_bucket_t *y = (const build_bucket_t *)b;
+
+    if (x->count != y->count) {
+        return x->count > y->count ? -1 : 1;
+    }
+    return x->id < y->id ? -1 : (x->id > y->id);
+}
+
+unsigned int _build_bucket(trie_key_t *k)
+{
+    TRIE_CHAR ch;
+
+    switch(k->char_size)
+    {
+        case 1:
+            ch = *(uint8_t *)k->s;
+            break;
+        case 2:
+            ch = *(uint16_t *)k->s;
+            break;
+        default:
+            ch = *(uint32_t *)k->s;
+            break;
+    }
+    return ch % BUILD_BUCKETS;
+}
+
+// Runs without the GIL. The value replaced by a key, if any, is written back
+// to values so that it can be released later.
+static void _build_part(void *arg)
+{
+    build_part_t *bp;
+    trie_builder_t *b;
+    TRIE_DATA old;
+    Py_ssize_t i, j;
+
+    bp = (build_part_t *)arg;
+    i = 0;
+    b = trie_builder_init(bp->t);
+    if (b) {
+        for (i=0;i<bp->count;i++) {
+            j = bp->order[i];
+            if (!trie_builder_add(b, &bp->keys[j], bp->values[j], &old)) {
+                break;
+            }
+            bp->values[j] = old;
+        }
+        trie_builder_deinit(b);
+    }
+    bp->ok = b && i == bp->count;
+    if (bp->done) {
+        PyThread_release_lock(bp->done);
+    }
+}
+
+// Returns 1 on success and 0 on error. Partitions can only be attached to an
+// empty trie, -1 is returned without adding anything if the trie is not empty.
+static int _Trie_build_parallel(TrieObject *self, PyObject *items, 
+    PyObject *val, int threads)
+{
+    Py_ssize_t i, j, n, count, nempty, *order;
+    PyObject **keyobjs, *pair, *key, *v;
+    trie_key_t *keys;
+    TRIE_DATA *values, old;
+    build_bucket_t *buckets;
+    build_part_t parts[BUILD_MAX_THREADS];
+    unsigned char part[BUILD_BUCKETS];
+    trie_t *t;
+    trie_node_t *w;
+    int p, q, r;
+
+    if (threads > BUILD_MAX_THREADS) {
+        threads = BUILD_MAX_THREADS;
+    }
+    count = PySequence_Fast_GET_SIZE(items);
+    memset(parts, 0, sizeof(parts));
+    n = 0;
+    r = 0;
+
+    keyobjs = (PyObject **)PyMem_Malloc((count ? count : 1)*sizeof(PyObject *));
+    keys = (trie_key_t *)PyMem_Malloc((count ? count : 1)*sizeof(trie_key_t));
+    values = (TRIE_DATA *)PyMem_Malloc((count ? count : 1)*sizeof(TRIE_DATA));
+    order = (Py_ssize_t *)PyMem_Malloc((count ? count : 1)*sizeof(Py_ssize_t));
+    buckets = (build_bucket_t *)PyMem_Malloc(BUILD_BUCKETS*sizeof(build_bucket_t));
+    if (!keyobjs || !keys || !values || !order || !buckets) {
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    // Python code might run while unpacking the items, nothing is locked yet.
+    // The threads read the keys without the GIL, so a reference is held to 
+    // every key until they are joined: the items and the pairs might be lists
+    // changed by another thread meanwhile.
+    for (i=0;i<BUILD_BUCKETS;i++) {
+        buckets[i].count = 0;
+        buckets[i].id = (unsigned int)i;
+    }
+    nempty = 0;
+    for (n=0;n<count;n++) {
+        if (!_build_item(items, n, val, &pair, &key, &v)) {
+            Py_XDECREF(pair);
+            goto out;
+        }
+        Py_INCREF(key);
+        keyobjs[n] = key;
+        keys[n] = _PyUnicode_AS_TKEY(key);
+        Py_INCREF(v);
+        values[n] = (TRIE_DATA)v;
+        Py_XDECREF(pair);
+        if (keys[n].size) {
+            buckets[_build_bucket(&keys[n])].count++;
+        } else {
+            nempty++;
+        }
+    }
+
+    // biggest buckets first, each to the partition with the fewest keys.
+    qsort(buckets, BUILD_BUCKETS, sizeof(build_bucket_t), _build_bucket_cmp);
+    for (i=0;i<BUILD_BUCKETS;i++) {
+        p = 0;
+        for (q=1;q<threads;q++) {
+            if (parts[q].count < parts[p].count) {
+                p = q;
+            }
+        }
+        parts[p].count += buckets[i].count;
+        part[buckets[i].id] = (unsigned char)p;
+    }
+
+    // order holds the empty keys first, which are added to the trie itself, 
+    // then the keys of every partition.
+    j = nempty;
+    for (p=0;p<threads;p++) {
+        parts[p].keys = keys;
+        parts[p].values = values;
+        parts[p].order = &order[j];
+        j += parts[p].count;
+        parts[p].count = 0;
+    }
+    nempty = 0;
+    for (i=0;i<count;i++) {
+        if (!keys[i].size) {
+            order[nempty++] = i;
+            continue;
+        }
+        p = part[_build_bucket(&keys[i])];
+        parts[p].order[parts[p].count++] = i;
+    }
+
+    _Trie_wrlock(self);
+    t = self->ptrie;
+    if (t->item_count) {
+        RWLOCK_WRUNLOCK(&self->lock);
+        r = -1;
+        goto out;
+    }
+    for (p=0;p<threads;p++) {
+        if (parts[p].count) {
+            parts[p].t = trie_create(t->flags);
+            if (!parts[p].t || !trie_reserve(parts[p].t, parts[p].count)) {
+                goto attach;
+            }
+        }
+    }
+
+    // the first partition is built by this thread, as well as the ones whose
+    // thread cannot be started.
+    for (p=1;p<threads;p++) {
+        if (!parts[p].count) {
+            continue;
+        }
+        parts[p].done = PyThread_allocate_lock();
+        if (!parts[p].done) {
+            continue;
+        }
+        PyThread_acquire_lock(parts[p].done, 1);
+        if ((unsigned long)PyThread_start_new_thread(_build_part, &parts[p]) == 
+            (unsigned long)-1) {
+            PyThread_release_lock(parts[p].done);
+            PyThread_free_lock(parts[p].done);
+            parts[p].done = NULL;
+        }
+    }
+    Py_BEGIN_ALLOW_THREADS
+    for (p=0;p<threads;p++) {
+        if (parts[p].t && !parts[p].done) {
+            _build_part(&parts[p]);
+        }
+    }
+    for (p=0;p<threads;p++) {
+        if (parts[p].done) {
+            PyThread_acquire_lock(parts[p].done, 1);
+            PyThread_free_lock(parts[p].done);
+        }
+    }
+    Py_END_ALLOW_THREADS
+
+attach:
+    r = 1;
+    for (p=0;p<threads;p++) {
+        if (!parts[p].count) {
+            continue;
+        }
+        if (r && parts[p].ok && trie_attach(t, parts[p].t)) {
+            parts[p].t = NULL;
+        } else {
+            r = 0;
+        }
+    }
+    for (i=0;r && i<nempty;i++) {
+        j = order[i];
+        w = trie_search(t, &keys[j]);
+        old = w ? w->value : 0;
+        if (!trie_add(t, &keys[j], values[j])) {
+            r = 0;
+            break;
+        }
+        values[j] = old;
+    }
+    RWLOCK_WRUNLOCK(&self->lock);
+
+    // partitions that are not attached are released with their values.
+    for (p=0;p<threads;p++) {
+        if (parts[p].t) {
+            trie_destroy(parts[p].t, _Trie_value_free);
+        }
+    }
+    if (!r) {
+        PyErr_SetString(TriezError, "key cannot be added.");
+    }
+
+out:
+    // values that are not held by the trie: the replaced ones, or all of them
+    // if the build did not run.
+    for (i=0;i<n;i++) {
+        if (values[i]) {
+            Py_DECREF((PyObject *)values[i]);
+        }
+        Py_DECREF(keyobjs[i]);
+    }
+    PyMem_Free(keyobjs);
+    PyMem_Free(keys);
+    PyMem_Free(values);
+    PyMem_Free(order);
+    PyMem_Free(buckets);
+    return r;
+}
+
+// Adds key/val pairs in items(a list or tuple) with the builder. If val is not
+// NULL, items are keys and all of them get val. Python code might run while 
+// replaced values are released or while a pair that is not a list or tuple is 
+// unpacked or while waiting for the trie lock, so the builder path is reset 
+// after that. If threads > 1 and the trie is empty, threads partitions are 
+// built in parallel instead.
+static int _Trie_build(TrieObject *self, PyObject *items, PyObject *val, 
+    int threads)
+{
+    trie_builder_t *b;
+    trie_key_t k;
+    PyObject *item, *pair, *key, *v;
+    TRIE_DATA old;
+    Py_ssize_t i, n;
+    int r;
+
+    if (!_Trie_writable(self)) {
+        return 0;
+    }
+    if (threads > 1 && !self->ptrie->item_count) {
+        r = _Trie_build_parallel(self, items, val, threads);
+        if (r >= 0) {
+            return r;
+        }
+    }
+
+    n = PySequence_Fast_GET_SIZE(items);
+    if (!self->ptrie->item_count) {
+        _Trie_wrlock(self);
+        r = trie_reserve(self->ptrie, n);
+        RWLOCK_WRUNLOCK(&self->lock);
+        if (!r) {
+            PyErr_NoMemory();
+            return 0;
+        }
+    }
+    b = trie_builder_init(self->ptrie);
+    if (!b) {
+        PyErr_NoMemory();
+        return 0;
+    }
+
+    for (i=0;i<n;i++) {
+        item = PySequence_Fast_GET_ITEM(items, i);
+        if (!val && !PyTuple_Check(item) && !PyList_Check(item)) {
+            trie_builder_reset(b);
+        }
+        if (!_build_item(items, i, val, &pair, &key, &v)) {
+            goto err;
+        }
+
+        k = _PyUnicode_AS_TKEY(key);
+        Py_INCREF(v);
+        if (!_Trie_wrlock(self)) {
+            trie_builder_reset(b);
+        }
+        r = trie_builder_add(b, &k, (TRIE_DATA)v, &old);
+        RWLOCK_WRUNLOCK(&self->lock);
+        if (!r) {
+            Py_DECREF(v);
+            PyErr_SetString(TriezError, "key cannot be added.");
+            goto err;
+        }
+        Py_XDECREF(pair);
+        if (old) {
+            Py_DECREF((PyObject *)old);
+            trie_builder_reset(b);
+        }
+    }
+
+    trie_builder_deinit(b);
+    return 1;
+err:
+    Py_XDECREF(pair);
+    trie_builder_deinit(b);
+    return 0;
+}
+
+// a list or tuple of key/value pairs from a mapping or an iterable of pairs.
+static PyObject *_Trie_items(PyObject *arg)
+{
+    if (PyDict_Check(arg)) {
+        return PyDict_Items(arg);
+    } else if (PyObject_HasAttrString(arg, "keys")) {
+        return PyMapping_Items(arg);
+    }
+    return PySequence_Fast(arg, "update() needs an iterable of (key, value) pairs.");
+}
+
+// T.update() accepts a mapping, or an iterable of key/value pairs and keyword
+// arguments like dict.update(). Keys are added in the given order, sorted 
+// keys are added fastest.
+static PyObject *Trie_update(TrieObject *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *arg, *items;
+    int r;
+
+    arg = NULL;
+    if (!PyArg_UnpackTuple(args, "update", 0, 1, &arg)) {
+        return NULL;
+    }
+
+    if (arg) {
+        items = _Trie_items(arg);
+        if (!items) {
+            return NULL;
+        }
+        r = _Trie_build(self, items, NULL, 0);
+        Py_DECREF(items);
+        if (!r) {
+            return NULL;
+        }
+    }
+
+    if (kwds) {
+        items = PyDict_Items(kwds);
+        if (!items) {
+            return NULL;
+        }
+        r = _Trie_build(self, items, NULL, 0);
+        Py_DECREF(items);
+        if (!r) {
+            return NULL;
+        }
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *Trie_fromkeys(PyObject *cls, PyObject *args, PyObject *kwds)
+{
+    PyObject *keys, *val, *items, *self;
+    int threads, r;
+    static char *kwlist[] = {"keys", "value", "threads", NULL};
+
+    val = Py_None;
+    threads = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|Oi", kwlist, &keys, &val, 
+        &threads)) {
+        return NULL;
+    }
+
+    self = PyObject_CallObject(cls, NULL);
+    if (!self) {
+        return NULL;
+    }
+    items = PySequence_Fast(keys, "fromkeys() needs an iterable of keys.");
+    if (!items) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    r = _Trie_build((TrieObject *)self, items, val, threads);
+    Py_DECREF(items);
+    if (!r) {
+        Py_DECREF(self);
+        return NULL;
+    }
+
+    return self;
+}
+
+static PyObject *Trie_fromitems(PyObject *cls, PyObject *args, PyObject *kwds)
+{
+    PyObject *arg, *items, *self;
+    int threads, r;
+    static char *kwlist[] = {"items", "threads", NULL};
+
+    threads = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", kwlist, &arg, 
+        &threads)) {
+        return NULL;
+    }
+
+    self = PyObject_CallObject(cls, NULL);
+    if (!self) {
+        return NULL;
+    }
+    items = _Trie_items(arg);
+    if (!items) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    r = _Trie_build((TrieObject *)self, items, NULL, threads);
+    Py_DECREF(items);
+    if (!r) {
+        Py_DECREF(self);
+        return NULL;
+    }
+
+    return self;
+}
+
+// Values are saved with marshal, so only the types supported by marshal can be
+// saved.
+static long _Trie_write_value(TRIE_DATA value, FILE *fp)
+{
+    PyObject *b;
+    Py_ssize_t size;
+
+    b = PyMarshal_WriteObjectToString((PyObject *)value, Py_MARSHAL_VERSION);
+    if (!b) {
+        return -1;
+    }
+    size = PyBytes_GET_SIZE(b);
+    if (fwrite(PyBytes_AS_STRING(b), 1, size, fp) != (size_t)size) {
+        Py_DECREF(b);
+        return -1;
+    }
+    Py_DECREF(b);
+    return (long)size;
+}
+
+int _parse_path(PyObject *args, PyObject **pathobj, char **path)
+{
+#ifdef IS_PY3K
+    if (!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, pathobj)) {
+        return 0;
+    }
+    *path = PyBytes_AS_STRING(*pathobj);
+#else
+    if (!PyArg_ParseTuple(args, "s", path)) {
+        return 0;
+    }
+    *pathobj = NULL;
+#endif
+    return 1;
+}
+
+static PyObject *Trie_save(TrieObject *self, PyObject *args)
+{
+    PyObject *pathobj;
+    char *path;
+    int r;
+
+    if (!_parse_path(args, &pathobj, &path)) {
+        return NULL;
+    }
+
+    errno = 0;
+    r = trie_save(self->ptrie, path, _Trie_write_value);
+    if (!r && !PyErr_Occurred()) {
+        if (errno) {
+            PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+        } else {
+            PyErr_SetString(TriezError, "trie cannot be saved.");
+        }
+    }
+    Py_XDECREF(pathobj);
+    if (!r) {
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject* Trie_mem_usage(TrieObject* self)
+{
+    return Py_BuildValue("l", trie_mem_usage(self->ptrie));
+}
+
+static PyObject* Trie_node_count(TrieObject* self)
+{
+    return Py_BuildValue("l", self->ptrie->node_count);
+}
+
+// {n: h[n]} for the non-zero entries of a histogram.
+static PyObject *_hist_dict(unsigned long *h, unsigned long size)
+{
+    PyObject *d, *k, *v;
+    unsigned long i;
+    int r;
+
+    d = PyDict_New();
+    if (!d) {
+        return NULL;
+    }
+    for (i=0;i<size;i++) {
+        if (!h[i]) {
+            continue;
+        }
+        k = PyLong_FromUnsignedLong(i);
+        v = PyLong_FromUnsignedLong(h[i]);
+        r = k && v ? PyDict_SetItem(d, k, v) : -1;
+        Py_XDECREF(k);
+        Py_XDECREF(v);
+        if (r < 0) {
+            Py_DECREF(d);
+            return NULL;
+        }
+    }
+    return d;
+}
+
+static PyObject *Trie_stats(TrieObject *self)
+{
+    trie_stats_t st;
+    PyObject *fanout, *depth, *r;
+#ifdef TRIE_STATS
+    PyObject *counters;
+#endif
+
+    if (!trie_stats(self->ptrie, &st)) {
+        return PyErr_NoMemory();
+    }
+    r = NULL;
+    fanout = _hist_dict(st.fanout, st.fanout_size);
+    depth = _hist_dict(st.depth, st.depth_size);
+    if (fanout && depth) {
+        r = Py_BuildValue("{s:k,s:k,s:k,s:O,s:O,s:{s:k,s:k,s:k},s:k,s:k,"
+            "s:k,s:k,s:k,s:k,s:k,s:k,s:k,s:k}", 
+            "nodes", st.nodes, 
+            "terminal_nodes", st.terminal, 
+            "nonterminal_nodes", st.nodes - st.terminal, 
+            "fanout", fanout, 
+            "depth", depth, 
+            "indexes", "node16", st.indexes[0], "node48", st.indexes[1], 
+                "node256", st.indexes[2], 
+            "tails", st.tails, 
+            "tail_chars", st.tail_chars, 
+            "slabs", st.slabs, 
+            "slab_nodes", st.slab_nodes, 
+            "free_nodes", st.free_nodes, 
+            "retired", st.retired, 
+            "overhead", st.overhead, 
+            "node_size", (unsigned long)sizeof(trie_node_t), 
+            "mem_usage", trie_mem_usage(self->ptrie), 
+            "automaton_states", st.ac_states);
+    }
+#ifdef TRIE_STATS
+    if (r) {
+        counters = Py_BuildValue("{s:k,s:k,s:k,s:k,s:k}", 
+            "walks", trie_counters.walks, 
+            "steps", trie_counters.steps, 
+            "index_lookups", trie_counters.index_lookups, 
+            "sibling_hops", trie_counters.sibling_hops, 
+            "dl_edges", trie_counters.dl_edges);
+        // PyDict_SetItemString() does not steal the reference.
+        if (!counters || PyDict_SetItemString(r, "counters", counters) < 0) {
+            Py_CLEAR(r);
+        }
+        Py_XDECREF(counters);
+    }
+#endif
+    Py_XDECREF(fanout);
+    Py_XDECREF(depth);
+    trie_stats_free(&st);
+    return r;
+}
+
+static void _Trie_value_free(TRIE_DATA value)
+{
+    Py_DECREF((PyObject *)value);
+}
+
+// Copies of the nodes of a trie with snapshots hold a reference to the value.
+static void _Trie_value_ref(TRIE_DATA value)
+{
+    Py_INCREF((PyObject *)value);
+}
+
+// Values released by the last snapshot of a trie are collected here while the
+// trie is locked, and released after the unlock as they might run Python code.
+// The buffer is allocated under the lock before trie_destroy(), by 
+// PyMem_Malloc() which does not run the GC. If there is no memory for it, 
+// values that have other references are released under the lock, which runs 
+// no Python code, and the rest are leaked rather than released there.
+typedef struct {
+    PyObject **items;
+    unsigned long count;
+    unsigned long size;
+} released_values_t;
+
+static released_values_t _released_values;
+
+static void _Trie_value_release(TRIE_DATA value)
+{
+    if (_released_values.count < _released_values.size) {
+        _released_values.items[_released_values.count++] = (PyObject *)value;
+    } else if (Py_REFCNT((PyObject *)value) > 1) {
+        Py_DECREF((PyObject *)value);
+    }
+}
+
+static void Trie_dealloc(TrieObject* self)
+{
+    TrieObject *origin;
+    released_values_t released;
+    unsigned long i, n;
+
+    if (self->ptrie && self->origin) {
+        origin = (TrieObject *)self->origin;
+        _Trie_wrlock(origin);
+        // the bound is taken under the lock, other snapshots might be made
+        // or released while _Trie_wrlock() waits.
+        n = trie_destroy_values_max(self->ptrie);
+        released.items = NULL;
+        if (n) {
+            released.items = (PyObject **)PyMem_Malloc(n * sizeof(PyObject *));
+        }
+        released.count = 0;
+        released.size = released.items ? n : 0;
+        _released_values = released;
+        trie_destroy(self->ptrie, _Trie_value_release);
+        released = _released_values;
+        _released_values.items = NULL;
+        _released_values.count = _released_values.size = 0;
+        RWLOCK_WRUNLOCK(&origin->lock);
+        for (i=0;i<released.count;i++) {
+            Py_DECREF(released.items[i]);
+        }
+        if (released.items) {
+            PyMem_Free(released.items);
+        }
+        RWLOCK_DESTROY(&self->lock);
+        Py_DECREF(origin);
+    } else if (self->ptrie) {
+        trie_destroy(self->ptrie, _Trie_value_free);
+        RWLOCK_DESTROY(&self->lock);
+    }
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+// T.compact() reclaims the nodes left by the lazy deletes of T, and releases
+// the slabs left with no nodes in use. (See Note 10 in trie.h)
+static PyObject *Trie_compact(TrieObject *self)
+{
+    unsigned long n;
+
+    if (!_Trie_writable(self)) {
+        return NULL;
+    }
+    _Trie_wrlock(self);
+    n = trie_compact(self->ptrie);
+    RWLOCK_WRUNLOCK(&self->lock);
+
+    return PyLong_FromUnsignedLong(n);
+}
+
+// T.snapshot() is O(1), writers of T copy the nodes they change afterwards. 
+// (See Note 9 in trie.h)
+static PyObject *Trie_snapshot(TrieObject *self)
+{
+    TrieObject *r, *origin;
+
+    origin = self->origin ? (TrieObject *)self->origin : self;
+    r = (TrieObject *)Py_TYPE(self)->tp_alloc(Py_TYPE(self), 0);
+    if (!r) {
+        return NULL;
+    }
+    if (RWLOCK_INIT(&r->lock) != 0) {
+        Py_DECREF(r);
+        return PyErr_NoMemory();
+    }
+    _Trie_wrlock(origin);
+    r->ptrie = trie_snapshot(self->ptrie, _Trie_value_ref);
+    RWLOCK_WRUNLOCK(&origin->lock);
+    if (!r->ptrie) {
+        RWLOCK_DESTROY(&r->lock);
+        Py_DECREF(r);
+        return PyErr_NoMemory();
+    }
+    Py_INCREF(origin);
+    r->origin = (PyObject *)origin;
+
+    return (PyObject *)r;
+}
+
+static PyObject *Trie_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    TrieObject *self;
+    int compressed, lazy_delete;
+    static char *kwlist[] = {"compressed", "lazy_delete", NULL};
+
+    compressed = 0;
+    lazy_delete = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|ii", kwlist, &compressed, 
+        &lazy_delete)) {
+        return NULL;
+    }
+
+    self = (TrieObject *)type->tp_alloc(type, 0);
+    if (self != NULL) {
+        if (RWLOCK_INIT(&self->lock) != 0) {
+            Py_DECREF(self);
+            return PyErr_NoMemory();
+        }
+        self->ptrie = trie_create((compressed ? TRIE_COMPRESSED : 0) | 
+            (lazy_delete ? TRIE_LAZY_DELETE : 0));
+        if (!self->ptrie) {
+            RWLOCK_DESTROY(&self->lock);
+            Py_DECREF(self);
+            return NULL;
+        }
+    }
+
+    return (PyObject *)self;
+}
+
+// Return 1 if `key` is in trie `op`, 0 if not, and -1 on error. 
+int Trie_contains(PyObject *op, PyObject *key)
+{
+    trie_key_t k;
+    TrieObject *mp;
+    
+    mp = (TrieObject *)op;
+    
+    if (!_IsValid_Unicode(key)) {
+        return 0; // do not return exception here.
+    }
+    
+    k = _PyUnicode_AS_TKEY(key);
+    
+    if(!trie_search(mp->ptrie, &k)) {
+        return 0;
+    }
+    
+    return 1;
+}
+
+// Count of the keys starting with prefix, without enumerating them.
+static unsigned long _Trie_count_suffixes(TrieObject *self, PyObject *args, 
+    int *err)
+{
+    PyObject *pfx;
+    trie_key_t k;
+
+    *err = 1;
+    if (!PyArg_ParseTuple(args, "O", &pfx)) {
+        return 0;
+    }
+    if (!_IsValid_Unicode(pfx)) {
+        PyErr_SetString(TriezError, "key must be a valid unicode string.");
+        return 0;
+    }
+    k = _PyUnicode_AS_TKEY(pfx);
+    *err = 0;
+
+    return trie_count_suffixes(self->ptrie, &k);
+}
+
+static PyObject *Trie_count_suffixes(TrieObject *self, PyObject *args)
+{
+    unsigned long n;
+    int err;
+
+    n = _Trie_count_suffixes(self, args, &err);
+    if (err) {
+        return NULL;
+    }
+    return PyLong_FromUnsignedLong(n);
+}
+
+static PyObject *Trie_has_any_suffix(TrieObject *self, PyObject *args)
+{
+    unsigned long n;
+    int err;
+
+    n = _Trie_count_suffixes(self, args, &err);
+    if (err) {
+        return NULL;
+    }
+    return PyBool_FromLong(n > 0);
+}
+
+// Occurrences found by trie_ac_find_all(). Values are increfed as they are 
+// found, nothing that may run Python code is called during the scan.
+typedef struct {
+    unsigned long *pos; // start and end of every occurrence
+    PyObject **values;
+    unsigned long count;
+    unsigned long alloc;
+} matchbuf_t;
+
+int _collect_match(unsigned long start, unsigned long end, TRIE_DATA value, 
+    void *arg)
+{
+    matchbuf_t *mb;
+    unsigned long *pos;
+    PyObject **values;
+    unsigned long alloc;
+
+    mb = (matchbuf_t *)arg;
+    if (mb->count == mb->alloc) {
+        alloc = mb->alloc ? mb->alloc * 2 : 64;
+        pos = (unsigned long *)PyMem_Realloc(mb->pos, 
+            alloc * 2 * sizeof(unsigned long));
+        if (!pos) {
+            return 0;
+        }
+        mb->pos = pos;
+        values = (PyObject **)PyMem_Realloc(mb->values, 
+            alloc * sizeof(PyObject *));
+        if (!values) {
+            return 0;
+        }
+        mb->values = values;
+        mb->alloc = alloc;
+    }
+    mb->pos[mb->count*2] = start;
+    mb->pos[mb->count*2+1] = end;
+    mb->values[mb->count] = (PyObject *)value;
+    Py_INCREF(mb->values[mb->count]);
+    mb->count++;
+    return 1;
+}
+
+static PyObject *Trie_compile(TrieObject *self)
+{
+    if (!trie_ac_compile(self->ptrie)) {
+        return PyErr_NoMemory();
+    }
+    Py_RETURN_NONE;
+}
+
+// Every occurrence of a key in text, in a single pass over it. (See Note 8 in
+// trie.h) The GIL is held, the automaton is dropped by writers.
+static PyObject *Trie_find_all(TrieObject *self, PyObject *args)
+{
+    PyObject *text, *r, *item;
+    trie_key_t k;
+    matchbuf_t mb;
+    unsigned long i;
+
+    if (!PyArg_ParseTuple(args, "O", &text)) {
+        return NULL;
+    }
+    if (!_IsValid_Unicode(text)) {
+        PyErr_SetString(TriezError, "text must be a valid unicode string.");
+        return NULL;
+    }
+    k = _PyUnicode_AS_TKEY(text);
+
+    memset(&mb, 0, sizeof(matchbuf_t));
+    r = NULL;
+    i = 0;
+    if (!trie_ac_find_all(self->ptrie, &k, _collect_match, &mb)) {
+        PyErr_NoMemory();
+        goto out;
+    }
+    r = PyList_New(mb.count);
+    if (!r) {
+        goto out;
+    }
+    for (;i<mb.count;i++) {
+        // the value reference is stolen.
+        item = Py_BuildValue("(kkN)", mb.pos[i*2], mb.pos[i*2+1], 
+            mb.values[i]);
+        if (!item) {
+            Py_CLEAR(r);
+            i++;
+            break;
+        }
+        PyList_SET_ITEM(r, i, item);
+    }
+
+out:
+    for (;i<mb.count;i++) {
+        Py_DECREF(mb.values[i]);
+    }
+    PyMem_Free(mb.pos);
+    PyMem_Free(mb.values);
+    return r;
+}
+
+// (length, value) of the longest (or shortest) key in T that is a prefix of 
+// s[offset:], None if there is none. A single descent, no set is built.
+static PyObject *_Trie_prefix_match(TrieObject *self, PyObject *args, 
+    PyObject *kwds, int longest)
+{
+    static char *kwlist[] = {"s", "offset", NULL};
+    PyObject *str;
+    Py_ssize_t offset;
+    trie_key_t k;
+    trie_node_t *nd;
+    unsigned long length;
+
+    offset = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|n", kwlist, &str, 
+        &offset)) {
+        return NULL;
+    }
+    if (!_IsValid_Unicode(str)) {
+        PyErr_SetString(TriezError, "key must be a valid unicode string.");
+        return NULL;
+    }
+    k = _PyUnicode_AS_TKEY(str);
+    if (offset < 0 || (unsigned long)offset > k.size) {
+        PyErr_SetString(PyExc_IndexError, "offset out of range.");
+        return NULL;
+    }
+
+    nd = trie_prefix_match(self->ptrie, &k, (unsigned long)offset, longest, 
+        &length);
+    if (!nd) {
+        Py_RETURN_NONE;
+    }
+    return Py_BuildValue("(kO)", length, (PyObject *)nd->value);
+}
+
+static PyObject *Trie_longest_prefix(TrieObject *self, PyObject *args, 
+    PyObject *kwds)
+{
+    return _Trie_prefix_match(self, args, kwds, 1);
+}
+
+static PyObject *Trie_shortest_prefix(TrieObject *self, PyObject *args, 
+    PyObject *kwds)
+{
+    return _Trie_prefix_match(self, args, kwds, 0);
+}
+
+// The ordered queries, None if there is no such key.
+static PyObject *_Trie_order_result(trie_node_t *nd, trie_key_t *out)
+{
+    PyObject *r;
+
+    if (nd) {
+        r = _TKEY_AS_PyUnicode(out);
+    } else {
+        r = Py_None;
+        Py_INCREF(r);
+    }
+    PyMem_Free(out->s);
+    return r;
+}
+
+static PyObject *Trie_first(TrieObject *self)
+{
+    trie_key_t out;
+
+    out.s = NULL;
+    if (!_order_key_grow(&out, self->ptrie->height)) {
+        return NULL;
+    }
+    return _Trie_order_result(trie_first(self->ptrie, &out), &out);
+}
+
+static PyObject *Trie_last(TrieObject *self)
+{
+    trie_key_t out;
+
+    out.s = NULL;
+    if (!_order_key_grow(&out, self->ptrie->height)) {
+        return NULL;
+    }
+    return _Trie_order_result(trie_last(self->ptrie, &out), &out);
+}
+
+static PyObject *_Trie_neighbour(TrieObject *self, PyObject *args, 
+    PyObject *kwds, int successor)
+{
+    static char *kwlist[] = {"key", "inclusive", NULL};
+    PyObject *key;
+    trie_key_t k, out;
+    trie_node_t *nd;
+    int inclusive;
+
+    inclusive = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", kwlist, &key, 
+        &inclusive)) {
+        return NULL;
+    }
+    if (!_IsValid_Unicode(key)) {
+        PyErr_SetString(TriezError, "key must be a valid unicode string.");
+        return NULL;
+    }
+    k = _PyUnicode_AS_TKEY(key);
+
+    out.s = NULL;
+    if (!_order_key_grow(&out, self->ptrie->height > k.size ? 
+        self->ptrie->height : k.size)) {
+        return NULL;
     }
+    if (successor) {
+        nd = trie_successor(self->ptrie, &k, inclusive, &out);
+    } else {
+        nd = trie_predecessor(self->ptrie, &k, inclusive, &out);
+    }
+    return _Trie_order_result(nd, &out);
+}
 
-    return (PyObject *)self;
+static PyObject *Trie_successor(TrieObject *self, PyObject *args, 
+    PyObject *kwds)
+{
+    return _Trie_neighbour(self, args, kwds, 1);
 }
 
-// Return 1 if `key` is in trie `op`, 0 if not, and -1 on error. 
-int Trie_contains(PyObject *op, PyObject *key)
+static PyObject *Trie_predecessor(TrieObject *self, PyObject *args, 
+    PyObject *kwds)
 {
-    trie_key_t k;
-    TrieObject *mp;
-    
-    mp = (TrieObject *)op;
-    
-    if (!_IsValid_Unicode(key)) {
-        return 0; // do not return exception here.
+    return _Trie_neighbour(self, args, kwds, 0);
+}
+
+static PyObject *Trie_iter_range(TrieObject *self, PyObject *args, 
+    PyObject *kwds)
+{
+    static char *kwlist[] = {"lo", "hi", "items", NULL};
+    PyObject *lo, *hi;
+    TrieRangeIteratorObject *tro;
+    Py_ssize_t size;
+    int items;
+
+    lo = hi = Py_None;
+    items = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OOi", kwlist, &lo, &hi, 
+        &items)) {
+        return NULL;
     }
-    
-    k = _PyUnicode_AS_TKEY(key);
-    
-    if(!trie_search(mp->ptrie, &k)) {
-        return 0;
+    if ((lo != Py_None && !_IsValid_Unicode(lo)) || 
+        (hi != Py_None && !_IsValid_Unicode(hi))) {
+        PyErr_SetString(TriezError, "key must be a valid unicode string.");
+        return NULL;
     }
-    
-    return 1;
+
+    tro = PyObject_GC_New(TrieRangeIteratorObject, &TrieRangeIteratorType);
+    if (tro == NULL) {
+        return NULL;
+    }
+    tro->_trieobj = self;
+    Py_INCREF(self);
+    tro->hi = hi != Py_None ? hi : NULL;
+    Py_XINCREF(tro->hi);
+    tro->key.s = tro->next.s = NULL;
+    tro->started = tro->done = 0;
+    tro->items = items;
+    PyObject_GC_Track(tro);
+
+    size = lo != Py_None ? TriezUnicode_Size(lo) : 0;
+    if (!_order_key_grow(&tro->key, size)) {
+        Py_DECREF(tro);
+        return NULL;
+    }
+    tro->key.size = size;
+    if (size) {
+#ifdef IS_PEP393_AVAILABLE
+        PyUnicode_AsUCS4(lo, (Py_UCS4 *)tro->key.s, size, 0);
+#else
+        memcpy(tro->key.s, TriezUnicode(lo), size * TRIEZ_KEY_CHAR_SIZE);
+#endif
+    }
+
+    return (PyObject *)tro;
 }
 
 static PyObject *_create_iterator(TrieObject *trieobj, trie_key_t *key, 
-    unsigned long max_depth, trie_iter_init_func_t init_func, 
-    trie_iter_next_func_t next_func, trie_iter_reset_func_t reset_func,
-    trie_iter_deinit_func_t deinit_func)
+    unsigned long max_depth, unsigned long chunk, int items, 
+    trie_iter_init_func_t init_func, trie_iter_next_func_t next_func, 
+    trie_iter_reset_func_t reset_func, trie_iter_deinit_func_t deinit_func)
 {
     TrieIteratorObject *tio;
     
@@ -322,30 +2154,25 @@ static PyObject *_create_iterator(TrieObject *trieobj, trie_key_t *key,
     tio->iter_next_func = next_func;
     tio->iter_reset_func = reset_func;
     tio->iter_deinit_func = deinit_func;
+    tio->chunk = chunk;
+    tio->items = items;
     tio->_iter = init_func(trieobj->ptrie, key, max_depth);
 
     return (PyObject *)tio;
 }
 
-int _parse_traverse_args(TrieObject *t, PyObject *args, trie_key_t *k, 
-    unsigned long *d)
+// Sets k to the traversal key pfx (empty if NULL) and d to max_depth.
+int _traverse_key(unsigned long height, PyObject *pfx, unsigned long max_depth,
+    trie_key_t *k, unsigned long *d)
 {
-    PyObject *pfx;
-    unsigned long max_depth;
 #ifdef IS_PEP393_AVAILABLE
     Py_UCS4 *_ucs4_buf;
 #endif
 
-    max_depth = 0;
-    pfx = NULL;
-    if (!PyArg_ParseTuple(args, "|Ok", &pfx, &max_depth)) {
-        return 0;
-    }
-
     // if max_depth == zero, set it to trie height which is the max. possible
     // depth. 
-    if(!max_depth || max_depth > t->ptrie->height) {
-        max_depth = t->ptrie->height;
+    if(!max_depth || max_depth > height) {
+        max_depth = height;
     }
     *d = max_depth;
     
@@ -372,6 +2199,7 @@ int _parse_traverse_args(TrieObject *t, PyObject *args, trie_key_t *k,
         k->s = (char *)_ucs4_buf;
         k->size = TriezUnicode_Size(pfx);
         k->char_size = sizeof(Py_UCS4);
+        k->max_char = NULL;
 #else
         *k = _PyUnicode_AS_TKEY(pfx);
 #endif
@@ -380,101 +2208,174 @@ int _parse_traverse_args(TrieObject *t, PyObject *args, trie_key_t *k,
     return 1;
 }
 
-int _enum_keys(trie_key_t *k, void *arg)
+int _parse_traverse_args(unsigned long height, PyObject *args, trie_key_t *k, 
+    unsigned long *d)
+{
+    PyObject *pfx;
+    unsigned long max_depth;
+
+    max_depth = 0;
+    pfx = NULL;
+    if (!PyArg_ParseTuple(args, "|Ok", &pfx, &max_depth)) {
+        return 0;
+    }
+    return _traverse_key(height, pfx, max_depth, k, d);
+}
+
+// iter_*() take the traversal args, and chunk/items for the returned 
+// iterator. (See Trieiter_next)
+int _parse_iter_args(unsigned long height, PyObject *args, PyObject *kwds, 
+    trie_key_t *k, unsigned long *d, unsigned long *chunk, int *items)
 {
-    PySet_Add((PyObject *)arg, _TKEY_AS_PyUnicode(k));
+    PyObject *pfx;
+    unsigned long max_depth;
+    static char *kwlist[] = {"key", "max_depth", "chunk", "items", NULL};
 
-    return 0;
+    max_depth = 0;
+    pfx = NULL;
+    *chunk = 0;
+    *items = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Okki", kwlist, &pfx, 
+        &max_depth, chunk, items)) {
+        return 0;
+    }
+    return _traverse_key(height, pfx, max_depth, k, d);
 }
 
 static PyObject *Trie_suffixes(PyObject* selfobj, PyObject *args)
 {
+    TrieObject *self;
     trie_key_t k;
-    unsigned long max_depth;
-    PyObject *sfxs;
+    unsigned long max_depth, e;
+    keybuf_t kb;
 
-    if (!_parse_traverse_args((TrieObject *)selfobj, args, &k, &max_depth))
-    {
+    self = (TrieObject *)selfobj;
+    if (!_parse_traverse_args(self->ptrie->height, args, &k, &max_depth)) {
         return NULL;
     }
-    
-    sfxs = PySet_New(0);
-    trie_suffixes(((TrieObject *)selfobj)->ptrie, &k, max_depth, _enum_keys, sfxs);
-    
-    return sfxs;
+
+    memset(&kb, 0, sizeof(keybuf_t));
+    Py_BEGIN_ALLOW_THREADS
+    e = _Trie_rdlock(self);
+    trie_suffixes(self->ptrie, &k, max_depth, _collect_keys, &kb);
+    _Trie_rdunlock(self, e);
+    Py_END_ALLOW_THREADS
+
+    return _keybuf_result(&kb, PySet_New(0));
 }
 
-static PyObject *Trie_itersuffixes(PyObject* selfobj, PyObject *args)
+static PyObject *Trie_itersuffixes(PyObject* selfobj, PyObject *args, 
+    PyObject *kwds)
 {
     trie_key_t k;
-    unsigned long max_depth;
+    unsigned long max_depth, chunk;
+    int items;
 
-    if (!_parse_traverse_args((TrieObject *)selfobj, args, &k, &max_depth)) {
+    if (!_parse_iter_args(((TrieObject *)selfobj)->ptrie->height, args, kwds, 
+        &k, &max_depth, &chunk, &items)) {
         return NULL;
     }
 
-    return _create_iterator((TrieObject *)selfobj, &k, max_depth, 
+    return _create_iterator((TrieObject *)selfobj, &k, max_depth, chunk, items,
         trie_itersuffixes_init, trie_itersuffixes_next, trie_itersuffixes_reset, trie_itersuffixes_deinit);
 }
 
 static PyObject *Trie_prefixes(PyObject* selfobj, PyObject *args)
 {
+    TrieObject *self;
     trie_key_t k;
-    unsigned long max_depth;
-    PyObject *sfxs;
+    unsigned long max_depth, e;
+    keybuf_t kb;
 
-    if (!_parse_traverse_args((TrieObject *)selfobj, args, &k, &max_depth))
-    {
+    self = (TrieObject *)selfobj;
+    if (!_parse_traverse_args(self->ptrie->height, args, &k, &max_depth)) {
         return NULL;
     }
-    
-    sfxs = PySet_New(0);
-    trie_prefixes(((TrieObject *)selfobj)->ptrie, &k, max_depth, _enum_keys, sfxs);
-    
-    return sfxs;
+
+    memset(&kb, 0, sizeof(keybuf_t));
+    Py_BEGIN_ALLOW_THREADS
+    e = _Trie_rdlock(self);
+    trie_prefixes(self->ptrie, &k, max_depth, _collect_keys, &kb);
+    _Trie_rdunlock(self, e);
+    Py_END_ALLOW_THREADS
+
+    return _keybuf_result(&kb, PySet_New(0));
 }
 
-static PyObject *Trie_iterprefixes(PyObject* selfobj, PyObject *args)
+static PyObject *Trie_iterprefixes(PyObject* selfobj, PyObject *args, 
+    PyObject *kwds)
 {
     trie_key_t k;
-    unsigned long max_depth;
+    unsigned long max_depth, chunk;
+    int items;
 
-    if (!_parse_traverse_args((TrieObject *)selfobj, args, &k, &max_depth)) {
+    if (!_parse_iter_args(((TrieObject *)selfobj)->ptrie->height, args, kwds, 
+        &k, &max_depth, &chunk, &items)) {
         return NULL;
     }
 
-    return _create_iterator((TrieObject *)selfobj, &k, max_depth, 
+    return _create_iterator((TrieObject *)selfobj, &k, max_depth, chunk, items,
         trie_iterprefixes_init, trie_iterprefixes_next, trie_iterprefixes_reset, 
         trie_iterprefixes_deinit);
 }
 
 static PyObject *Trie_corrections(PyObject* selfobj, PyObject *args)
 {
+    TrieObject *self;
     trie_key_t k;
-    unsigned long max_depth;
-    PyObject *sfxs;
+    unsigned long max_depth, e;
+    keybuf_t kb;
 
-    if (!_parse_traverse_args((TrieObject *)selfobj, args, &k, &max_depth))
-    {
+    self = (TrieObject *)selfobj;
+    if (!_parse_traverse_args(self->ptrie->height, args, &k, &max_depth)) {
         return NULL;
     }
-    
-    sfxs = PySet_New(0);
-    trie_corrections(((TrieObject *)selfobj)->ptrie, &k, max_depth, _enum_keys, sfxs);
-    
-    return sfxs;
+
+    memset(&kb, 0, sizeof(keybuf_t));
+    Py_BEGIN_ALLOW_THREADS
+    e = _Trie_rdlock(self);
+    trie_corrections(self->ptrie, &k, max_depth, _collect_distances, &kb);
+    _Trie_rdunlock(self, e);
+    Py_END_ALLOW_THREADS
+
+    return _keybuf_result(&kb, PySet_New(0));
 }
 
-static PyObject *Trie_itercorrections(PyObject* selfobj, PyObject *args)
+static PyObject *Trie_corrections_with_distances(PyObject* selfobj, PyObject *args)
 {
+    TrieObject *self;
     trie_key_t k;
-    unsigned long max_depth;
+    unsigned long max_depth, e;
+    keybuf_t kb;
+
+    self = (TrieObject *)selfobj;
+    if (!_parse_traverse_args(self->ptrie->height, args, &k, &max_depth)) {
+        return NULL;
+    }
+
+    memset(&kb, 0, sizeof(keybuf_t));
+    Py_BEGIN_ALLOW_THREADS
+    e = _Trie_rdlock(self);
+    trie_corrections(self->ptrie, &k, max_depth, _collect_distances, &kb);
+    _Trie_rdunlock(self, e);
+    Py_END_ALLOW_THREADS
+
+    return _keybuf_result(&kb, PyDict_New());
+}
 
-    if (!_parse_traverse_args((TrieObject *)selfobj, args, &k, &max_depth)) {
+static PyObject *Trie_itercorrections(PyObject* selfobj, PyObject *args, 
+    PyObject *kwds)
+{
+    trie_key_t k;
+    unsigned long max_depth, chunk;
+    int items;
+
+    if (!_parse_iter_args(((TrieObject *)selfobj)->ptrie->height, args, kwds, 
+        &k, &max_depth, &chunk, &items)) {
         return NULL;
     }
 
-    return _create_iterator((TrieObject *)selfobj, &k, max_depth, 
+    return _create_iterator((TrieObject *)selfobj, &k, max_depth, chunk, items,
         trie_itercorrections_init, trie_itercorrections_next, 
         trie_itercorrections_reset, trie_itercorrections_deinit);
 }
@@ -490,13 +2391,14 @@ PyObject *Trie_iter(PyObject *obj)
     // create an empty string
     k.s = "";
     k.size = 0;
+    k.max_char = NULL;
 #ifdef IS_PEP393_AVAILABLE
     k.char_size = sizeof(Py_UCS4);
 #else
     k.char_size = sizeof(Py_UNICODE);
 #endif
     
-    return _create_iterator(self, &k, self->ptrie->height, 
+    return _create_iterator(self, &k, self->ptrie->height, 0, 0,
         trie_itersuffixes_init, trie_itersuffixes_next, trie_itersuffixes_reset, trie_itersuffixes_deinit);
 }
 
@@ -525,18 +2427,64 @@ static PyMethodDef Trie_methods[] = {
         "Memory usage of the trie. Used for debugging purposes."},
     {"node_count", (PyCFunction)Trie_node_count, METH_NOARGS, 
         "Node count of the trie. Used for debugging purposes."},
-    {"iter_suffixes", Trie_itersuffixes, METH_VARARGS, 
-        "T.iter_suffixes() -> a set-like object providing a view on T's suffixes"},
+    {"stats", (PyCFunction)Trie_stats, METH_NOARGS, 
+        "T.stats() -> a dict of the shape and memory statistics of T: fan-out and depth histograms, terminal/non-terminal nodes, indexes and allocator overhead. Hot path counters are included if built with TRIE_STATS."},
+    {"iter_suffixes", (PyCFunction)Trie_itersuffixes, METH_VARARGS | METH_KEYWORDS, 
+        "T.iter_suffixes([key][,max_depth][,chunk][,items]) -> a set-like object providing a view on T's suffixes. If chunk is set, lists of up to chunk keys are yielded. If items is set, (key, value) tuples are yielded instead of keys."},
     {"suffixes", Trie_suffixes, METH_VARARGS, 
         "T.suffixes() -> a list containing T's suffixes"},
-    {"iter_prefixes", Trie_iterprefixes, METH_VARARGS, 
-        "T.iter_prefixes() -> a set-like object providing a view on T's prefixes"},
+    {"iter_prefixes", (PyCFunction)Trie_iterprefixes, METH_VARARGS | METH_KEYWORDS, 
+        "T.iter_prefixes([key][,max_depth][,chunk][,items]) -> a set-like object providing a view on T's prefixes. chunk and items are as in T.iter_suffixes()."},
     {"prefixes", Trie_prefixes, METH_VARARGS, 
         "T.prefixes() -> a list containing T's prefixes"},
-    {"iter_corrections", Trie_itercorrections, METH_VARARGS, 
-        "T.iter_corrections() -> a set-like object providing a view on T's corrections"},
+    {"iter_corrections", (PyCFunction)Trie_itercorrections, METH_VARARGS | METH_KEYWORDS, 
+        "T.iter_corrections([key][,max_depth][,chunk][,items]) -> a set-like object providing a view on T's corrections. chunk and items are as in T.iter_suffixes()."},
     {"corrections", Trie_corrections, METH_VARARGS, 
         "T.corrections() -> a list containing T's corrections"},
+    {"corrections_with_distances", Trie_corrections_with_distances, METH_VARARGS, 
+        "T.corrections_with_distances() -> a dict mapping T's corrections to their edit distance"},
+    {"add", (PyCFunction)Trie_add, METH_VARARGS | METH_KEYWORDS, 
+        "T.add(k, v[,weight]) -> None. Set T[k] to v, and the weight of k that T.top_k_suffixes() ranks by, a finite number. (defaults to 0)"},
+    {"count_suffixes", (PyCFunction)Trie_count_suffixes, METH_VARARGS, 
+        "T.count_suffixes(prefix) -> count of the keys in T that start with prefix, len(T.suffixes(prefix)) without enumerating them"},
+    {"has_any_suffix", (PyCFunction)Trie_has_any_suffix, METH_VARARGS, 
+        "T.has_any_suffix(prefix) -> True if a key in T starts with prefix"},
+    {"longest_prefix", (PyCFunction)Trie_longest_prefix, METH_VARARGS | METH_KEYWORDS, 
+        "T.longest_prefix(s[,offset]) -> (length, value) of the longest key in T that s[offset:] starts with, None if there is none"},
+    {"shortest_prefix", (PyCFunction)Trie_shortest_prefix, METH_VARARGS | METH_KEYWORDS, 
+        "T.shortest_prefix(s[,offset]) -> (length, value) of the shortest key in T that s[offset:] starts with, None if there is none"},
+    {"compile", (PyCFunction)Trie_compile, METH_NOARGS, 
+        "T.compile() -> None. Build the automaton that T.find_all() uses, which is otherwise built by its first call. Adding or deleting keys drops it."},
+    {"find_all", (PyCFunction)Trie_find_all, METH_VARARGS, 
+        "T.find_all(text) -> a list of (start, end, value) for every occurrence of a key of T in text, ordered by end (longest first for the same end). Found in a single pass over text."},
+    {"snapshot", (PyCFunction)Trie_snapshot, METH_NOARGS, 
+        "T.snapshot() -> a read-only trie holding the items of T as they are now, in O(1). Iterators over it are not affected by the changes of T, writers of T copy the nodes that they change while a snapshot is alive."},
+    {"compact", (PyCFunction)Trie_compact, METH_NOARGS, 
+        "T.compact() -> the count of nodes reclaimed. Deletes of a trie created with lazy_delete=True only clear values, the nodes left with no keys below them are reclaimed by T.compact(). Memory of the slabs left with no nodes in use is released too."},
+    {"first", (PyCFunction)Trie_first, METH_NOARGS, 
+        "T.first() -> the smallest key in T, None if T is empty"},
+    {"last", (PyCFunction)Trie_last, METH_NOARGS, 
+        "T.last() -> the largest key in T, None if T is empty"},
+    {"successor", (PyCFunction)Trie_successor, METH_VARARGS | METH_KEYWORDS, 
+        "T.successor(key[,inclusive]) -> the smallest key in T that is > key (>= key if inclusive), None if there is none"},
+    {"predecessor", (PyCFunction)Trie_predecessor, METH_VARARGS | METH_KEYWORDS, 
+        "T.predecessor(key[,inclusive]) -> the largest key in T that is < key (<= key if inclusive), None if there is none"},
+    {"iter_range", (PyCFunction)Trie_iter_range, METH_VARARGS | METH_KEYWORDS, 
+        "T.iter_range([lo][,hi][,items]) -> an iterator over the keys k of T with lo <= k < hi in sorted order. (or (key, value) tuples if items is set)"},
+    {"top_k_suffixes", (PyCFunction)Trie_top_k_suffixes, METH_VARARGS, 
+        "T.top_k_suffixes(prefix, k) -> a list of the k heaviest suffixes of prefix, heaviest first"},
+    {"update", (PyCFunction)Trie_update, METH_VARARGS | METH_KEYWORDS, 
+        "T.update(E, **F) -> None. Update T from mapping/iterable E and F. Sorted keys are added faster."},
+    {"get_many", (PyCFunction)Trie_get_many, METH_VARARGS | METH_KEYWORDS, 
+        "T.get_many(S[,d][,sort]) -> list of T[k] for every k in S, d (defaults to None) if k is not in T. If sort is set, S is searched in sorted order."},
+    {"contains_many", (PyCFunction)Trie_contains_many, METH_VARARGS | METH_KEYWORDS, 
+        "T.contains_many(S[,sort]) -> list of bools, (k in T) for every k in S. If sort is set, S is searched in sorted order."},
+    {"save", (PyCFunction)Trie_save, METH_VARARGS, 
+        "T.save(path) -> None. Save T to path to be loaded by FrozenTrie.mmap()."},
+    {"fromkeys", (PyCFunction)Trie_fromkeys, METH_VARARGS | METH_KEYWORDS | METH_CLASS, 
+        "T.fromkeys(S[,v][,threads]) -> New trie with keys from S and values equal to v. Sorted keys are added faster. If threads > 1, keys are partitioned by their first char and added by that many threads."},
+    {"fromitems", (PyCFunction)Trie_fromitems, METH_VARARGS | METH_KEYWORDS | METH_CLASS, 
+        "T.fromitems(E[,threads]) -> New trie with items from mapping/iterable E. If threads > 1, keys are partitioned by their first char and added by that many threads."},
     {NULL}  /* Sentinel */
 };
 
@@ -586,6 +2534,290 @@ static PyTypeObject TrieType = {
     Trie_new,                       /* tp_new */
 };
 
+// FrozenTrie is a read-only trie served from a file mapped into memory. See
+// Trie.save().
+typedef struct {
+    PyObject_HEAD
+    trie_frozen_t *pfrozen;
+} FrozenTrieObject;
+
+static void FrozenTrie_dealloc(FrozenTrieObject* self)
+{
+    if (self->pfrozen) {
+        trie_frozen_close(self->pfrozen);
+    }
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *FrozenTrie_mmap(PyObject *cls, PyObject *args)
+{
+    FrozenTrieObject *self;
+    PyObject *pathobj;
+    char *path;
+
+    if (!_parse_path(args, &pathobj, &path)) {
+        return NULL;
+    }
+
+    self = (FrozenTrieObject *)((PyTypeObject *)cls)->tp_alloc(
+        (PyTypeObject *)cls, 0);
+    if (self != NULL) {
+        errno = 0;
+        self->pfrozen = trie_frozen_open(path);
+        if (!self->pfrozen) {
+            if (errno) {
+                PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+            } else {
+                PyErr_SetString(TriezError, "not a valid frozen trie file.");
+            }
+            Py_DECREF(self);
+            self = NULL;
+        }
+    }
+    Py_XDECREF(pathobj);
+
+    return (PyObject *)self;
+}
+
+static Py_ssize_t FrozenTrie_length(FrozenTrieObject *mp)
+{
+    return (Py_ssize_t)mp->pfrozen->header->item_count;
+}
+
+static PyObject *FrozenTrie_subscript(FrozenTrieObject *mp, PyObject *key)
+{
+    trie_key_t k;
+    trie_fnode_t *w;
+    char *buf;
+    unsigned long size;
+
+    if (!_IsValid_Unicode(key)) {
+        PyErr_SetString(TriezError, "key must be a valid unicode string.");
+        return NULL;
+    }
+
+    k = _PyUnicode_AS_TKEY(key);
+    w = trie_frozen_search(mp->pfrozen, &k);
+    if (!w) {
+        PyErr_SetObject(PyExc_KeyError, key);
+        return NULL;
+    }
+
+    buf = trie_frozen_value(mp->pfrozen, w, &size);
+    return PyMarshal_ReadObjectFromString(buf, size);
+}
+
+int FrozenTrie_contains(PyObject *op, PyObject *key)
+{
+    trie_key_t k;
+
+    if (!_IsValid_Unicode(key)) {
+        return 0;
+    }
+
+    k = _PyUnicode_AS_TKEY(key);
+    if (!trie_frozen_search(((FrozenTrieObject *)op)->pfrozen, &k)) {
+        return 0;
+    }
+
+    return 1;
+}
+
+static PyObject *FrozenTrie_node_count(FrozenTrieObject* self)
+{
+    return Py_BuildValue("K", 
+        (unsigned PY_LONG_LONG)self->pfrozen->header->node_count);
+}
+
+static PyObject *FrozenTrie_suffixes(PyObject* selfobj, PyObject *args)
+{
+    trie_frozen_t *f;
+    trie_key_t k;
+    unsigned long max_depth;
+    keybuf_t kb;
+
+    f = ((FrozenTrieObject *)selfobj)->pfrozen;
+    if (!_parse_traverse_args((unsigned long)f->header->height, args, &k, 
+        &max_depth)) {
+        return NULL;
+    }
+
+    // frozen tries cannot change, no lock is needed.
+    memset(&kb, 0, sizeof(keybuf_t));
+    Py_BEGIN_ALLOW_THREADS
+    trie_frozen_suffixes(f, &k, max_depth, _collect_keys, &kb);
+    Py_END_ALLOW_THREADS
+
+    return _keybuf_result(&kb, PySet_New(0));
+}
+
+static PyObject *FrozenTrie_prefixes(PyObject* selfobj, PyObject *args)
+{
+    trie_frozen_t *f;
+    trie_key_t k;
+    unsigned long max_depth;
+    keybuf_t kb;
+
+    f = ((FrozenTrieObject *)selfobj)->pfrozen;
+    if (!_parse_traverse_args((unsigned long)f->header->height, args, &k, 
+        &max_depth)) {
+        return NULL;
+    }
+
+    // frozen tries cannot change, no lock is needed.
+    memset(&kb, 0, sizeof(keybuf_t));
+    Py_BEGIN_ALLOW_THREADS
+    trie_frozen_prefixes(f, &k, max_depth, _collect_keys, &kb);
+    Py_END_ALLOW_THREADS
+
+    return _keybuf_result(&kb, PySet_New(0));
+}
+
+static PyObject *FrozenTrie_corrections(PyObject* selfobj, PyObject *args)
+{
+    trie_frozen_t *f;
+    trie_key_t k;
+    unsigned long max_depth;
+    keybuf_t kb;
+
+    f = ((FrozenTrieObject *)selfobj)->pfrozen;
+    if (!_parse_traverse_args((unsigned long)f->header->height, args, &k, 
+        &max_depth)) {
+        return NULL;
+    }
+
+    // frozen tries cannot change, no lock is needed.
+    memset(&kb, 0, sizeof(keybuf_t));
+    Py_BEGIN_ALLOW_THREADS
+    trie_frozen_corrections(f, &k, max_depth, _collect_distances, &kb);
+    Py_END_ALLOW_THREADS
+
+    return _keybuf_result(&kb, PySet_New(0));
+}
+
+static PyObject *FrozenTrie_corrections_with_distances(PyObject* selfobj, PyObject *args)
+{
+    trie_frozen_t *f;
+    trie_key_t k;
+    unsigned long max_depth;
+    keybuf_t kb;
+
+    f = ((FrozenTrieObject *)selfobj)->pfrozen;
+    if (!_parse_traverse_args((unsigned long)f->header->height, args, &k, 
+        &max_depth)) {
+        return NULL;
+    }
+
+    // frozen tries cannot change, no lock is needed.
+    memset(&kb, 0, sizeof(keybuf_t));
+    Py_BEGIN_ALLOW_THREADS
+    trie_frozen_corrections(f, &k, max_depth, _collect_distances, &kb);
+    Py_END_ALLOW_THREADS
+
+    return _keybuf_result(&kb, PyDict_New());
+}
+
+// There are no iterator objects for frozen tries, iterate all keys.
+PyObject *FrozenTrie_iter(PyObject *obj)
+{
+    PyObject *args, *sfxs, *it;
+
+    args = PyTuple_New(0);
+    if (!args) {
+        return NULL;
+    }
+    sfxs = FrozenTrie_suffixes(obj, args);
+    Py_DECREF(args);
+    if (!sfxs) {
+        return NULL;
+    }
+    it = PyObject_GetIter(sfxs);
+    Py_DECREF(sfxs);
+
+    return it;
+}
+
+static PySequenceMethods FrozenTrie_as_sequence = {
+    0,                              /* sq_length */
+    0,                              /* sq_concat */
+    0,                              /* sq_repeat */
+    0,                              /* sq_item */
+    0,                              /* sq_slice */
+    0,                              /* sq_ass_item */
+    0,                              /* sq_ass_slice */
+    FrozenTrie_contains,            /* sq_contains */
+    0,                              /* sq_inplace_concat */
+    0,                              /* sq_inplace_repeat */
+};
+
+static PyMappingMethods FrozenTrie_as_mapping = {
+    (lenfunc)FrozenTrie_length,     /*mp_length*/
+    (binaryfunc)FrozenTrie_subscript, /*mp_subscript*/
+    0,                              /*mp_ass_subscript*/
+};
+
+static PyMethodDef FrozenTrie_methods[] = {
+    {"mmap", (PyCFunction)FrozenTrie_mmap, METH_VARARGS | METH_CLASS, 
+        "F.mmap(path) -> FrozenTrie mapped from a file written by Trie.save()"},
+    {"node_count", (PyCFunction)FrozenTrie_node_count, METH_NOARGS, 
+        "Node count of the trie. Used for debugging purposes."},
+    {"suffixes", FrozenTrie_suffixes, METH_VARARGS, 
+        "F.suffixes() -> a list containing F's suffixes"},
+    {"prefixes", FrozenTrie_prefixes, METH_VARARGS, 
+        "F.prefixes() -> a list containing F's prefixes"},
+    {"corrections", FrozenTrie_corrections, METH_VARARGS, 
+        "F.corrections() -> a list containing F's corrections"},
+    {"corrections_with_distances", FrozenTrie_corrections_with_distances, METH_VARARGS, 
+        "F.corrections_with_distances() -> a dict mapping F's corrections to their edit distance"},
+    {NULL}  /* Sentinel */
+};
+
+static PyTypeObject FrozenTrieType = {
+#ifdef IS_PY3K
+    PyVarObject_HEAD_INIT(NULL, 0)
+#else
+    PyObject_HEAD_INIT(NULL)
+    0,                              /*ob_size*/
+#endif
+    "FrozenTrie",                   /* tp_name */
+    sizeof(FrozenTrieObject),       /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)FrozenTrie_dealloc, /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_reserved */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    &FrozenTrie_as_sequence,        /* tp_as_sequence */
+    &FrozenTrie_as_mapping,         /* tp_as_mapping */
+    PyObject_HashNotImplemented,    /* tp_hash  */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /* tp_flags */
+    "Read-only trie objects mapped from a file", /* tp_doc */
+    0,                              /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    FrozenTrie_iter,                /* tp_iter */
+    0,                              /* tp_iternext */
+    FrozenTrie_methods,             /* tp_methods */
+    0,                              /* tp_members */
+    0,                              /* tp_getset */
+    0,                              /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    0,                              /* tp_init */
+    0,                              /* tp_alloc */
+    0,                              /* tp_new */
+};
+
 static PyMethodDef Triez_methods[] = {
     {NULL, NULL}      /* sentinel */
 };
@@ -614,7 +2846,8 @@ init_triez(void)
 {
     PyObject *m;
     
-    if (PyType_Ready(&TrieType) < 0) {
+    if (PyType_Ready(&TrieType) < 0 || PyType_Ready(&FrozenTrieType) < 0 ||
+        PyType_Ready(&TrieRangeIteratorType) < 0) {
 #ifdef IS_PY3K
         return NULL;
 #else
@@ -634,6 +2867,8 @@ init_triez(void)
     
     Py_INCREF(&TrieType);
     PyModule_AddObject(m, "Trie", (PyObject *)&TrieType);
+    Py_INCREF(&FrozenTrieType);
+    PyModule_AddObject(m, "FrozenTrie", (PyObject *)&FrozenTrieType);
     
     TriezError = PyErr_NewException("Triez.Error", NULL, NULL);
     PyDict_SetItemString(PyModule_GetDict(m), "Error", TriezError);
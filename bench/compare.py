@@ -0,0 +1,86 @@
+#!/usr/bin/env python
+"""
+Compares two trie_bench results, e.g: python compare.py baseline.json new.json
+
+The throughput of every op is compared over the repeats with Welch's t-test,
+a change is only reported as a regression or an improvement if it is both
+significant and bigger than --threshold percent. Exits with 1 if there is a
+regression.
+"""
+
+import sys
+import json
+import math
+import argparse
+
+# two-sided 95% critical values of Student's t by degrees of freedom.
+_T95 = [12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086]
+
+def _t_critical(df):
+    if df < 1:
+        return float("inf")
+    if df > len(_T95):
+        return 1.96
+    return _T95[int(df) - 1]
+
+def _mean_var(xs):
+    m = sum(xs) / float(len(xs))
+    if len(xs) < 2:
+        return m, 0.0
+    return m, sum((x - m) ** 2 for x in xs) / float(len(xs) - 1)
+
+def welch(a, b):
+    """Returns (t, degrees of freedom) of the samples a and b."""
+    ma, va = _mean_var(a)
+    mb, vb = _mean_var(b)
+    sa, sb = va / len(a), vb / len(b)
+    if sa + sb == 0:
+        return (0.0 if ma == mb else float("inf")), float(len(a) + len(b) - 2)
+    t = (mb - ma) / math.sqrt(sa + sb)
+    den = ((sa ** 2 / (len(a) - 1) if len(a) > 1 else 0) +
+        (sb ** 2 / (len(b) - 1) if len(b) > 1 else 0))
+    df = (sa + sb) ** 2 / den if den else float(len(a) + len(b) - 2)
+    return t, df
+
+def compare(base, new, threshold):
+    ops = dict((r["op"], r) for r in base["results"])
+    regressed = False
+    print("%-12s %14s %14s %8s %8s  %s" % ("op", "base ops/s", "new ops/s",
+        "change", "p99 ns", "verdict"))
+    for r in new["results"]:
+        b = ops.get(r["op"])
+        if b is None:
+            continue
+        ma, _ = _mean_var(b["ops_per_sec"])
+        mb, _ = _mean_var(r["ops_per_sec"])
+        change = (mb - ma) * 100.0 / ma if ma else 0.0
+        t, df = welch(b["ops_per_sec"], r["ops_per_sec"])
+        verdict = "noise"
+        if abs(t) > _t_critical(df) and abs(change) > threshold:
+            verdict = "improvement" if change > 0 else "REGRESSION"
+            regressed = regressed or change < 0
+        print("%-12s %14.1f %14.1f %+7.1f%% %8d  %s" % (r["op"], ma, mb, change,
+            r["p99_ns"], verdict))
+    return regressed
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("base")
+    parser.add_argument("new")
+    parser.add_argument("--threshold", type=float, default=3.0,
+        help="changes smaller than this percent are noise. (default: 3)")
+    args = parser.parse_args()
+
+    with open(args.base) as f:
+        base = json.load(f)
+    with open(args.new) as f:
+        new = json.load(f)
+    for k in ("dataset", "keys", "compressed"):
+        if base.get(k) != new.get(k):
+            sys.stderr.write("warning: %s differs: %r != %r\n" % (k,
+                base.get(k), new.get(k)))
+    return 1 if compare(base, new, args.threshold) else 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,534 @@
+/*
+
+ trie_bench - throughput and latency of the trie core, without Python.
+
+ Builds with trie.c directly (See Makefile) and writes the results as JSON,
+ which compare.py checks against a baseline run.
+
+*/
+
+#include "trie.h"
+#include "string.h"
+
+#ifdef __WINDOWS
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define DEFAULT_KEYS_PATH "tests/out_keys_8859_9"
+#define DEFAULT_REPEATS 5
+#define DEFAULT_SAMPLES 100000
+#define DEFAULT_SEED 42
+
+// queries that enumerate many keys are run on a subset of the keys.
+#define SUFFIXES_QUERIES 20000
+#define PREFIXES_QUERIES 100000
+#define CORRECTIONS_QUERIES 500
+#define CORRECTIONS_DIST 2
+
+typedef struct bench_keys_s {
+    trie_key_t *keys;
+    unsigned long count;
+    unsigned long alloc;
+    char *name;
+} bench_keys_t;
+
+typedef struct bench_op_s {
+    const char *name;
+    unsigned long ops; // ops per repeat
+    double *rates; // ops/sec of every repeat
+    double p50, p90, p99, p999; // latency in ns
+} bench_op_t;
+
+typedef struct bench_args_s {
+    const char *path;
+    unsigned long synthetic; // key count, 0 to use path
+    unsigned long repeats;
+    unsigned long samples; // ops timed one by one for the percentiles
+    unsigned long seed;
+    unsigned int flags;
+    const char *out;
+} bench_args_t;
+
+enum {
+    OP_ADD = 0,
+    OP_SEARCH,
+    OP_SUFFIXES,
+    OP_PREFIXES,
+    OP_CORRECTIONS,
+    OP_DEL,
+    OP_COUNT,
+};
+
+static const char *op_names[OP_COUNT] = {"add", "search", "suffixes",
+    "prefixes", "corrections", "del"};
+
+static unsigned long long rng_state;
+static volatile unsigned long sink; // keeps the results alive
+
+// xorshift64*, so that the synthetic keys and the orders are reproducible.
+unsigned long long rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+double now_ns(void)
+{
+#ifdef __WINDOWS
+    LARGE_INTEGER c, f;
+
+    QueryPerformanceCounter(&c);
+    QueryPerformanceFrequency(&f);
+    return (double)c.QuadPart * 1e9 / (double)f.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+#endif
+}
+
+void *xmalloc(size_t size)
+{
+    void *p;
+
+    p = malloc(size ? size : 1);
+    if (!p) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    return p;
+}
+
+// Appends a key of size chars, stored in the narrowest char size like the
+// strings of PEP393.
+void keys_add(bench_keys_t *ks, const uint32_t *chars, unsigned long size)
+{
+    trie_key_t *k;
+    unsigned long i;
+    uint32_t max;
+
+    if (ks->count == ks->alloc) {
+        ks->alloc = ks->alloc ? ks->alloc * 2 : 1024;
+        ks->keys = (trie_key_t *)realloc(ks->keys,
+            ks->alloc * sizeof(trie_key_t));
+        if (!ks->keys) {
+            fprintf(stderr, "out of memory.\n");
+            exit(1);
+        }
+    }
+
+    max = 0;
+    for (i=0;i<size;i++) {
+        if (chars[i] > max) {
+            max = chars[i];
+        }
+    }
+    k = &ks->keys[ks->count++];
+    k->size = size;
+    k->char_size = max < 0x100 ? 1 : (max < 0x10000 ? 2 : 4);
+    k->alloc_size = size;
+    k->max_char = NULL;
+    k->s = (char *)xmalloc(size * k->char_size);
+    for (i=0;i<size;i++) {
+        if (k->char_size == 1) {
+            ((uint8_t *)k->s)[i] = (uint8_t)chars[i];
+        } else if (k->char_size == 2) {
+            ((uint16_t *)k->s)[i] = (uint16_t)chars[i];
+        } else {
+            ((uint32_t *)k->s)[i] = chars[i];
+        }
+    }
+}
+
+// ISO-8859-9 differs from Latin-1 in six Turkish letters.
+uint32_t latin5_char(unsigned char c)
+{
+    switch(c) {
+        case 0xD0: return 0x011E;
+        case 0xDD: return 0x0130;
+        case 0xDE: return 0x015E;
+        case 0xF0: return 0x011F;
+        case 0xFD: return 0x0131;
+        case 0xFE: return 0x015F;
+    }
+    return c;
+}
+
+// Reads one key per line of an ISO-8859-9 file. (like tests/test_simple.py)
+int keys_load(bench_keys_t *ks, const char *path)
+{
+    FILE *fp;
+    uint32_t buf[4096];
+    unsigned long n;
+    int c;
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        return 0;
+    }
+    n = 0;
+    while((c = fgetc(fp)) != EOF) {
+        if (c == '\n' || c == '\r') {
+            if (c == '\n' || n) {
+                keys_add(ks, buf, n);
+            }
+            n = 0;
+            if (c == '\r') {
+                c = fgetc(fp);
+                if (c != '\n' && c != EOF) {
+                    ungetc(c, fp);
+                }
+            }
+            continue;
+        }
+        if (n < sizeof(buf)/sizeof(buf[0])) {
+            buf[n++] = latin5_char((unsigned char)c);
+        }
+    }
+    if (n) {
+        keys_add(ks, buf, n);
+    }
+    fclose(fp);
+    return 1;
+}
+
+// Keys are made of syllables, so that they share prefixes like words do,
+// with a few wide chars mixed in.
+void keys_synthetic(bench_keys_t *ks, unsigned long count)
+{
+    static const char *syllables[] = {"ka", "ra", "le", "mi", "to", "su",
+        "ne", "bo", "ti", "an", "er", "in", "ol", "us", "ya", "de", "lar",
+        "ler", "ci", "ma"};
+    uint32_t buf[64];
+    unsigned long i, n, j, m;
+    const char *s;
+
+    for (i=0;i<count;i++) {
+        n = 0;
+        m = 2 + rng_next() % 6;
+        for (j=0;j<m;j++) {
+            for (s=syllables[rng_next() % 20];*s;s++) {
+                buf[n++] = (uint32_t)*s;
+            }
+        }
+        if (rng_next() % 16 == 0) {
+            buf[rng_next() % n] = 0x0130 + (uint32_t)(rng_next() % 64);
+        }
+        // a counter suffix keeps most keys distinct at any count.
+        for (j=i;j;j/=26) {
+            buf[n++] = 'a' + (uint32_t)(j % 26);
+        }
+        keys_add(ks, buf, n);
+    }
+}
+
+void shuffle(unsigned long *a, unsigned long n)
+{
+    unsigned long i, j, tmp;
+
+    for (i=n;i>1;i--) {
+        j = (unsigned long)(rng_next() % i);
+        tmp = a[i-1];
+        a[i-1] = a[j];
+        a[j] = tmp;
+    }
+}
+
+int count_key(trie_key_t *k, void *arg)
+{
+    (*(unsigned long *)arg)++;
+    return 1;
+}
+
+int count_dist(trie_key_t *k, unsigned long dist, void *arg)
+{
+    (*(unsigned long *)arg) += dist + 1;
+    return 1;
+}
+
+// Runs op on the ith key (of the op's query set). Returns 0 on failure.
+int run_op(int op, trie_t *t, trie_key_t *k, unsigned long i)
+{
+    trie_key_t pfx;
+    unsigned long n;
+    TRIE_DATA old;
+
+    n = 0;
+    switch(op) {
+        case OP_ADD:
+            return trie_add(t, k, (TRIE_DATA)(i + 1));
+        case OP_SEARCH:
+            sink += trie_search(t, k) != NULL;
+            return 1;
+        case OP_SUFFIXES:
+            pfx = *k;
+            pfx.size = k->size < 2 ? k->size : 2;
+            trie_suffixes(t, &pfx, t->height, count_key, &n);
+            break;
+        case OP_PREFIXES:
+            trie_prefixes(t, k, t->height, count_key, &n);
+            break;
+        case OP_CORRECTIONS:
+            trie_corrections(t, k, CORRECTIONS_DIST, count_dist, &n);
+            break;
+        case OP_DEL:
+            trie_del(t, k, &old);
+            return 1;
+    }
+    sink += n;
+    return 1;
+}
+
+unsigned long op_queries(int op, unsigned long count)
+{
+    unsigned long n;
+
+    n = count;
+    if (op == OP_SUFFIXES) {
+        n = SUFFIXES_QUERIES;
+    } else if (op == OP_PREFIXES) {
+        n = PREFIXES_QUERIES;
+    } else if (op == OP_CORRECTIONS) {
+        n = CORRECTIONS_QUERIES;
+    }
+    return n < count ? n : count;
+}
+
+int cmp_double(const void *a, const void *b)
+{
+    double x, y;
+
+    x = *(const double *)a;
+    y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+double percentile(double *sorted, unsigned long n, double p)
+{
+    unsigned long i;
+
+    if (!n) {
+        return 0;
+    }
+    i = (unsigned long)(p * (double)(n - 1) + 0.5);
+    return sorted[i];
+}
+
+// One repeat: every op over its whole query set in a shuffled order. If lat
+// is given, the first samples ops are timed one by one instead.
+void run_repeat(bench_keys_t *ks, unsigned int flags, unsigned long *order,
+    bench_op_t *ops, unsigned long r, double **lat, unsigned long samples,
+    unsigned long *node_count, unsigned long *mem_usage)
+{
+    trie_t *t;
+    unsigned long i, n;
+    double start, end;
+    int op;
+
+    t = trie_create(flags);
+    if (!t) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    for (op=0;op<OP_COUNT;op++) {
+        shuffle(order, ks->count);
+        n = op_queries(op, ks->count);
+        if (lat) {
+            n = n < samples ? n : samples;
+            for (i=0;i<n;i++) {
+                start = now_ns();
+                if (!run_op(op, t, &ks->keys[order[i]], order[i])) {
+                    fprintf(stderr, "%s failed.\n", op_names[op]);
+                    exit(1);
+                }
+                lat[op][i] = now_ns() - start;
+            }
+            // the rest of the keys are added untimed, so that the other ops
+            // run on the whole trie.
+            if (op == OP_ADD) {
+                for (;i<ks->count;i++) {
+                    run_op(op, t, &ks->keys[order[i]], order[i]);
+                }
+            }
+            qsort(lat[op], n, sizeof(double), cmp_double);
+            ops[op].p50 = percentile(lat[op], n, 0.50);
+            ops[op].p90 = percentile(lat[op], n, 0.90);
+            ops[op].p99 = percentile(lat[op], n, 0.99);
+            ops[op].p999 = percentile(lat[op], n, 0.999);
+            continue;
+        }
+
+        if (op == OP_DEL) {
+            *node_count = t->node_count;
+            *mem_usage = trie_mem_usage(t);
+        }
+        start = now_ns();
+        for (i=0;i<n;i++) {
+            if (!run_op(op, t, &ks->keys[order[i]], order[i])) {
+                fprintf(stderr, "%s failed.\n", op_names[op]);
+                exit(1);
+            }
+        }
+        // lazy deletes pay for the dead nodes here. (See Note 10)
+        if (op == OP_DEL && (flags & TRIE_LAZY_DELETE)) {
+            trie_compact(t);
+        }
+        end = now_ns();
+        ops[op].ops = n;
+        ops[op].rates[r] = (double)n * 1e9 / (end - start > 1 ? end - start : 1);
+    }
+    trie_destroy(t, NULL);
+}
+
+void write_results(FILE *fp, bench_args_t *a, bench_keys_t *ks,
+    bench_op_t *ops, unsigned long node_count, unsigned long mem_usage)
+{
+    unsigned long r;
+    int op;
+
+    fprintf(fp, "{\n  \"dataset\": \"%s\",\n  \"keys\": %lu,\n", ks->name,
+        ks->count);
+    fprintf(fp, "  \"compressed\": %d,\n  \"lazy_delete\": %d,\n", 
+        (a->flags & TRIE_COMPRESSED) ? 1 : 0, 
+        (a->flags & TRIE_LAZY_DELETE) ? 1 : 0);
+    fprintf(fp, "  \"seed\": %lu,\n  \"repeats\": %lu,\n", a->seed, 
+        a->repeats);
+    fprintf(fp, "  \"node_count\": %lu,\n  \"mem_usage\": %lu,\n", node_count,
+        mem_usage);
+    fprintf(fp, "  \"results\": [\n");
+    for (op=0;op<OP_COUNT;op++) {
+        fprintf(fp, "    {\"op\": \"%s\", \"ops\": %lu, \"ops_per_sec\": [",
+            ops[op].name, ops[op].ops);
+        for (r=0;r<a->repeats;r++) {
+            fprintf(fp, "%s%.1f", r ? ", " : "", ops[op].rates[r]);
+        }
+        fprintf(fp, "], \"p50_ns\": %.0f, \"p90_ns\": %.0f, \"p99_ns\": %.0f, "
+            "\"p999_ns\": %.0f}%s\n", ops[op].p50, ops[op].p90, ops[op].p99,
+            ops[op].p999, op < OP_COUNT-1 ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+}
+
+void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-f keys_file] [-n synthetic_key_count] "
+        "[-r repeats] [-l latency_samples] [-s seed] [-c] [-d] [-o out.json]\n"
+        "  -f: one ISO-8859-9 key per line (default: %s)\n"
+        "  -n: use n generated keys instead of a file\n"
+        "  -c: compressed trie\n"
+        "  -d: lazy deletes, del is timed along with the compaction after it\n", prog, DEFAULT_KEYS_PATH);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    bench_args_t a;
+    bench_keys_t ks;
+    bench_op_t ops[OP_COUNT];
+    unsigned long *order, i, node_count, mem_usage;
+    double *lat[OP_COUNT];
+    char name[64];
+    FILE *fp;
+    int op;
+
+    a.path = DEFAULT_KEYS_PATH;
+    a.synthetic = 0;
+    a.repeats = DEFAULT_REPEATS;
+    a.samples = DEFAULT_SAMPLES;
+    a.seed = DEFAULT_SEED;
+    a.flags = 0;
+    a.out = NULL;
+    for (i=1;i<(unsigned long)argc;i++) {
+        if (!strcmp(argv[i], "-c")) {
+            a.flags |= TRIE_COMPRESSED;
+        } else if (!strcmp(argv[i], "-d")) {
+            a.flags |= TRIE_LAZY_DELETE;
+        } else if (i+1 == (unsigned long)argc) {
+            usage(argv[0]);
+        } else if (!strcmp(argv[i], "-f")) {
+            a.path = argv[++i];
+        } else if (!strcmp(argv[i], "-n")) {
+            a.synthetic = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "-r")) {
+            a.repeats = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "-l")) {
+            a.samples = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "-s")) {
+            a.seed = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "-o")) {
+            a.out = argv[++i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (!a.repeats) {
+        usage(argv[0]);
+    }
+
+    rng_state = a.seed ? a.seed : DEFAULT_SEED;
+    memset(&ks, 0, sizeof(ks));
+    if (a.synthetic) {
+        keys_synthetic(&ks, a.synthetic);
+        sprintf(name, "synthetic-%lu", a.synthetic);
+        ks.name = name;
+    } else {
+        if (!keys_load(&ks, a.path)) {
+            fprintf(stderr, "cannot read %s.\n", a.path);
+            return 1;
+        }
+        ks.name = (char *)a.path;
+    }
+
+    order = (unsigned long *)xmalloc(ks.count * sizeof(unsigned long));
+    for (i=0;i<ks.count;i++) {
+        order[i] = i;
+    }
+    for (op=0;op<OP_COUNT;op++) {
+        ops[op].name = op_names[op];
+        ops[op].rates = (double *)xmalloc(a.repeats * sizeof(double));
+        ops[op].p50 = ops[op].p90 = ops[op].p99 = ops[op].p999 = 0;
+        lat[op] = (double *)xmalloc((a.samples < ks.count ? a.samples :
+            ks.count) * sizeof(double));
+    }
+
+    // a warm-up repeat, then the measured ones and the latency run.
+    node_count = mem_usage = 0;
+    run_repeat(&ks, a.flags, order, ops, 0, NULL, 0, &node_count, &mem_usage);
+    for (i=0;i<a.repeats;i++) {
+        run_repeat(&ks, a.flags, order, ops, i, NULL, 0, &node_count,
+            &mem_usage);
+        fprintf(stderr, ".");
+    }
+    fprintf(stderr, "\n");
+    run_repeat(&ks, a.flags, order, ops, 0, lat, a.samples, &node_count,
+        &mem_usage);
+
+    fp = stdout;
+    if (a.out) {
+        fp = fopen(a.out, "w");
+        if (!fp) {
+            fprintf(stderr, "cannot write %s.\n", a.out);
+            return 1;
+        }
+    }
+    write_results(fp, &a, &ks, ops, node_count, mem_usage);
+    if (a.out) {
+        fclose(fp);
+    }
+
+    for (op=0;op<OP_COUNT;op++) {
+        free(ops[op].rates);
+        free(lat[op]);
+    }
+    for (i=0;i<ks.count;i++) {
+        free(ks.keys[i].s);
+    }
+    free(ks.keys);
+    free(order);
+    return 0;
+}
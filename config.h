@@ -1,6 +1,15 @@
 #ifndef YCONFIG_H
 #define YCONFIG_H
 
+// trie.c does not need Python, it is built without it if TRIE_STANDALONE is 
+// defined. (e.g: by the benchmark driver in bench/) Chars are then 4 bytes, 
+// like PEP393 builds.
+#ifdef TRIE_STANDALONE
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#define IS_PEP393_AVAILABLE
+#else
 #include "Python.h"
 
 #if PY_MAJOR_VERSION >= 3
@@ -12,8 +21,11 @@
 #define IS_PEP393_AVAILABLE
 #endif
 #endif
+#endif
 
-#ifdef IS_PEP393_AVAILABLE
+#ifdef TRIE_STANDALONE
+#define TRIE_CHAR uint32_t
+#elif defined(IS_PEP393_AVAILABLE)
 //Python dynamically choose encoding of the string if PEP393 is available.
 #define TRIE_CHAR Py_UCS4
 #else
@@ -23,6 +35,47 @@
 #define TRIE_CHAR Py_UNICODE
 #endif
 #define TRIE_DATA uintptr_t
+#define TRIE_WEIGHT double
+
+// allocator that can be called without holding the GIL.
+#if !defined(TRIE_STANDALONE) && PY_VERSION_HEX >= 0x03040000
+#define TRIE_RAW_MALLOC PyMem_RawMalloc
+#define TRIE_RAW_REALLOC PyMem_RawRealloc
+#define TRIE_RAW_FREE PyMem_RawFree
+#else
+#define TRIE_RAW_MALLOC malloc
+#define TRIE_RAW_REALLOC realloc
+#define TRIE_RAW_FREE free
+#endif
+
+// SSE2 is used for searching 16 children at once. (See trie_index16_t) We
+// only do that for 4-byte TRIE_CHARs.
+#if (defined(__SSE2__) || defined(_M_X64)) && defined(IS_PEP393_AVAILABLE)
+#define TRIE_USE_SSE2
+#endif
+
+// Readers of uncompressed tries do not lock if the compiler has atomics. 
+// (See Note 7) Otherwise these are plain accesses and readers always lock.
+#if defined(__GNUC__)
+#define TRIE_LOCKFREE_READS
+#define TRIE_ATOMIC_ADD(p, n) __atomic_add_fetch((p), (n), __ATOMIC_SEQ_CST)
+#define TRIE_ATOMIC_SUB(p, n) __atomic_sub_fetch((p), (n), __ATOMIC_SEQ_CST)
+#define TRIE_ATOMIC_LOAD(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define TRIE_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define TRIE_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define TRIE_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define TRIE_FENCE_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define TRIE_FENCE_RELEASE() __atomic_thread_fence(__ATOMIC_RELEASE)
+#else
+#define TRIE_ATOMIC_ADD(p, n) (*(p) += (n))
+#define TRIE_ATOMIC_SUB(p, n) (*(p) -= (n))
+#define TRIE_ATOMIC_LOAD(p) (*(p))
+#define TRIE_LOAD_ACQUIRE(p) (*(p))
+#define TRIE_STORE_RELEASE(p, v) (*(p) = (v))
+#define TRIE_FENCE()
+#define TRIE_FENCE_ACQUIRE()
+#define TRIE_FENCE_RELEASE()
+#endif
 
 #if defined(MS_WINDOWS)
 #define __WINDOWS
@@ -11,12 +11,16 @@ HOMEPAGE = "http://bitbucket.org/sumerc/pyctrie/"
 NAME = "pyctrie"
 VERSION = "0.1"
 DEBUG = False
+STATS = False # hot path counters of Trie.stats(), they cost a little
 
 user_macros = []
 user_libraries = []
 compile_args = []
 link_args = []
 
+if STATS:
+    user_macros.append(('TRIE_STATS', None))
+
 if DEBUG:
     if os.name == 'posix':
         compile_args.append('-g')
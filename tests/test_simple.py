@@ -148,6 +148,18 @@ class TestBasic(unittest.TestCase):
                 for e in crs:
                     self.assertTrue(damerau_levenshtein(x, e) <= i)
 
+        # every correction is reported once, with its distance
+        dists = tr.corrections_with_distances(uni_escape("tae"), 2)
+        self.assertEqual(dists, {uni_escape("tea"): 1, uni_escape("ted"): 2, 
+            uni_escape("ten"): 2, uni_escape("to"): 2})
+        self.assertEqual(set(dists), tr.corrections(uni_escape("tae"), 2))
+        self.assertEqual(sorted(tr.iter_corrections(uni_escape("tae"), 2)), 
+            sorted(dists))
+
+        crcs = tr.iter_corrections(uni_escape("i"), 1)
+        del tr[uni_escape("in")]
+        self.assertRaises(RuntimeError, list, crcs)
+
     def test_corrections_with_dataset(self):
         tr = triez.Trie()
 
@@ -159,7 +171,7 @@ class TestBasic(unittest.TestCase):
         self.assertEqual(tr.node_count(), 310764)
         self.assertEqual(tr[uni_escape("ramazan")], 2)
         self.assertEqual(len(tr.corrections(uni_escape("ra"), 3)), 5639)
-        self.assertEqual(len(set(list(tr.iter_corrections(uni_escape("ra"), 3)))), 5639)
+        self.assertEqual(len(list(tr.iter_corrections(uni_escape("ra"), 3))), 5639)
         self.assertEqual(set(list((tr.iter_corrections(uni_escape("abe"), 3)))), 
             tr.corrections(uni_escape("abe"), 3))
 
@@ -220,6 +232,14 @@ class TestBasic(unittest.TestCase):
         del tr[uni_escape("in")]
         self.assertRaises(RuntimeError, list, suffixes)
 
+        # a new iterator does not hide a change from the older ones
+        tr = self._create_trie()
+        suffixes = tr.iter_suffixes(uni_escape("i"))
+        tr[uni_escape("io")] = 1
+        suffixes2 = tr.iter_suffixes(uni_escape("t"))
+        self.assertEqual(len(list(suffixes2)), 4)
+        self.assertRaises(RuntimeError, list, suffixes)
+
         # trie self_iter and suffixes should be same
         suffixes = tr.iter_suffixes()
         self.assertEqual(len(list(tr)), len(list(suffixes)))
@@ -242,6 +262,30 @@ class TestBasic(unittest.TestCase):
         self.assertEqual(len(tr.suffixes()), len(list(tr.iter_suffixes())), 
             len(tr))
       
+    def test_iter_chunks(self):
+        tr = triez.Trie()
+        for i in range(1000):
+            tr[uni_escape("key%d" % (i, ))] = i
+        keys = list(tr.iter_suffixes(uni_escape("key1")))
+        for chunk in [1, 7, 111, 5000]:
+            chunks = list(tr.iter_suffixes(uni_escape("key1"), chunk=chunk))
+            self.assertTrue(all(len(c) == chunk for c in chunks[:-1]))
+            self.assertEqual([k for c in chunks for k in c], keys)
+        it = tr.iter_suffixes(chunk=300, items=True)
+        for i in range(2): # exhausted iterators start over
+            self.assertEqual(dict(kv for c in it for kv in c), 
+                dict((k, tr[k]) for k in tr))
+        self.assertEqual(list(tr.iter_prefixes(uni_escape("key12"), items=True)), 
+            [(uni_escape("key1"), 1), (uni_escape("key12"), 12)])
+        self.assertEqual(dict(tr.iter_corrections(uni_escape("key12"), 1, 
+            items=True)), dict((k, tr[k]) for k in 
+                tr.corrections(uni_escape("key12"), 1)))
+
+        it = tr.iter_suffixes(chunk=10)
+        next(it)
+        tr[uni_escape("other")] = 1
+        self.assertRaises(RuntimeError, next, it)
+
     def test_suffixes_uni_escapecode(self):
 
         tr = self._create_trie2()
@@ -267,6 +311,25 @@ class TestBasic(unittest.TestCase):
         self.assertTrue(set([uni_escape("\N{ARABIC LETTER ALEF}\N{ARABIC LETTER ALEF}"), 
             uni_escape("\N{ARABIC LETTER ALEF}")]) == prefixes)
 
+    def test_result_kinds(self):
+        # results are built in the narrowest string kind, they shall be the 
+        # same as the added keys, in size too.
+        keys = [uni_escape(k) for k in ["ab", "ab\xe9", "ab\u4e00", 
+            "ab\U0001F600", "ab\xe9\u4e00a", "a\U0001F600\xe9b", "b"]]
+        for compressed in [False, True]:
+            tr = triez.Trie(compressed=compressed)
+            for k in keys:
+                tr[k] = 1
+            results = list(tr.suffixes(uni_escape(""))) + list(tr) + \
+                list(tr.iter_suffixes(uni_escape("a"))) + \
+                list(tr.prefixes(keys[4])) + \
+                list(tr.corrections(uni_escape("ab\xe9"), 2)) + \
+                list(tr.top_k_suffixes(uni_escape("a"), 10))
+            self.assertEqual(set(results), set(keys))
+            for r in results:
+                self.assertEqual(sys.getsizeof(r), 
+                    sys.getsizeof(keys[keys.index(r)]))
+
     def test_basic(self):
         self.assertEqual(triez.Trie().node_count(), 1)
 
@@ -313,6 +376,650 @@ class TestBasic(unittest.TestCase):
         tr = self._create_trie()
         self.assertEqual(tr.node_count(), 11)
        
+    def test_compressed(self):
+        tr = triez.Trie(compressed=True)
+        tr[uni_escape("romane")] = 1
+        self.assertEqual(tr.node_count(), 2)
+        tr[uni_escape("romanus")] = 2 # splits the edge
+        tr[uni_escape("rom")] = 3 # splits at the end of the key
+        self.assertEqual(tr.node_count(), 5)
+        self.assertFalse(uni_escape("roman") in tr)
+        self.assertFalse(uni_escape("ro") in tr)
+        self.assertEqual(tr[uni_escape("rom")], 3)
+        self.assertEqual(tr.suffixes(uni_escape("ro")), set([uni_escape("rom"),
+            uni_escape("romane"), uni_escape("romanus")]))
+        self.assertEqual(tr.suffixes(uni_escape("r"), 1), set())
+        self.assertEqual(tr.suffixes(uni_escape("ro"), 1),
+            set([uni_escape("rom")]))
+        self.assertEqual(tr.suffixes(uni_escape("ro"), 4),
+            set([uni_escape("rom"), uni_escape("romane")]))
+        self.assertEqual(set(tr.iter_suffixes(uni_escape("roma"))),
+            set([uni_escape("romane"), uni_escape("romanus")]))
+        self.assertEqual(tr.prefixes(uni_escape("romanes")),
+            set([uni_escape("rom"), uni_escape("romane")]))
+        self.assertEqual(tr.corrections(uni_escape("romanse"), 2),
+            set([uni_escape("romane"), uni_escape("romanus")]))
+
+        # deleting merges the edges back
+        del tr[uni_escape("rom")]
+        del tr[uni_escape("romanus")]
+        self.assertEqual(tr.node_count(), 2)
+        del tr[uni_escape("romane")]
+        self.assertEqual(tr.node_count(), 1)
+
+        tr = triez.Trie(compressed=True)
+        tr2 = triez.Trie()
+        lines = _read_lines(path="tests/out_keys_8859_9", encoding="iso-8859-9")
+        for line in lines:
+            tr[line] = 2
+            tr2[line] = 2
+        self.assertEqual(len(tr), len(tr2))
+        self.assertTrue(tr.node_count() < tr2.node_count())
+        self.assertEqual(tr.corrections(uni_escape("ra"), 3),
+            tr2.corrections(uni_escape("ra"), 3))
+        self.assertEqual(set(tr.iter_corrections(uni_escape("abe"), 2)),
+            tr2.corrections(uni_escape("abe"), 2))
+        self.assertEqual(tr.suffixes(uni_escape("ab-")),
+            set(tr2.iter_suffixes(uni_escape("ab-"))))
+        for line in lines:
+            del tr[line]
+        self.assertEqual(tr.node_count(), 1)
+
+    def test_many_children(self):
+        # children of a node are indexed differently as their count grows,
+        # and chars > 0xFF are indexed separately.
+        chars = [unichr(i) for i in range(0x20, 0x100)] + \
+            [unichr(i) for i in range(0x4e00, 0x4e40)]
+        tr = triez.Trie()
+        for i, ch in enumerate(chars):
+            tr[ch] = i
+            tr[uni_escape("a") + ch] = i
+            for j, ch2 in enumerate(chars[:i+1]):
+                self.assertEqual(tr[ch2], j)
+        self.assertEqual(tr.suffixes(uni_escape("a")), set([uni_escape("a")] + 
+            [uni_escape("a") + ch for ch in chars]))
+
+        for i, ch in enumerate(chars):
+            del tr[ch]
+            self.assertFalse(ch in tr)
+            for j, ch2 in enumerate(chars[i+1:]):
+                self.assertEqual(tr[ch2], i+j+1)
+        self.assertEqual(len(tr), len(chars))
+        for ch in chars:
+            del tr[uni_escape("a") + ch]
+        self.assertEqual(tr.node_count(), 1)
+
+    def test_mem_usage(self):
+        tr = triez.Trie()
+        self.assertTrue(tr.mem_usage() > 0)
+
+        for i in range(1000):
+            tr[uni_escape("key%d" % (i, ))] = i
+        mem_usage = tr.mem_usage()
+        node_count = tr.node_count()
+
+        # freed nodes shall be reused by the next additions
+        for i in range(1000):
+            del tr[uni_escape("key%d" % (i, ))]
+        self.assertEqual(tr.node_count(), 1)
+        for i in range(1000):
+            tr[uni_escape("key%d" % (i, ))] = i
+        self.assertEqual(tr.mem_usage(), mem_usage)
+        self.assertEqual(tr.node_count(), node_count)
+
+        # compact() releases the slabs left with no nodes in use.
+        keys = [uni_escape("slab%d" % (i, )) for i in range(20000)]
+        for i, key in enumerate(keys):
+            tr[key] = i
+        mem_usage = tr.mem_usage()
+        s = tr.snapshot()
+        for key in keys:
+            del tr[key]
+        tr.compact()
+        self.assertEqual(len(s), len(keys) + 1000)
+        self.assertEqual(s[keys[-1]], len(keys) - 1)
+        del s
+        tr.compact()
+        self.assertTrue(tr.mem_usage() < mem_usage // 2)
+        for i, key in enumerate(keys):
+            tr[key] = i
+        self.assertEqual(len(tr), len(keys) + 1000)
+        self.assertEqual(tr[keys[-1]], len(keys) - 1)
+
+    def test_dealloc(self):
+        class A:
+            _destructor_calls = 0
+            def __del__(self):
+                A._destructor_calls += 1
+
+        for compressed in [False, True]:
+            A._destructor_calls = 0
+            tr = triez.Trie(compressed=compressed)
+            for i in range(100):
+                tr[uni_escape("key%d" % (i, ))] = A()
+            del tr[uni_escape("key5")]
+            self.assertEqual(A._destructor_calls, 1)
+            del tr
+            self.assertEqual(A._destructor_calls, 100)
+
+    def test_update(self):
+        keys = [uni_escape("ab"), uni_escape("abc"), uni_escape("abd"), 
+            uni_escape("b"), uni_escape("ba"), uni_escape("\\u0130st")]
+        for compressed in [False, True]:
+            tr = triez.Trie(compressed=compressed)
+            tr.update((k, i) for i, k in enumerate(keys))
+            self.assertEqual(len(tr), len(keys))
+            for i, k in enumerate(keys):
+                self.assertEqual(tr[k], i)
+
+            # unsorted keys, already existing keys and a prefix of the last key
+            tr.update([(uni_escape("abd"), 7), (uni_escape("a"), 8)], 
+                b=9)
+            self.assertEqual(len(tr), len(keys) + 1)
+            self.assertEqual(tr[uni_escape("abd")], 7)
+            self.assertEqual(tr[uni_escape("a")], 8)
+            self.assertEqual(tr[uni_escape("b")], 9)
+            self.assertEqual(tr.suffixes(uni_escape("ab")), 
+                set([uni_escape("ab"), uni_escape("abc"), uni_escape("abd")]))
+
+            tr.update({uni_escape("x"): 1})
+            self.assertEqual(tr[uni_escape("x")], 1)
+
+            self.assertRaises(_triez.Error, tr.update, [(1, 2)])
+            self.assertRaises(ValueError, tr.update, [(uni_escape("a"), )])
+
+        tr = triez.Trie.fromkeys(sorted(keys))
+        self.assertTrue(isinstance(tr, triez.Trie))
+        self.assertEqual(len(tr), len(keys))
+        self.assertEqual(tr[uni_escape("abd")], None)
+        tr = triez.Trie.fromkeys(keys, 5)
+        self.assertEqual(tr[uni_escape("\\u0130st")], 5)
+
+        lines = _read_lines(path="tests/out_keys_8859_9", encoding="iso-8859-9")
+        tr = triez.Trie.fromkeys(sorted(lines), 2)
+        self.assertEqual(len(tr), 82489)
+        self.assertEqual(tr.node_count(), 310764)
+
+        # replaced values are released
+        class A:
+            _destructor_calls = 0
+            def __del__(self):
+                A._destructor_calls += 1
+        tr = triez.Trie()
+        tr.update([(uni_escape("a"), A()), (uni_escape("a"), A())])
+        self.assertEqual(A._destructor_calls, 1)
+
+    def test_parallel_build(self):
+        lines = _read_lines(path="tests/out_keys_8859_9", encoding="iso-8859-9")
+        items = [(k, i) for i, k in enumerate(lines)]
+        # empty key, replaced keys and wide chars
+        items += [(uni_escape(""), 1), (lines[5], 2), (uni_escape(""), 3),
+            (uni_escape("\\u0130st"), 4)]
+        tr = triez.Trie.fromitems(items)
+        for threads in [2, 4, 100]:
+            tr2 = triez.Trie.fromitems(items, threads=threads)
+            self.assertEqual(len(tr2), len(tr))
+            self.assertEqual(tr2.node_count(), tr.node_count())
+            self.assertEqual(tr2.suffixes(), tr.suffixes())
+            self.assertEqual(tr2.corrections(uni_escape("ra"), 2),
+                tr.corrections(uni_escape("ra"), 2))
+            for k, v in items[:1000]:
+                self.assertEqual(tr2[k], tr[k])
+            self.assertEqual(tr2[uni_escape("")], 3)
+            self.assertEqual(tr2[lines[5]], 2)
+
+            # attached nodes belong to the trie like the others
+            for k in lines[:1000]:
+                del tr2[k]
+            self.assertEqual(len(tr2), len(tr) - 1000)
+            tr2.update(items[:1000])
+            self.assertEqual(tr2.node_count(), tr.node_count())
+
+        tr = triez.Trie.fromkeys(sorted(lines), 2, threads=4)
+        self.assertEqual(len(tr), 82489)
+        self.assertEqual(tr.node_count(), 310764)
+
+        class A:
+            _destructor_calls = 0
+            def __del__(self):
+                A._destructor_calls += 1
+        tr = triez.Trie.fromitems([(uni_escape("a"), A()), (uni_escape("b"), A()),
+            (uni_escape("a"), A())], threads=2)
+        self.assertEqual(A._destructor_calls, 1)
+        del tr
+        self.assertEqual(A._destructor_calls, 3)
+        self.assertRaises(_triez.Error, triez.Trie.fromitems,
+            [(uni_escape("a"), 1), (1, 2)], threads=2)
+
+    def test_top_k_suffixes(self):
+        for compressed in [False, True]:
+            tr = triez.Trie(compressed=compressed)
+            tr.add(uni_escape("car"), 1, 5)
+            tr.add(uni_escape("cart"), 2, 9)
+            tr.add(uni_escape("care"), 3, 2.5)
+            tr.add(uni_escape("cat"), 4, 7)
+            tr[uni_escape("ca")] = 5 # weighs 0
+            tr.add(uni_escape("dog"), 6, 100)
+            self.assertEqual(tr[uni_escape("cart")], 2)
+            self.assertEqual(tr.top_k_suffixes(uni_escape("ca"), 3), 
+                [uni_escape("cart"), uni_escape("cat"), uni_escape("car")])
+            self.assertEqual(tr.top_k_suffixes(uni_escape("ca"), 10), 
+                [uni_escape("cart"), uni_escape("cat"), uni_escape("car"), 
+                uni_escape("care"), uni_escape("ca")])
+            self.assertEqual(tr.top_k_suffixes(uni_escape("car"), 1), 
+                [uni_escape("cart")])
+            self.assertEqual(tr.top_k_suffixes(uni_escape(""), 1), 
+                [uni_escape("dog")])
+            self.assertEqual(tr.top_k_suffixes(uni_escape("x"), 1), [])
+
+            # weights are kept by T[k] = v, and updated on add/del
+            tr[uni_escape("cart")] = 7
+            self.assertEqual(tr.top_k_suffixes(uni_escape("c"), 1), 
+                [uni_escape("cart")])
+            tr.add(uni_escape("cart"), 7, 1)
+            self.assertEqual(tr.top_k_suffixes(uni_escape("c"), 2), 
+                [uni_escape("cat"), uni_escape("car")])
+            del tr[uni_escape("cat")]
+            del tr[uni_escape("dog")]
+            self.assertEqual(tr.top_k_suffixes(uni_escape(""), 2), 
+                [uni_escape("car"), uni_escape("care")])
+
+            # weights are allocated on the first nonzero weight, keys added 
+            # before weigh 0
+            tr = triez.Trie(compressed=compressed)
+            tr[uni_escape("cab")] = 1
+            tr[uni_escape("cob")] = 2
+            del tr[uni_escape("cob")]
+            self.assertEqual(tr.top_k_suffixes(uni_escape("c"), 2), 
+                [uni_escape("cab")])
+            mem_usage = tr.mem_usage()
+            tr.add(uni_escape("cat"), 3, 1)
+            self.assertTrue(tr.mem_usage() > mem_usage)
+            self.assertEqual(tr.top_k_suffixes(uni_escape("c"), 2), 
+                [uni_escape("cat"), uni_escape("cab")])
+
+            # weights shall be finite, a rejected one leaves the key as it is
+            for w in [float("nan"), float("inf"), float("-inf")]:
+                self.assertRaises(ValueError, tr.add, uni_escape("cab"), 4, w)
+            self.assertEqual(tr[uni_escape("cab")], 1)
+            self.assertEqual(tr.top_k_suffixes(uni_escape("c"), 2), 
+                [uni_escape("cat"), uni_escape("cab")])
+
+    def test_count_suffixes(self):
+        for compressed in [False, True]:
+            tr = triez.Trie(compressed=compressed)
+            keys = [uni_escape(k) for k in ["", "a", "ab", "abc", "abd", "b", 
+                "\u4e00", "\u4e00a"]]
+            for k in keys:
+                tr[k] = 1
+                tr[k] = 2 # replacing a key does not count it again
+            for p in keys + [uni_escape("abe"), uni_escape("c")]:
+                n = len([k for k in keys if k.startswith(p)])
+                self.assertEqual(tr.count_suffixes(p), n)
+                self.assertEqual(tr.count_suffixes(p), len(tr.suffixes(p)))
+                self.assertEqual(tr.has_any_suffix(p), n > 0)
+            del tr[uni_escape("ab")]
+            self.assertRaises(KeyError, tr.__delitem__, uni_escape("abx"))
+            self.assertRaises(KeyError, tr.__delitem__, uni_escape("ab"))
+            self.assertEqual(tr.count_suffixes(uni_escape("a")), 3)
+            del tr[uni_escape("abc")]
+            del tr[uni_escape("abd")]
+            self.assertFalse(tr.has_any_suffix(uni_escape("ab")))
+            self.assertEqual(tr.count_suffixes(uni_escape("")), len(tr))
+
+    def test_prefix_match(self):
+        for compressed in [False, True]:
+            tr = triez.Trie(compressed=compressed)
+            self.assertEqual(tr.longest_prefix(uni_escape("abc")), None)
+            for i, k in enumerate(["a", "abc", "abcde", "\u4e00b"]):
+                tr[uni_escape(k)] = i
+            s = uni_escape("xabcdx\u4e00bc")
+            self.assertEqual(tr.longest_prefix(s), None)
+            self.assertEqual(tr.longest_prefix(s, 1), (3, 1))
+            self.assertEqual(tr.shortest_prefix(s, offset=1), (1, 0))
+            self.assertEqual(tr.longest_prefix(s, 2), None)
+            self.assertEqual(tr.longest_prefix(s, 6), (2, 3))
+            self.assertEqual(tr.longest_prefix(s, len(s)), None)
+            self.assertRaises(IndexError, tr.longest_prefix, s, len(s) + 1)
+            tr[uni_escape("")] = 9
+            self.assertEqual(tr.shortest_prefix(s, 1), (0, 9))
+            self.assertEqual(tr.longest_prefix(s, len(s)), (0, 9))
+
+    def test_stats(self):
+        for compressed in [False, True]:
+            tr = triez.Trie(compressed=compressed)
+            keys = [uni_escape(k) for k in ["a", "ab", "abc", "b", "bcd"]]
+            for k in keys:
+                tr[k] = 1
+            st = tr.stats()
+            self.assertEqual(st["nodes"], tr.node_count())
+            self.assertEqual(st["terminal_nodes"], len(keys))
+            self.assertEqual(st["nonterminal_nodes"], st["nodes"] - len(keys))
+            self.assertEqual(sum(st["fanout"].values()), st["nodes"])
+            self.assertEqual(sum(st["depth"].values()), st["nodes"])
+            self.assertEqual(st["depth"][0], 1)
+            self.assertEqual(st["fanout"][2], 1) # the root
+            self.assertEqual(st["tails"] > 0, compressed)
+            self.assertEqual(st["mem_usage"], tr.mem_usage())
+            self.assertTrue(st["overhead"] > 0)
+
+    def test_find_all(self):
+        for compressed in [False, True]:
+            tr = triez.Trie(compressed=compressed)
+            for k in ["he", "she", "his", "hers", "\u4e00"]:
+                tr[uni_escape(k)] = k
+            tr.compile()
+            text = uni_escape("ushers \u4e00his")
+            self.assertEqual(tr.find_all(text), [(1, 4, "she"), (2, 4, "he"),
+                (2, 6, "hers"), (7, 8, "\u4e00"), (8, 11, "his")])
+            tr[uni_escape("us")] = "us" # drops the automaton
+            self.assertEqual(tr.find_all(text)[0], (0, 2, "us"))
+            del tr[uni_escape("she")]
+            self.assertEqual(len(tr.find_all(text)), 5)
+            self.assertEqual(tr.find_all(uni_escape("")), [])
+
+    def test_ordered(self):
+        for compressed in [False, True]:
+            tr = triez.Trie(compressed=compressed)
+            self.assertEqual(tr.first(), None)
+            self.assertEqual(tr.successor(uni_escape("a")), None)
+            keys = [uni_escape(k) for k in ["b", "", "abc", "abd", "a", 
+                "\u4e00", "\u4e00a", "ba", "abcdef"]]
+            for k in keys:
+                tr[k] = k
+            keys.sort()
+            self.assertEqual(list(tr), keys)
+            self.assertEqual(tr.first(), uni_escape(""))
+            self.assertEqual(tr.last(), uni_escape("\u4e00a"))
+            for q in keys + [uni_escape(k) for k in ["ab", "abcd", "abcz", 
+                "bb", "\u4e01", "0"]]:
+                succ = [k for k in keys if k > q]
+                pred = [k for k in keys if k < q]
+                self.assertEqual(tr.successor(q), succ[0] if succ else None)
+                self.assertEqual(tr.predecessor(q), pred[-1] if pred else None)
+                if q in keys:
+                    self.assertEqual(tr.successor(q, inclusive=True), q)
+                    self.assertEqual(tr.predecessor(q, inclusive=True), q)
+            self.assertEqual(list(tr.iter_range()), keys)
+            self.assertEqual(list(tr.iter_range(uni_escape("ab"), 
+                uni_escape("b"))), [uni_escape(k) for k in ["abc", "abcdef", 
+                "abd"]])
+            self.assertEqual(list(tr.iter_range(uni_escape("ba"), items=True)),
+                [(k, k) for k in keys if k >= uni_escape("ba")])
+            del tr[uni_escape("abc")]
+            del tr[uni_escape("abcdef")]
+            self.assertEqual(tr.successor(uni_escape("ab")), uni_escape("abd"))
+
+    def test_get_many(self):
+        keys = [uni_escape("mo"), uni_escape("mom"), uni_escape("m"), 
+            uni_escape(""), uni_escape("momo"), uni_escape("\\u0130st"), 
+            uni_escape("mob"), uni_escape("mom")]
+        for compressed in [False, True]:
+            tr = triez.Trie(compressed=compressed)
+            tr[uni_escape("mo")] = 1
+            tr[uni_escape("mom")] = 2
+            tr[uni_escape("\\u0130st")] = 3
+            tr[uni_escape("mob")] = 4
+            for sort in [False, True]:
+                self.assertEqual(tr.get_many(keys, sort=sort), 
+                    [1, 2, None, None, None, 3, 4, 2])
+                self.assertEqual(tr.get_many(keys, 0, sort=sort), 
+                    [1, 2, 0, 0, 0, 3, 4, 2])
+                self.assertEqual(tr.contains_many(keys + [1], sort=sort), 
+                    [True, True, False, False, False, True, True, True, False])
+            self.assertEqual(tr.get_many([]), [])
+            self.assertRaises(_triez.Error, tr.get_many, [uni_escape("mo"), 1])
+
+        lines = _read_lines(path="tests/out_keys_8859_9", encoding="iso-8859-9")
+        tr = triez.Trie.fromkeys(lines[::2], 1)
+        r = tr.contains_many(lines, sort=True)
+        self.assertEqual(r, [line in tr for line in lines])
+
+    def test_frozen(self):
+        import os
+        import tempfile
+
+        fd, path = tempfile.mkstemp()
+        os.close(fd)
+        try:
+            for compressed in [False, True]:
+                tr = triez.Trie(compressed=compressed)
+                tr[uni_escape("mo")] = 1
+                tr[uni_escape("mom")] = [uni_escape("x"), 2.5, None]
+                tr[uni_escape("\\u0130stanbul")] = (3, b"bytes")
+                tr.save(path)
+                ft = triez.FrozenTrie.mmap(path)
+                self.assertTrue(isinstance(ft, triez.FrozenTrie))
+                self.assertEqual(len(ft), 3)
+                # compressed edges are expanded
+                self.assertEqual(ft.node_count(), 
+                    3 + len(uni_escape("\\u0130stanbul")) + 1)
+                self.assertEqual(ft[uni_escape("mo")], 1)
+                self.assertEqual(ft[uni_escape("mom")], [uni_escape("x"), 2.5, None])
+                self.assertEqual(ft[uni_escape("\\u0130stanbul")], (3, b"bytes"))
+                self.assertTrue(uni_escape("mo") in ft)
+                self.assertFalse(uni_escape("m") in ft)
+                self.assertRaises(KeyError, ft.__getitem__, uni_escape("m"))
+                self.assertEqual(set(ft), set(tr))
+                self.assertEqual(ft.suffixes(uni_escape("m")), tr.suffixes(uni_escape("m")))
+                self.assertEqual(ft.prefixes(uni_escape("mom")), tr.prefixes(uni_escape("mom")))
+                self.assertEqual(ft.corrections(uni_escape("mx"), 1), 
+                    tr.corrections(uni_escape("mx"), 1))
+                self.assertEqual(ft.corrections_with_distances(uni_escape("mxo"), 2), 
+                    tr.corrections_with_distances(uni_escape("mxo"), 2))
+                del ft
+
+            lines = _read_lines(path="tests/out_keys_8859_9", encoding="iso-8859-9")
+            tr = triez.Trie()
+            for line in lines:
+                tr[line] = 2
+            tr.save(path)
+            ft = triez.FrozenTrie.mmap(path)
+            self.assertEqual(len(ft), 82489)
+            self.assertEqual(ft.node_count(), 310764)
+            self.assertEqual(ft[uni_escape("ramazan")], 2)
+            self.assertEqual(len(ft.corrections(uni_escape("ra"), 3)), 5639)
+            del ft
+
+            # values that cannot be marshalled
+            tr[uni_escape("x")] = object()
+            self.assertRaises(ValueError, tr.save, path)
+            with open(path, "wb") as f:
+                f.write(b"not a trie")
+            self.assertRaises(_triez.Error, triez.FrozenTrie.mmap, path)
+
+            # nodes and value offsets are validated, corrupt files are not
+            # opened. (header is 72 bytes, nodes are 16)
+            import struct
+            tr = triez.Trie()
+            tr[uni_escape("mo")] = 1
+            tr[uni_escape("mom")] = 2
+            tr.save(path)
+            with open(path, "rb") as f:
+                good = f.read()
+            node_count, item_count = struct.unpack_from("=QQ", good, 24)
+            offsets = struct.unpack_from("=Q", good, 64)[0]
+            corrupt = [
+                (72 + 12, 1000), # child_count of the root
+                (72 + 16 + 8, 0), # children of a node before it
+                (72 + 16*2 + 4, item_count + 1), # value index
+                (offsets + 8*item_count, 1 << 40), # value past the data
+            ]
+            for at, v in corrupt:
+                b = bytearray(good)
+                if at >= offsets:
+                    struct.pack_into("=Q", b, at, v)
+                else:
+                    struct.pack_into("=I", b, at, v)
+                with open(path, "wb") as f:
+                    f.write(bytes(b))
+                self.assertRaises(_triez.Error, triez.FrozenTrie.mmap, path)
+            with open(path, "wb") as f:
+                f.write(good)
+            ft = triez.FrozenTrie.mmap(path)
+            self.assertEqual(ft[uni_escape("mom")], 2)
+            del ft
+
+            # dead nodes of lazy deletes are not saved.
+            for compressed in [False, True]:
+                tr = triez.Trie(compressed=compressed, lazy_delete=True)
+                eager = triez.Trie(compressed=compressed)
+                for i in range(1000):
+                    tr[uni_escape("key%d" % (i, ))] = i
+                for i in range(1000):
+                    del tr[uni_escape("key%d" % (i, ))]
+                tr.save(path)
+                ft = triez.FrozenTrie.mmap(path)
+                self.assertEqual(len(ft), 0)
+                self.assertEqual(ft.node_count(), 1)
+                del ft
+                for i in range(0, 1000, 3):
+                    tr[uni_escape("key%d" % (i, ))] = i
+                    eager[uni_escape("key%d" % (i, ))] = i
+                tr.save(path)
+                ft = triez.FrozenTrie.mmap(path)
+                self.assertEqual(set(ft), set(eager))
+                self.assertEqual(ft[uni_escape("key999")], 999)
+                node_count = ft.node_count()
+                del ft
+                eager.save(path)
+                ft = triez.FrozenTrie.mmap(path)
+                self.assertEqual(ft.node_count(), node_count)
+                del ft
+        finally:
+            if os.path.exists(path):
+                os.remove(path)
+
+    def test_snapshot(self):
+        for compressed in [False, True]:
+            tr = triez.Trie(compressed=compressed)
+            for k in [uni_escape("mo"), uni_escape("mom"), uni_escape("mob"),
+                uni_escape("\\u0130stanbul")]:
+                tr[k] = k
+            s = tr.snapshot()
+            self.assertTrue(isinstance(s, triez.Trie))
+            tr[uni_escape("mom")] = 2
+            tr[uni_escape("momo")] = 3
+            del tr[uni_escape("mob")]
+            del tr[uni_escape("\\u0130stanbul")]
+            self.assertEqual(len(s), 4)
+            self.assertEqual(s[uni_escape("mom")], uni_escape("mom"))
+            self.assertEqual(s[uni_escape("mob")], uni_escape("mob"))
+            self.assertFalse(uni_escape("momo") in s)
+            self.assertEqual(sorted(s), sorted([uni_escape("mo"), uni_escape("mom"),
+                uni_escape("mob"), uni_escape("\\u0130stanbul")]))
+            self.assertEqual(sorted(tr), [uni_escape("mo"), uni_escape("mom"),
+                uni_escape("momo")])
+            self.assertEqual(tr[uni_escape("mom")], 2)
+
+            # snapshots are read-only, a snapshot of a snapshot sees the same keys.
+            self.assertRaises(TypeError, s.__setitem__, uni_escape("x"), 1)
+            self.assertRaises(TypeError, s.__delitem__, uni_escape("mo"))
+            s2 = s.snapshot()
+            del s
+            self.assertEqual(s2[uni_escape("mob")], uni_escape("mob"))
+            self.assertEqual(len(s2), 4)
+            del s2
+            tr[uni_escape("mob")] = 4
+            self.assertEqual(tr[uni_escape("mob")], 4)
+            self.assertEqual(len(tr), 4)
+
+            # values released by the last snapshot may write to the trie.
+            class A:
+                def __del__(self):
+                    tr[uni_escape("del")] = 1
+            tr[uni_escape("a")] = A()
+            s = tr.snapshot()
+            del tr[uni_escape("a")]
+            self.assertFalse(uni_escape("del") in tr)
+            del s
+            self.assertEqual(tr[uni_escape("del")], 1)
+
+    def test_lazy_delete(self):
+        lines = _read_lines(path="tests/out_keys_8859_9", encoding="iso-8859-9")
+        for compressed in [False, True]:
+            tr = triez.Trie(compressed=compressed, lazy_delete=True)
+            eager = triez.Trie(compressed=compressed)
+            for i, line in enumerate(lines):
+                tr.add(line, i, weight=i % 7)
+                eager.add(line, i, weight=i % 7)
+            node_count = tr.node_count()
+            for line in lines[::3]:
+                del tr[line]
+                del eager[line]
+            self.assertRaises(KeyError, tr.__delitem__, lines[0])
+            # dead nodes stay until compact(), but hold no keys.
+            self.assertEqual(tr.node_count(), node_count)
+            self.assertEqual(len(tr), len(eager))
+            self.assertEqual(tr.first(), eager.first())
+            self.assertEqual(tr.last(), eager.last())
+            self.assertEqual(tr.suffixes(uni_escape("ra")),
+                eager.suffixes(uni_escape("ra")))
+            self.assertEqual(tr.top_k_suffixes(uni_escape("a"), 10),
+                eager.top_k_suffixes(uni_escape("a"), 10))
+
+            it = tr.iter_suffixes()
+            next(it)
+            self.assertTrue(tr.compact() > 0)
+            self.assertRaises(RuntimeError, next, it)
+            self.assertEqual(tr.node_count(), eager.node_count())
+            self.assertEqual(tr.compact(), 0)
+            self.assertEqual(set(tr), set(eager))
+            self.assertEqual(tr.top_k_suffixes(uni_escape("a"), 10),
+                eager.top_k_suffixes(uni_escape("a"), 10))
+            tr[lines[0]] = 1
+            self.assertEqual(tr[lines[0]], 1)
+
+    def test_threads(self):
+        import threading
+        for compressed in [False, True]:
+            tr = triez.Trie(compressed=compressed)
+            for i in range(2000):
+                tr[uni_escape("key%d" % (i, ))] = i
+            crs = tr.corrections(uni_escape("key12"), 2)
+            dists = tr.corrections_with_distances(uni_escape("key12"), 2)
+            sfxs = tr.suffixes(uni_escape("key1"))
+            top = tr.top_k_suffixes(uni_escape("key"), 5)
+
+            # readers run without the GIL while keys that they do not see are
+            # added and deleted. Keys under "ke" grow and shrink the index of a
+            # node that every reader passes.
+            errors = []
+            def _read():
+                try:
+                    for i in range(50):
+                        self.assertEqual(tr.corrections(uni_escape("key12"), 2), 
+                            crs)
+                        self.assertEqual(tr.corrections_with_distances(
+                            uni_escape("key12"), 2), dists)
+                        self.assertEqual(tr.suffixes(uni_escape("key1")), sfxs)
+                        self.assertEqual(tr.top_k_suffixes(uni_escape("key"), 5), 
+                            top)
+                        self.assertEqual(tr.contains_many([uni_escape("key5"),
+                            uni_escape("x")]), [True, False])
+                except Exception as e:
+                    errors.append(e)
+
+            chars = [unichr(i) for i in range(0x20, 0x100) if i != ord('y')] + \
+                [unichr(i) for i in range(0x4e00, 0x4e40)]
+            threads = [threading.Thread(target=_read) for i in range(4)]
+            for t in threads:
+                t.start()
+            for i in range(20000):
+                tr[uni_escape("other%d" % (i % 500, ))] = i
+                if i % 3 == 0:
+                    del tr[uni_escape("other%d" % (i % 500, ))]
+                k = uni_escape("ke") + chars[i % len(chars)] + uni_escape("zzzz")
+                if (i // len(chars)) % 2:
+                    del tr[k]
+                else:
+                    tr[k] = i
+            tr.update((uni_escape("more%d" % (i, )), i) for i in range(5000))
+            for t in threads:
+                t.join()
+            self.assertEqual(errors, [])
+            self.assertEqual(len(tr.suffixes(uni_escape("key"))), 2000)
+
     def test_refcount(self):
 
         def _GRC(obj):
@@ -2,6 +2,19 @@
 #include "trie.h"
 #include "string.h"
 
+#ifdef TRIE_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef __WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 //#define DEBUG_PRINT
 
 #ifdef DEBUG_PRINT
@@ -10,11 +23,40 @@
 #define _DPRINT(x)
 #endif
 
+// initial and max. node count of a slab. See _trie_slot.
+#define TRIE_SLAB_MIN_SIZE 64
+#define TRIE_SLAB_MAX_SIZE (1UL << TRIE_SLAB_SHIFT)
+#define TRIE_SLAB_MASK (TRIE_SLAB_MAX_SIZE - 1)
+// max. slab count of a trie, as ids are 32 bits. (See Note 11)
+#define TRIE_SLAB_COUNT_MAX (1UL << (32 - TRIE_SLAB_SHIFT))
+#define SLAB_NODES(sl) ((trie_node_t *)((char *)(sl) + TRIE_SLAB_HEADER))
+
+// nodes on the path of a key that add and delete remember to update their key
+// counts, the counts of longer paths are updated by walking the key again.
+#define TRIE_COUNT_PATH 64
+
+// children count limits of the child indexes. Shrinking happens a bit below
+// the growth limits so that add/del around a limit does not rebuild the index
+// every time. See trie_index_t.
+#define TRIE_INDEX_MIN 5
+#define TRIE_INDEX16_SHRINK 12
+#define TRIE_INDEX48_SHRINK 40
+
+#ifdef TRIE_STATS
+trie_counters_t trie_counters;
+#endif
+
+// count of key chars on the edge of a node. (See Note 5)
+#define EDGE_SIZE(t, p) (1 + (_node_tail(t, p) ? _node_tail(t, p)->size : 0))
+
+// Memory is counted in t->mem_usage if t is given. Enumeration functions 
+// pass NULL for their temporary buffers, as they may run concurrently without
+// holding the GIL. (See _triez.c) That is also why the raw allocator is used.
 void *TRIEMALLOC(trie_t *t, unsigned long size)
 {
     void *p;
 
-    p = PyMem_Malloc(size + sizeof(unsigned long));
+    p = TRIE_RAW_MALLOC(size + sizeof(unsigned long));
     if (!p) {
         return NULL;
     }
@@ -27,18 +69,25 @@ void *TRIEMALLOC(trie_t *t, unsigned long size)
 
 void TRIEFREE(trie_t *t, void *p)
 {
-    assert(t != NULL);
-    
     p = (char *)p - sizeof(unsigned long);
-    t->mem_usage -= *(unsigned long *)p;
-    PyMem_Free(p);
+    if (t) {
+        t->mem_usage -= *(unsigned long *)p;
+    }
+    TRIE_RAW_FREE(p);
 }
 
+// Keys are written from left to right while enumerating, so the max. char of
+// every prefix is tracked along. It lets the results be built in the narrowest
+// string kind without scanning them again. (See trie_key_max_char)
 void KEY_CHAR_WRITE(trie_key_t *k, unsigned long index, TRIE_CHAR in)
 {
     assert(k->char_size >= sizeof(TRIE_CHAR));
 
     *(TRIE_CHAR *)&k->s[index*k->char_size] = in;
+    if (k->max_char) {
+        k->max_char[index] = (index && k->max_char[index-1] > in) ? 
+            k->max_char[index-1] : in;
+    }
 }
 
 void KEY_CHAR_READ(trie_key_t *k, unsigned long index, TRIE_CHAR *out)
@@ -65,11 +114,51 @@ void KEY_CHAR_READ(trie_key_t *k, unsigned long index, TRIE_CHAR *out)
     }
 }
 
+// Recomputes max_char of k from index on, for chars that are not written 
+// from left to right.
+void _key_max_update(trie_key_t *k, unsigned long index, unsigned long size)
+{
+    unsigned long i;
+    TRIE_CHAR m;
+
+    if (!k->max_char) {
+        return;
+    }
+    m = index ? k->max_char[index-1] : 0;
+    for (i=index;i<size;i++) {
+        if (((TRIE_CHAR *)k->s)[i] > m) {
+            m = ((TRIE_CHAR *)k->s)[i];
+        }
+        k->max_char[i] = m;
+    }
+}
+
+TRIE_CHAR trie_key_max_char(trie_key_t *k)
+{
+    unsigned long i;
+    TRIE_CHAR ch, m;
+
+    if (!k->size) {
+        return 0;
+    }
+    if (k->max_char) {
+        return k->max_char[k->size-1];
+    }
+    m = 0;
+    for (i=0;i<k->size;i++) {
+        KEY_CHAR_READ(k, i, &ch);
+        if (ch > m) {
+            m = ch;
+        }
+    }
+    return m;
+}
+
 void KEYCPY(trie_key_t *dst, trie_key_t *src, unsigned long dst_index,
         unsigned long src_index, unsigned long length)
 {
-    unsigned int i,j;
-    char *srcb, *dstb;
+    unsigned long i;
+    TRIE_CHAR ch;
 
     if (length == 0) {
         return;
@@ -79,12 +168,17 @@ void KEYCPY(trie_key_t *dst, trie_key_t *src, unsigned long dst_index,
     assert(src_index+length-1 < src->size);
     assert(dst->char_size >= src->char_size);
 
+    if (dst->char_size == src->char_size) {
+        memcpy(&dst->s[dst_index*dst->char_size], 
+            &src->s[src_index*src->char_size], length*src->char_size);
+        _key_max_update(dst, dst_index, dst_index+length);
+        return;
+    }
+
+    // widen the chars
     for (i=0;i<length;i++) {
-        srcb = &src->s[(src_index+i) * src->char_size];
-        dstb = &dst->s[(dst_index+i) * dst->char_size];
-        for (j=0;j<src->char_size;j++) {
-            dstb[j] = srcb[j];
-        }
+        KEY_CHAR_READ(src, src_index+i, &ch);
+        KEY_CHAR_WRITE(dst, dst_index+i, ch);
     }
 }
 
@@ -96,7 +190,9 @@ trie_key_t *KEYCREATE(trie_t *t, unsigned long length, unsigned char char_size)
     if (!k) {
         return NULL;
     }
-    k->s = (char *)TRIEMALLOC(t, length*char_size);
+    // max_char shares the block with s. (See KEY_CHAR_WRITE)
+    k->s = (char *)TRIEMALLOC(t, length*char_size + (char_size == 
+        sizeof(TRIE_CHAR) ? length*sizeof(TRIE_CHAR) : 0));
     if (!k->s) {
         TRIEFREE(t, k);
         return NULL;
@@ -105,6 +201,10 @@ trie_key_t *KEYCREATE(trie_t *t, unsigned long length, unsigned char char_size)
     k->size = length;
     k->char_size = char_size;
     k->alloc_size = length;
+    k->max_char = NULL;
+    if (char_size == sizeof(TRIE_CHAR)) {
+        k->max_char = (TRIE_CHAR *)&k->s[length*char_size];
+    }
 
     return k;
 }
@@ -167,375 +267,3211 @@ iter_pos_t *PEEKI(iter_stack_t *k)
     return &k->_elems[k->index-1];
 }
 
-trie_node_t *NODECREATE(trie_t* t, TRIE_CHAR key, TRIE_DATA value)
+void INDEXFREE(trie_t *t, trie_index_t *ix)
 {
-    trie_node_t *nd;
-
-    nd = (trie_node_t *)TRIEMALLOC(t, sizeof(trie_node_t));
-    if (nd) {
-        nd->key = key;
-        nd->value = value;
-        nd->next = NULL;
-        nd->children = NULL;
+    if (ix->wnodes) {
+        TRIEFREE(t, ix->wnodes);
     }
-    return nd;
+    TRIEFREE(t, ix);
 }
 
-void NODEFREE(trie_t* t, trie_node_t *nd)
+trie_index_t *INDEXCREATE(trie_t *t, trie_index_type_t type)
 {
-    TRIEFREE(t, nd);
-}
+    trie_index_t *ix;
+    unsigned long size;
 
-trie_t *trie_create(void)
-{
-    trie_t *t;
+    switch(type)
+    {
+        case NODE16:
+            size = sizeof(trie_index16_t);
+            break;
+        case NODE48:
+            size = sizeof(trie_index48_t);
+            break;
+        default:
+            size = sizeof(trie_index256_t);
+            break;
+    }
 
-    t = (trie_t *)TRIEMALLOC(NULL, sizeof(trie_t));
-    if (t) {
-        t->mem_usage += sizeof(trie_t);
-        t->root = NODECREATE(t, (TRIE_CHAR)0, (TRIE_DATA)0); // root is a dummy node
-        t->node_count = 1;
-        t->item_count = 0;
-        t->height = 1;
-        t->dirty = 0;
-        t->mem_usage = 0;
+    ix = (trie_index_t *)TRIEMALLOC(t, size);
+    if (!ix) {
+        return NULL;
     }
-    return t;
+    memset(ix, 0, size);
+    ix->type = type;
+
+    return ix;
 }
 
-void trie_destroy(trie_t *t)
+trie_tail_t *TAILCREATE(trie_t *t, unsigned long size)
 {
-    trie_node_t *curr, *parent, *next;
-
-    while(t->node_count > 0)
-    {
-        curr = t->root;
-        parent = NULL;
-        while(curr->children) {
-            parent = curr;
-            curr = curr->children;
-        }
+    trie_tail_t *tl;
 
-        if (parent) {
-            next = parent->children->next;
-            NODEFREE(t, parent->children);
-            parent->children = next;
-        } else { // root remaining
-            NODEFREE(t, t->root);
-        }
-        t->node_count--;
+    tl = (trie_tail_t *)TRIEMALLOC(t, sizeof(trie_tail_t) + 
+        (size-1)*sizeof(TRIE_CHAR));
+    if (!tl) {
+        return NULL;
     }
-    TRIEFREE(t, t);
+    tl->size = size;
+
+    return tl;
 }
 
-unsigned long trie_mem_usage(trie_t *t)
+void TAILFREE(trie_t *t, trie_tail_t *tl)
 {
-    return t->mem_usage;
+    TRIEFREE(t, tl);
 }
 
-trie_node_t *_trie_prefix(trie_node_t *t, trie_key_t *key)
+// Returns the node of id, NULL if id is 0. (See Note 11) Ids that readers 
+// follow are loaded with acquire semantics, so that the slab array is at 
+// least as new as the node. (See _node_children) The helpers that decode ids
+// are static, so that they are inlined in the position independent code of 
+// the extension module too.
+static trie_node_t *_node_at(trie_t *t, uint32_t id)
 {
-    TRIE_CHAR ch;
-    unsigned int i;
-    trie_node_t *curr, *parent;
-
-    if (!t){
+    if (!id) {
         return NULL;
     }
-    i = 0;
-    parent = t;
-    curr = t->children;
-    while(i < key->size)
-    {
-        KEY_CHAR_READ(key, i, &ch);
+    return &SLAB_NODES(TRIE_LOAD_ACQUIRE(&t->slabs)[id >> TRIE_SLAB_SHIFT])[
+        id & TRIE_SLAB_MASK];
+}
 
-        while(curr && curr->key != ch) {
-            curr = curr->next;
-        }
-        if (!curr) {
-            return NULL;
-        }
+static trie_node_t *_node_children(trie_t *t, trie_node_t *p)
+{
+    return _node_at(t, TRIE_LOAD_ACQUIRE(&p->children));
+}
 
-        parent = curr;
-        curr = curr->children;
-        i++;
-    }
+static trie_node_t *_node_next(trie_t *t, trie_node_t *p)
+{
+    return _node_at(t, TRIE_LOAD_ACQUIRE(&p->next));
+}
 
-    return parent;
+static uint32_t _node_id(trie_node_t *p)
+{
+    return p ? p->id : 0;
 }
 
-trie_node_t *trie_search(trie_t *t, trie_key_t *key)
+// NULL if p has neither an index nor a tail.
+static trie_ext_t *_node_ext(trie_t *t, trie_node_t *p)
 {
-    trie_node_t *r;
+    return (trie_ext_t *)_node_at(t, TRIE_LOAD_ACQUIRE(&p->ext));
+}
 
-    r = _trie_prefix(t->root, key);
-    if (r && !r->value)
-    {
-        return NULL;
-    }
+static trie_index_t *_node_index(trie_t *t, trie_node_t *p)
+{
+    trie_ext_t *e;
 
-    return r;
+    e = _node_ext(t, p);
+    return e ? e->index : NULL;
 }
 
-int trie_add(trie_t *t, trie_key_t *key, TRIE_DATA value)
+static trie_tail_t *_node_tail(trie_t *t, trie_node_t *p)
 {
-    TRIE_CHAR ch;
-    unsigned int i;
-    trie_node_t *curr, *parent;
+    trie_ext_t *e;
 
-    i = 0;
-    parent = t->root;
-    curr = t->root->children;
-    while(i < key->size)
-    {
-        KEY_CHAR_READ(key, i, &ch);
-        
-        while(curr && curr->key != ch) {
-            curr = curr->next;
-        }
-        if (!curr) {
-            curr = NODECREATE(t, ch, (TRIE_DATA)0);
-            if (!curr){
-                return 0;
-            }
+    e = _node_ext(t, p);
+    return e ? e->tail : NULL;
+}
 
-            curr->next = parent->children;
-            parent->children = curr;
-            t->node_count++;
-        }
-        parent = curr;
-        curr = curr->children;
-        i++;
-    }
+// Slabs hold weights only once a key of t is given a nonzero weight. (See 
+// Note 6) Returns NULL if t is not weighted.
+static trie_weight_t *_node_weight(trie_t *t, trie_node_t *p)
+{
+    trie_weight_t *w;
 
-    if (!parent->value) {
-        t->item_count++;
-        t->dirty = 1;
-    }
+    w = TRIE_LOAD_ACQUIRE(&TRIE_LOAD_ACQUIRE(&t->slabs)[
+        p->id >> TRIE_SLAB_SHIFT]->weights);
+    return w ? &w[p->id & TRIE_SLAB_MASK] : NULL;
+}
 
-    if (key->size > t->height) {
-        t->height = key->size;
-    }
+// Every key of a trie that is not weighted weighs 0.
+TRIE_WEIGHT _node_get_weight(trie_t *t, trie_node_t *p)
+{
+    trie_weight_t *w;
 
-    parent->value = value;
-    return 1;
+    w = _node_weight(t, p);
+    return w ? w->weight : 0;
 }
 
-// Algorithm:  First traverse the key and reverse the linked-list of children,
-// while reversing, move the branched nodes to the head then traverse back and
-// try to delete the node if no children is associated with it. Harder to implement
-// however performance is better as we iterate key only once.
-// Complexity: O(m)
-int trie_del(trie_t *t, trie_key_t *key)
+// The max. weight of a subtree with no weights is 0 if it has any keys.
+TRIE_WEIGHT _node_get_max_weight(trie_t *t, trie_node_t *p)
 {
-    unsigned int i, found;
-    trie_node_t *curr, *prev, *it, *parent;
-    TRIE_CHAR ch;
-
-    // iterate forward and reverse the linked-list
-    found = 1;
-    i = 0;
-    parent = t->root;
-    curr = t->root->children;
-    while(i < key->size)
-    {
-        KEY_CHAR_READ(key, i, &ch);
-        prev = it = curr;
-        while(it && it->key != ch) {
-            prev = it;
-            it=it->next;
-        }
-        if (!it) {
-            found = 0;
-            break; // should be rollbacked
-        }
-        if (it != curr) {
-            // curr points to head of next-list here. move the branched item
-            // to head(by pointing to curr) for latter back-traversing.
-            prev->next = it->next;
-            it->next = curr;
-        }
+    trie_weight_t *w;
 
-        curr = it->children;
-        it->children = parent;
-        parent = it;
-        i++;
+    w = _node_weight(t, p);
+    if (w) {
+        return w->max_weight;
     }
+    return p->count ? 0 : TRIE_WEIGHT_NONE;
+}
 
-    // key is found, but do we really have added it?
-    found = found && parent->value;
-
-    // remove key
-    if (found) {
-        parent->value = 0;
-    }
+// Copies the weights of src to dst.
+void _node_copy_weight(trie_t *t, trie_node_t *dst, trie_node_t *src)
+{
+    trie_weight_t *w;
 
-    // traverse backwards
-    prev = curr;
-    curr = parent;
-    while(i--)
-    {
-        it = curr->children;
-        curr->children = prev;
-
-        // no-child and no-val and item is added/found?
-        if (found && !curr->children && !curr->value) {
-            // we know curr == it->children as we move it to head before.
-            prev = curr->next;
-            NODEFREE(t, curr);
-            t->node_count--;
-        } else {
-            prev = curr;
-        }
-        curr = it;
-    }
-    t->root->children = prev;
-    if (found) {
-        t->item_count--;
-        t->dirty = 1;
+    w = _node_weight(t, dst);
+    if (w) {
+        *w = *_node_weight(t, src);
     }
-
-    return found;
 }
 
-iter_t * ITERATORCREATE(trie_t *t, trie_key_t *key, unsigned long max_depth, 
-    unsigned long alloc_size, unsigned long stack_size1, unsigned long stack_size2)
+// Returns the index of a free entry of t->slabs: a released one if there is
+// any, otherwise the array grows. Replaced arrays are kept until t is 
+// destroyed, as readers and snapshots of t might still be on them. They are 
+// chained by the entry before their first one. Returns TRIE_SLAB_COUNT_MAX if
+// there is no room.
+unsigned long _trie_slab_entry(trie_t *t)
 {
-    iter_t *r;
-    iter_stack_t *k0,*k1;
-    trie_key_t *kp;
+    trie_slab_t **slabs;
+    unsigned long i, alloc;
 
-    // alloc a key that can hold size + max_depth chars.
-    kp = KEYCREATE(t, alloc_size, sizeof(TRIE_CHAR));
-    if (!kp) {
-        return NULL;
+    if (t->slab_count < t->slab_alloc && !t->slab_released) {
+        return t->slab_count++;
     }
-
-    KEYCPY(kp, key, 0, 0, key->size);
-    kp->size = key->size;
-
-    // allocate stacks
-    k0 = STACKCREATE(t, stack_size1);
-    if (!k0) {
-        KEYFREE(t, kp);
-        return NULL;
+    if (t->slab_released) {
+        for (i=0;t->slabs[i];i++)
+            ;
+        t->slab_released--;
+        return i;
     }
-    k1 = STACKCREATE(t, stack_size2);
-    if (!k1) {
-        KEYFREE(t, kp);
-        STACKFREE(t, k0);
-        return NULL;
+    if (t->slab_alloc == TRIE_SLAB_COUNT_MAX) {
+        return TRIE_SLAB_COUNT_MAX;
     }
+    alloc = t->slab_alloc ? t->slab_alloc * 2 : 4;
+    if (alloc > TRIE_SLAB_COUNT_MAX) {
+        alloc = TRIE_SLAB_COUNT_MAX;
+    }
+    slabs = (trie_slab_t **)TRIEMALLOC(t, (alloc + 1) * sizeof(trie_slab_t *));
+    if (!slabs) {
+        return TRIE_SLAB_COUNT_MAX;
+    }
+    slabs[0] = (trie_slab_t *)(void *)t->slabs;
+    slabs++;
+    if (t->slabs) {
+        memcpy(slabs, t->slabs, t->slab_count * sizeof(trie_slab_t *));
+    }
+    TRIE_STORE_RELEASE(&t->slabs, slabs);
+    t->slab_alloc = alloc;
+    return t->slab_count++;
+}
 
-    // alloc iterator obj
-    r = (iter_t *)TRIEMALLOC(t, sizeof(iter_t));
-    if (!r) {
-        KEYFREE(t, kp);
-        STACKFREE(t, k0);
-        STACKFREE(t, k1);
+// Creates a slab of size nodes at t->slabs[i].
+trie_slab_t *SLABCREATE(trie_t *t, unsigned long i, unsigned long size)
+{
+    trie_slab_t *sl;
+    void *block;
+
+    // nodes follow the header, aligned so that no node spans 2 cache lines,
+    // and the ext bitmap follows the nodes.
+    block = TRIEMALLOC(t, 2*TRIE_SLAB_HEADER - 1 + size*sizeof(trie_node_t) + 
+        size / 8);
+    if (!block) {
         return NULL;
     }
-
-    r->first = 1;
-    r->last = 0;
-    r->fail = 0;
-    r->fail_reason = UNDEFINED;
-    r->key = kp;
-    r->stack0 = k0;
-    r->stack1 = k1;
-    r->max_depth = max_depth;
-    r->trie = t;
-    t->dirty = 0; // reset dirty flag just before iteration
-    r->keylen_reached = 0;
-    r->depth_reached = 0;
-    
-    return r;
+    sl = (trie_slab_t *)(((uintptr_t)block + TRIE_SLAB_HEADER - 1) & 
+        ~(uintptr_t)(TRIE_SLAB_HEADER - 1));
+    sl->block = block;
+    sl->weights = NULL;
+    if (t->flags & TRIE_WEIGHTED) {
+        sl->weights = (trie_weight_t *)TRIEMALLOC(t, 
+            size*sizeof(trie_weight_t));
+        if (!sl->weights) {
+            TRIEFREE(t, block);
+            return NULL;
+        }
+    }
+    sl->own = NULL;
+    sl->ext = (unsigned char *)&SLAB_NODES(sl)[size];
+    memset(sl->ext, 0, size / 8);
+    sl->size = (uint32_t)size;
+    sl->used = 0;
+    sl->free = 0;
+    t->slabs[i] = sl;
+
+    return sl;
 }
 
-void ITERATORFREE(trie_t *t, iter_t *iter)
+void SLABFREE(trie_t *t, trie_slab_t *sl)
 {
-    KEYFREE(t, iter->key);
-    STACKFREE(t, iter->stack0);
-    STACKFREE(t, iter->stack1);
-    TRIEFREE(t, iter);
+    if (sl->own) {
+        TRIEFREE(t, sl->own);
+    }
+    if (sl->weights) {
+        TRIEFREE(t, sl->weights);
+    }
+    TRIEFREE(t, sl->block);
 }
 
-void iterator_deinit(iter_t *iter)
+// Adds a slab of size nodes to t. Returns its index, TRIE_SLAB_COUNT_MAX on 
+// failure.
+unsigned long _trie_slab_add(trie_t *t, unsigned long size)
 {
-    assert(iter != NULL);
+    unsigned long i;
 
-    ITERATORFREE(iter->trie, iter);
+    i = _trie_slab_entry(t);
+    if (i != TRIE_SLAB_COUNT_MAX && !SLABCREATE(t, i, size)) {
+        t->slabs[i] = NULL;
+        t->slab_released++;
+        i = TRIE_SLAB_COUNT_MAX;
+    }
+    return i;
 }
 
-void _suffixes(trie_node_t *p, trie_key_t *key, unsigned long index, 
-    trie_enum_cbk_t cbk, void* cbk_arg)
+// Gives the slabs of t their weights, once a key of t is given a nonzero 
+// weight. Until then every key weighs 0, so the max. weight of a node is 0 if
+// it has any keys below it. (See Note 6) The weights of a slab are published 
+// after they are set, readers might be on t. Returns 0 on allocation failure,
+// t is not changed then.
+int _trie_weigh(trie_t *t)
 {
-    if (p->value) {
-        cbk(key, cbk_arg);
+    trie_weight_t **ws, *w;
+    trie_slab_t *sl;
+    trie_node_t *nd;
+    unsigned long i, k;
+
+    if (t->flags & TRIE_WEIGHTED) {
+        return 1;
     }
-    
-    if (index == key->alloc_size) {
-        return;
+    ws = NULL;
+    if (t->slab_count) {
+        ws = (trie_weight_t **)TRIEMALLOC(NULL, t->slab_count * 
+            sizeof(trie_weight_t *));
+        if (!ws) {
+            return 0;
+        }
     }
-    p = p->children;
-    while(p){
-        KEY_CHAR_WRITE(key, index, p->key);
-        key->size = index+1;
-        
-        _suffixes(p, key, index+1, cbk, cbk_arg);
-      
-        p = p->next;
+    for (k=0;k<t->slab_count;k++) {
+        ws[k] = NULL;
+        sl = t->slabs[k];
+        if (!sl) {
+            continue;
+        }
+        ws[k] = (trie_weight_t *)TRIEMALLOC(t, sl->size*sizeof(trie_weight_t));
+        if (!ws[k]) {
+            while(k-- > 0) {
+                if (ws[k]) {
+                    TRIEFREE(t, ws[k]);
+                }
+            }
+            TRIEFREE(NULL, ws);
+            return 0;
+        }
+    }
+
+    for (k=0;k<t->slab_count;k++) {
+        sl = t->slabs[k];
+        if (!sl) {
+            continue;
+        }
+        w = ws[k];
+        for (i=0;i<sl->used;i++) {
+            nd = &SLAB_NODES(sl)[i];
+            w[i].weight = 0;
+            w[i].max_weight = nd->count ? 0 : TRIE_WEIGHT_NONE;
+        }
+        TRIE_STORE_RELEASE(&sl->weights, w);
     }
+    if (ws) {
+        TRIEFREE(NULL, ws);
+    }
+    t->flags |= TRIE_WEIGHTED;
+    return 1;
 }
 
-void trie_suffixes(trie_t *t, trie_key_t *key, unsigned long max_depth, 
-    trie_enum_cbk_t cbk, void* cbk_arg)
+// 1 if nd may be reached by a snapshot of t.
+int _node_shared(trie_t *t, trie_node_t *nd)
 {
-    trie_key_t *kp;
-    trie_node_t *prefix;
-    unsigned long index;
+    trie_slab_t *sl;
+    unsigned long i;
 
-    // first search key
-    prefix = _trie_prefix(t->root, key);
-    if (!prefix) {
-        return;
+    if (!t->shared_count) {
+        return 0;
     }
+    sl = t->slabs[nd->id >> TRIE_SLAB_SHIFT];
+    if (!sl->own) {
+        return 0;
+    }
+    i = nd->id & TRIE_SLAB_MASK;
+    return !(sl->own[i >> 3] & (1 << (i & 7)));
+}
 
-    // alloc a key that can hold size + max_depth chars.
-    kp = KEYCREATE(t, (key->size + max_depth), sizeof(TRIE_CHAR));
-    if (!kp) {
+// Marks the node of id as owned by t, it is not shared with the snapshots.
+void _node_own(trie_t *t, uint32_t id)
+{
+    trie_slab_t *sl;
+    unsigned long i;
+
+    if (!t->shared_count) {
         return;
     }
-    KEYCPY(kp, key, 0, 0, key->size);
-    kp->size = key->size;
-    
-    index = 0;
-    if (kp->size > 0) {
-        index = kp->size;
+    sl = t->slabs[id >> TRIE_SLAB_SHIFT];
+    if (sl->own) {
+        i = id & TRIE_SLAB_MASK;
+        sl->own[i >> 3] |= (unsigned char)(1 << (i & 7));
     }
-
-    _suffixes(prefix, kp, index, cbk, cbk_arg);
-
-    KEYFREE(t, kp);
 }
 
-iter_t *trie_itersuffixes_init(trie_t *t, trie_key_t *key, unsigned long max_depth)
+// Returns an unused node of t with only its id set, NULL on allocation 
+// failure. Nodes of the free-list are reused first.
+trie_node_t *_trie_slot(trie_t *t)
 {
-    iter_t *iter;
-    trie_node_t *prefix;
-
-    // first search key
-    prefix = _trie_prefix(t->root, key);
-    if (!prefix) {
-        return NULL;
+    trie_node_t *nd;
+    trie_slab_t *sl;
+    unsigned long i, k, size;
+    uint32_t id;
+
+    if (t->free_nodes) {
+        id = t->free_nodes;
+        nd = _node_at(t, id);
+        t->free_nodes = nd->next;
+        t->slabs[id >> TRIE_SLAB_SHIFT]->free--;
+        nd->id = id;
+        _node_own(t, id);
+        return nd;
     }
 
-    // create the iterator obj
-    iter = ITERATORCREATE(t, key, max_depth, (key->size + max_depth), 
-        max_depth, 0);
-    if (!iter) {
-        return NULL;
-    }
+    sl = t->slab_count ? t->slabs[t->slab_cur] : NULL;
+    if (!sl || sl->used == sl->size) {
+        // slabs made by trie_reserve() might be waiting.
+        for (k=1;k<t->slab_count;k++) {
+            i = (t->slab_cur + k) % t->slab_count;
+            if (t->slabs[i] && t->slabs[i]->used < t->slabs[i]->size) {
+                break;
+            }
+        }
+        if (k >= t->slab_count) {
+            // every new slab is twice the size of the previous one, so small
+            // tries stay small and big ones do not call malloc too often.
+            size = TRIE_SLAB_MIN_SIZE;
+            if (sl) {
+                size = sl->size * 2;
+                if (size > TRIE_SLAB_MAX_SIZE) {
+                    size = TRIE_SLAB_MAX_SIZE;
+                }
+            }
+            i = _trie_slab_add(t, size);
+            if (i == TRIE_SLAB_COUNT_MAX) {
+                return NULL;
+            }
+        }
+        t->slab_cur = i;
+        sl = t->slabs[i];
+    }
+    id = (uint32_t)(t->slab_cur << TRIE_SLAB_SHIFT | sl->used);
+    nd = &SLAB_NODES(sl)[sl->used];
+    sl->used++;
+    nd->id = id;
+    _node_own(t, id);
+
+    return nd;
+}
+
+// Puts the node of id on the free-list. Its value, children and ext are 
+// cleared, as trie_destroy() visits every used node, and its id is 0, which 
+// tells it from the used ones. (See _trie_release_slabs) A free node is owned
+// by t, so that _trie_thaw() does not free it once more.
+void _trie_slot_free(trie_t *t, uint32_t id)
+{
+    trie_slab_t *sl;
+    trie_node_t *nd;
+    unsigned long i;
+
+    sl = t->slabs[id >> TRIE_SLAB_SHIFT];
+    i = id & TRIE_SLAB_MASK;
+    sl->ext[i >> 3] &= (unsigned char)~(1 << (i & 7));
+    _node_own(t, id);
+    nd = &SLAB_NODES(sl)[i];
+    nd->id = 0;
+    nd->value = 0;
+    nd->children = 0;
+    nd->ext = 0;
+    nd->next = t->free_nodes;
+    t->free_nodes = id;
+    sl->free++;
+}
+
+trie_node_t *NODECREATE(trie_t* t, TRIE_CHAR key, TRIE_DATA value)
+{
+    trie_node_t *nd;
+    trie_weight_t *w;
+
+    nd = _trie_slot(t);
+    if (!nd) {
+        return NULL;
+    }
+    nd->key = key;
+    nd->value = value;
+    nd->count = 0;
+    nd->next = 0;
+    nd->children = 0;
+    nd->ext = 0;
+    w = _node_weight(t, nd);
+    if (w) {
+        w->weight = 0;
+        w->max_weight = TRIE_WEIGHT_NONE;
+    }
+
+    return nd;
+}
+
+// Returns the trie_ext_t of p, which is allocated if p does not have one. 
+// Returns NULL on allocation failure.
+trie_ext_t *_node_ext_make(trie_t *t, trie_node_t *p)
+{
+    trie_ext_t *e;
+    trie_slab_t *sl;
+    unsigned long i;
+    uint32_t id;
+
+    if (p->ext) {
+        return (trie_ext_t *)_node_at(t, p->ext);
+    }
+    e = (trie_ext_t *)_trie_slot(t);
+    if (!e) {
+        return NULL;
+    }
+    id = ((trie_node_t *)e)->id;
+    sl = t->slabs[id >> TRIE_SLAB_SHIFT];
+    i = id & TRIE_SLAB_MASK;
+    sl->ext[i >> 3] |= (unsigned char)(1 << (i & 7));
+    e->index = NULL;
+    e->tail = NULL;
+    TRIE_STORE_RELEASE(&p->ext, id);
+
+    return e;
+}
+
+// Replaces the index of p with ix. If p cannot hold an index, ix is freed: 
+// the children list is walked instead.
+void _node_set_index(trie_t *t, trie_node_t *p, trie_index_t *ix)
+{
+    trie_ext_t *e;
+
+    e = ix ? _node_ext_make(t, p) : _node_ext(t, p);
+    if (e) {
+        TRIE_STORE_RELEASE(&e->index, ix);
+    } else if (ix) {
+        INDEXFREE(t, ix);
+    }
+}
+
+// Same for the tail of p, returns 0 on allocation failure.
+int _node_set_tail(trie_t *t, trie_node_t *p, trie_tail_t *tl)
+{
+    trie_ext_t *e;
+
+    e = tl ? _node_ext_make(t, p) : _node_ext(t, p);
+    if (e) {
+        e->tail = tl;
+    }
+    return e || !tl;
+}
+
+void NODEFREE(trie_t* t, trie_node_t *nd)
+{
+    trie_ext_t *e;
+
+    e = _node_ext(t, nd);
+    if (e) {
+        if (e->index) {
+            INDEXFREE(t, e->index);
+        }
+        if (e->tail) {
+            TAILFREE(t, e->tail);
+        }
+        _trie_slot_free(t, nd->ext);
+    }
+    _trie_slot_free(t, nd->id);
+}
+
+void _limbo_free(trie_t *t, trie_limbo_kind_t kind, void *p)
+{
+    switch(kind)
+    {
+        case LIMBO_NODE:
+            NODEFREE(t, (trie_node_t *)p);
+            break;
+        case LIMBO_INDEX:
+            INDEXFREE(t, (trie_index_t *)p);
+            break;
+        default:
+            TRIEFREE(t, p);
+            break;
+    }
+}
+
+// Frees p, which is not reachable from the trie anymore, once the readers 
+// that might still be on it are done. (See Note 7) If there are no readers, 
+// p is freed right away. If it cannot be recorded, it is leaked rather than 
+// freed early.
+void _trie_retire(trie_t *t, trie_limbo_kind_t kind, void *p)
+{
+    trie_limbo_t *lb;
+    void **items;
+    unsigned long alloc;
+
+    TRIE_FENCE();
+    if (!TRIE_ATOMIC_LOAD(&t->readers[0]) && !TRIE_ATOMIC_LOAD(&t->readers[1])) {
+        _limbo_free(t, kind, p);
+        return;
+    }
+
+    lb = &t->limbo[t->epoch & 1];
+    if (lb->count == lb->alloc) {
+        alloc = lb->alloc ? lb->alloc * 2 : 16;
+        items = (void **)TRIEMALLOC(t, alloc * (sizeof(void *) + 1));
+        if (!items) {
+            return;
+        }
+        if (lb->items) {
+            memcpy(items, lb->items, lb->count * sizeof(void *));
+            memcpy(&items[alloc], lb->kinds, lb->count);
+            TRIEFREE(t, lb->items);
+        }
+        lb->items = items;
+        lb->kinds = (unsigned char *)&items[alloc];
+        lb->alloc = alloc;
+    }
+    lb->items[lb->count] = p;
+    lb->kinds[lb->count] = (unsigned char)kind;
+    lb->count++;
+}
+
+// Called by the writer before every change. Once the readers of the previous
+// epoch are done, what is retired in it is freed and the epoch advances. 
+void _trie_reclaim(trie_t *t)
+{
+    trie_limbo_t *lb;
+    unsigned long i, e;
+
+    if (!t->limbo[0].count && !t->limbo[1].count) {
+        return;
+    }
+
+    e = t->epoch;
+    TRIE_FENCE();
+    if (TRIE_ATOMIC_LOAD(&t->readers[(e+1) & 1])) {
+        return;
+    }
+    lb = &t->limbo[(e+1) & 1];
+    for (i=0;i<lb->count;i++) {
+        _limbo_free(t, (trie_limbo_kind_t)lb->kinds[i], lb->items[i]);
+    }
+    lb->count = 0;
+    TRIE_ATOMIC_ADD(&t->epoch, 1);
+}
+
+// A reader that does not exclude the writer enters the current epoch, so 
+// that nothing it may reach is freed until it calls trie_read_end(). The epoch
+// is read again as the writer might have advanced it before the reader is 
+// counted.
+unsigned long trie_read_begin(trie_t *t)
+{
+    unsigned long e;
+
+    while(1) {
+        e = TRIE_ATOMIC_LOAD(&t->epoch);
+        TRIE_ATOMIC_ADD(&t->readers[e & 1], 1);
+        if (TRIE_ATOMIC_LOAD(&t->epoch) == e) {
+            return e;
+        }
+        TRIE_ATOMIC_SUB(&t->readers[e & 1], 1);
+    }
+}
+
+void trie_read_end(trie_t *t, unsigned long epoch)
+{
+    TRIE_ATOMIC_SUB(&t->readers[epoch & 1], 1);
+}
+
+// An index is changed in place between these, readers check seq to see if it
+// has changed while they were reading. (See Note 7)
+void _index_write_begin(trie_index_t *ix)
+{
+    ix->seq++;
+    TRIE_FENCE_RELEASE();
+}
+
+void _index_write_end(trie_index_t *ix)
+{
+    TRIE_STORE_RELEASE(&ix->seq, ix->seq + 1);
+}
+
+// returns the position of ch in the sorted wide array or the position that ch 
+// shall be inserted.
+unsigned int _index_wide_pos(trie_index_t *ix, TRIE_CHAR ch)
+{
+    unsigned int lo, hi, mid;
+
+    lo = 0;
+    hi = ix->wcount;
+    while(lo < hi) {
+        mid = (lo + hi) / 2;
+        if (ix->wkeys[mid] < ch) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int _index_wide_put(trie_t *t, trie_index_t *ix, trie_node_t *nd)
+{
+    unsigned int pos, walloc;
+    trie_node_t **wnodes;
+    TRIE_CHAR *wkeys;
+
+    if (ix->wcount == ix->walloc) {
+        walloc = ix->walloc ? ix->walloc * 2 : 4;
+        // keys and nodes share a single block, nodes first for alignment.
+        wnodes = (trie_node_t **)TRIEMALLOC(t, walloc * (sizeof(trie_node_t *) + 
+            sizeof(TRIE_CHAR)));
+        if (!wnodes) {
+            return 0;
+        }
+        wkeys = (TRIE_CHAR *)&wnodes[walloc];
+        if (ix->wnodes) {
+            memcpy(wnodes, ix->wnodes, ix->wcount * sizeof(trie_node_t *));
+            memcpy(wkeys, ix->wkeys, ix->wcount * sizeof(TRIE_CHAR));
+            _trie_retire(t, LIMBO_BLOCK, ix->wnodes);
+        }
+        ix->wnodes = wnodes;
+        ix->wkeys = wkeys;
+        ix->walloc = walloc;
+    }
+
+    pos = _index_wide_pos(ix, nd->key);
+    memmove(&ix->wnodes[pos+1], &ix->wnodes[pos], 
+        (ix->wcount-pos) * sizeof(trie_node_t *));
+    memmove(&ix->wkeys[pos+1], &ix->wkeys[pos], 
+        (ix->wcount-pos) * sizeof(TRIE_CHAR));
+    ix->wnodes[pos] = nd;
+    ix->wkeys[pos] = nd->key;
+    ix->wcount++;
+
+    return 1;
+}
+
+// Adds nd to the index. Caller makes sure that there is room for it. Returns 
+// 0 on allocation failure.
+int _index_put(trie_t *t, trie_index_t *ix, trie_node_t *nd)
+{
+    trie_index16_t *ix16;
+    trie_index48_t *ix48;
+    unsigned int i;
+
+    _index_write_begin(ix);
+    if (ix->type == NODE16) {
+        ix16 = (trie_index16_t *)ix;
+        ix16->keys[ix->count] = nd->key;
+        ix16->nodes[ix->count] = nd;
+    } else if (nd->key > 0xFF) {
+        if (!_index_wide_put(t, ix, nd)) {
+            _index_write_end(ix);
+            return 0;
+        }
+    } else if (ix->type == NODE48) {
+        ix48 = (trie_index48_t *)ix;
+        for (i=0;ix48->nodes[i];i++)
+            ;
+        ix48->nodes[i] = nd;
+        ix48->slots[nd->key] = i+1;
+    } else {
+        ((trie_index256_t *)ix)->nodes[nd->key] = nd;
+    }
+    ix->count++;
+    _index_write_end(ix);
+
+    return 1;
+}
+
+trie_node_t *_index_child(trie_index_t *ix, TRIE_CHAR ch)
+{
+    trie_index16_t *ix16;
+    trie_index48_t *ix48;
+    unsigned int i;
+#ifdef TRIE_USE_SSE2
+    __m128i k;
+    int mask;
+#endif
+
+    if (ix->type == NODE16) {
+        ix16 = (trie_index16_t *)ix;
+#ifdef TRIE_USE_SSE2
+        k = _mm_set1_epi32((int)ch);
+        mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(k, 
+                _mm_loadu_si128((__m128i *)&ix16->keys[0]))))
+            | _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(k, 
+                _mm_loadu_si128((__m128i *)&ix16->keys[4])))) << 4
+            | _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(k, 
+                _mm_loadu_si128((__m128i *)&ix16->keys[8])))) << 8
+            | _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(k, 
+                _mm_loadu_si128((__m128i *)&ix16->keys[12])))) << 12;
+        mask &= (1 << ix->count) - 1;
+        if (!mask) {
+            return NULL;
+        }
+        for (i=0;!(mask & 1);i++) {
+            mask >>= 1;
+        }
+        return ix16->nodes[i];
+#else
+        for (i=0;i<ix->count;i++) {
+            if (ix16->keys[i] == ch) {
+                return ix16->nodes[i];
+            }
+        }
+        return NULL;
+#endif
+    }
+
+    if (ch > 0xFF) {
+        i = _index_wide_pos(ix, ch);
+        if (i < ix->wcount && ix->wkeys[i] == ch) {
+            return ix->wnodes[i];
+        }
+        return NULL;
+    }
+
+    if (ix->type == NODE48) {
+        ix48 = (trie_index48_t *)ix;
+        i = ix48->slots[ch];
+        return i ? ix48->nodes[i-1] : NULL;
+    }
+
+    return ((trie_index256_t *)ix)->nodes[ch];
+}
+
+// returns the child in ix with the largest key less than ch. (writers only)
+trie_node_t *_index_prev(trie_index_t *ix, TRIE_CHAR ch)
+{
+    trie_index16_t *ix16;
+    trie_node_t *prev;
+    unsigned int i;
+
+    if (ix->type == NODE16) {
+        ix16 = (trie_index16_t *)ix;
+        prev = NULL;
+        for (i=0;i<ix->count;i++) {
+            if (ix16->keys[i] < ch && (!prev || ix16->keys[i] > prev->key)) {
+                prev = ix16->nodes[i];
+            }
+        }
+        return prev;
+    }
+
+    if (ch > 0xFF) {
+        i = _index_wide_pos(ix, ch);
+        if (i > 0) {
+            return ix->wnodes[i-1];
+        }
+        ch = 0x100;
+    }
+    for (i=ch;i-- > 0;) {
+        prev = _index_child(ix, i);
+        if (prev) {
+            return prev;
+        }
+    }
+    return NULL;
+}
+
+void _index_remove(trie_index_t *ix, TRIE_CHAR ch)
+{
+    trie_index16_t *ix16;
+    trie_index48_t *ix48;
+    unsigned int i;
+
+    _index_write_begin(ix);
+    if (ix->type == NODE16) {
+        ix16 = (trie_index16_t *)ix;
+        for (i=0;ix16->keys[i] != ch;i++)
+            ;
+        // order does not matter, move the last one here.
+        ix16->keys[i] = ix16->keys[ix->count-1];
+        ix16->nodes[i] = ix16->nodes[ix->count-1];
+    } else if (ch > 0xFF) {
+        i = _index_wide_pos(ix, ch);
+        memmove(&ix->wnodes[i], &ix->wnodes[i+1], 
+            (ix->wcount-i-1) * sizeof(trie_node_t *));
+        memmove(&ix->wkeys[i], &ix->wkeys[i+1], 
+            (ix->wcount-i-1) * sizeof(TRIE_CHAR));
+        ix->wcount--;
+    } else if (ix->type == NODE48) {
+        ix48 = (trie_index48_t *)ix;
+        ix48->nodes[ix48->slots[ch]-1] = NULL;
+        ix48->slots[ch] = 0;
+    } else {
+        ((trie_index256_t *)ix)->nodes[ch] = NULL;
+    }
+    ix->count--;
+    _index_write_end(ix);
+}
+
+// Builds the index of p from its children list. Returns NULL if p has only a 
+// few children or the index cannot be allocated. (in which case we simply 
+// walk the list)
+trie_index_t *_index_from_list(trie_t *t, trie_node_t *p)
+{
+    trie_index_t *ix;
+    trie_node_t *c;
+    unsigned long count, narrow;
+    trie_index_type_t type;
+
+    count = narrow = 0;
+    for (c=_node_children(t, p);c;c=_node_next(t, c)) {
+        count++;
+        if (c->key <= 0xFF) {
+            narrow++;
+        }
+    }
+    if (count < TRIE_INDEX_MIN) {
+        return NULL;
+    }
+
+    type = NODE16;
+    if (count > 16) {
+        type = narrow > 48 ? NODE256 : NODE48;
+    }
+    ix = INDEXCREATE(t, type);
+    if (!ix) {
+        return NULL;
+    }
+    for (c=_node_children(t, p);c;c=_node_next(t, c)) {
+        if (!_index_put(t, ix, c)) {
+            INDEXFREE(t, ix);
+            return NULL;
+        }
+    }
+
+    return ix;
+}
+
+// Called after child is linked to p's children list. An index is never left 
+// in an incomplete state: we drop it if it cannot be updated. A replaced index
+// is retired, readers might still be on it. (See Note 7)
+void _trie_index_add(trie_t *t, trie_node_t *p, trie_node_t *child)
+{
+    trie_index_t *ix;
+    trie_node_t *c;
+    unsigned long count;
+
+    ix = _node_index(t, p);
+    if (ix) {
+        if ((ix->type == NODE16 && ix->count < 16) || 
+            (ix->type == NODE48 && (child->key > 0xFF || 
+                ix->count - ix->wcount < 48)) || (ix->type == NODE256)) {
+            if (_index_put(t, ix, child)) {
+                return;
+            }
+        }
+        // need a bigger index (or out of memory)
+    } else {
+        // most nodes never get an index, do not build one for every link.
+        count = 0;
+        for (c=_node_children(t, p);c && count < TRIE_INDEX_MIN;
+            c=_node_next(t, c)) {
+            count++;
+        }
+        if (count < TRIE_INDEX_MIN) {
+            return;
+        }
+    }
+
+    _node_set_index(t, p, _index_from_list(t, p));
+    if (ix) {
+        _trie_retire(t, LIMBO_INDEX, ix);
+    }
+}
+
+// Called when child is unlinked from p. Smaller indexes are built from the 
+// current index.
+void _trie_index_del(trie_t *t, trie_node_t *p, trie_node_t *child)
+{
+    trie_index_t *ix, *nix;
+    unsigned int i;
+
+    ix = _node_index(t, p);
+    if (!ix) {
+        return;
+    }
+    _index_remove(ix, child->key);
+
+    nix = NULL;
+    if (ix->type == NODE16) {
+        if (ix->count >= TRIE_INDEX_MIN-1) {
+            return;
+        }
+    } else if (ix->count <= TRIE_INDEX16_SHRINK || (ix->type == NODE256 && 
+        ix->count - ix->wcount <= TRIE_INDEX48_SHRINK)) {
+        // NODE48/NODE256
+        nix = INDEXCREATE(t, ix->count <= TRIE_INDEX16_SHRINK ? NODE16 : NODE48);
+        if (!nix) {
+            return; // keep the bigger one
+        }
+        for (i=0;i<ix->wcount;i++) {
+            if (!_index_put(t, nix, ix->wnodes[i])) {
+                INDEXFREE(t, nix);
+                return;
+            }
+        }
+        for (i=0;i<=0xFF;i++) {
+            child = _index_child(ix, i);
+            if (child) {
+                _index_put(t, nix, child);
+            }
+        }
+    } else {
+        return;
+    }
+
+    _node_set_index(t, p, nix);
+    _trie_retire(t, LIMBO_INDEX, ix);
+}
+
+// returns the child of p whose key is ch. Children are sorted, so the walk 
+// stops at the first bigger key.
+trie_node_t *_trie_child(trie_t *t, trie_node_t *p, TRIE_CHAR ch)
+{
+    trie_node_t *curr;
+    trie_index_t *ix;
+    unsigned int seq;
+
+    ix = _node_index(t, p);
+    if (ix) {
+        TRIE_COUNTER_INC(index_lookups);
+        seq = TRIE_LOAD_ACQUIRE(&ix->seq);
+        curr = _index_child(ix, ch);
+        TRIE_FENCE_ACQUIRE();
+        if (!(seq & 1) && TRIE_ATOMIC_LOAD(&ix->seq) == seq) {
+            return curr;
+        }
+        // a writer has changed the index meanwhile. (See Note 7)
+    }
+
+    curr = _node_children(t, p);
+    while(curr && curr->key < ch) {
+        TRIE_COUNTER_INC(sibling_hops);
+        curr = _node_next(t, curr);
+    }
+    return (curr && curr->key == ch) ? curr : NULL;
+}
+
+// Links child to p. Children lists are kept sorted by key, which is what the
+// ordered queries (first, successor...) rely on. The new node is published by 
+// a single release store. (See Note 7)
+void _trie_link(trie_t *t, trie_node_t *p, trie_node_t *child)
+{
+    trie_node_t *prev, *curr;
+    trie_index_t *ix;
+
+    ix = _node_index(t, p);
+    if (ix) {
+        prev = _index_prev(ix, child->key);
+    } else {
+        prev = NULL;
+        for (curr=_node_children(t, p);curr && curr->key < child->key;
+            curr=_node_next(t, curr)) {
+            prev = curr;
+        }
+    }
+    if (prev) {
+        child->next = prev->next;
+        TRIE_STORE_RELEASE(&prev->next, child->id);
+    } else {
+        child->next = p->children;
+        TRIE_STORE_RELEASE(&p->children, child->id);
+    }
+    _trie_index_add(t, p, child);
+}
+
+// The automaton is only valid for the keys it is compiled with. (See Note 8)
+void _trie_ac_drop(trie_t *t)
+{
+    if (t->ac) {
+        TRIEFREE(t, t->ac->states);
+        TRIEFREE(t, t->ac);
+        t->ac = NULL;
+    }
+}
+
+// Replaces the shared children of p with copies. (See Note 9) The copies are
+// published by a single store, readers on the shared ones are not affected.
+// Returns 0 on allocation failure, p is not changed then.
+int _trie_copy_children(trie_t *t, trie_node_t *p)
+{
+    trie_node_t *c, *nd;
+    trie_tail_t *tl, *ctl;
+    trie_index_t *ix;
+    uint32_t head, *link;
+
+    head = 0;
+    link = &head;
+    for (c=_node_children(t, p);c;c=_node_next(t, c)) {
+        nd = NODECREATE(t, c->key, c->value);
+        if (!nd) {
+            goto fail;
+        }
+        *link = nd->id;
+        link = &nd->next;
+        ctl = _node_tail(t, c);
+        if (ctl) {
+            tl = TAILCREATE(t, ctl->size);
+            if (!tl) {
+                goto fail;
+            }
+            memcpy(tl->s, ctl->s, ctl->size*sizeof(TRIE_CHAR));
+            if (!_node_set_tail(t, nd, tl)) {
+                TAILFREE(t, tl);
+                goto fail;
+            }
+        }
+        nd->count = c->count;
+        _node_copy_weight(t, nd, c);
+        nd->children = c->children;
+        // no index only costs lookups.
+        _node_set_index(t, nd, _index_from_list(t, nd));
+    }
+
+    if (t->value_ref) {
+        for (nd=_node_at(t, head);nd;nd=_node_next(t, nd)) {
+            if (nd->value) {
+                t->value_ref(nd->value);
+            }
+        }
+    }
+    TRIE_STORE_RELEASE(&p->children, head);
+    ix = _node_index(t, p);
+    _node_set_index(t, p, _index_from_list(t, p));
+    if (ix) {
+        _trie_retire(t, LIMBO_INDEX, ix);
+    }
+    // the automaton points to the shared nodes.
+    _trie_ac_drop(t);
+    return 1;
+
+fail:
+    while(head) {
+        nd = _node_at(t, head);
+        head = nd->next;
+        NODEFREE(t, nd);
+    }
+    return 0;
+}
+
+// Marks the nodes that t reaches as its own.
+void _thaw_mark(trie_t *t, trie_node_t *p)
+{
+    trie_node_t *c;
+
+    _node_own(t, p->id);
+    for (c=_node_children(t, p);c;c=_node_next(t, c)) {
+        _thaw_mark(t, c);
+    }
+}
+
+// Called when the last snapshot of t is destroyed. (See Note 9) The shared 
+// nodes that t does not reach anymore are only reached by the snapshots, they
+// are retired as readers of t might still be on them. Their values are 
+// released by cbk. The trie_ext_t of a node is freed with the node, and the 
+// reserved node 0 is never handed out, so those are skipped.
+void _trie_thaw(trie_t *t, trie_value_free_cbk_t cbk)
+{
+    trie_slab_t *sl;
+    trie_node_t *nd;
+    unsigned long i, k;
+    int retired;
+
+    _thaw_mark(t, t->root);
+    retired = 0;
+    for (k=0;k<t->slab_count;k++) {
+        sl = t->slabs[k];
+        if (!sl || !sl->own) {
+            continue;
+        }
+        for (i=k ? 0 : 1;i<sl->used;i++) {
+            if ((sl->own[i >> 3] | sl->ext[i >> 3]) & (1 << (i & 7))) {
+                continue;
+            }
+            nd = &SLAB_NODES(sl)[i];
+            if (nd->value && cbk) {
+                cbk(nd->value);
+            }
+            nd->value = 0;
+            _trie_retire(t, LIMBO_NODE, nd);
+            retired = 1;
+        }
+    }
+    for (k=0;k<t->slab_count;k++) {
+        sl = t->slabs[k];
+        if (sl && sl->own) {
+            TRIEFREE(t, sl->own);
+            sl->own = NULL;
+        }
+    }
+    t->shared_count = 0;
+    // iterators of t might be on the retired nodes.
+    if (retired) {
+        t->version++;
+    }
+}
+
+trie_t *trie_create(unsigned int flags)
+{
+    trie_t *t;
+    trie_node_t *nd;
+
+    t = (trie_t *)TRIEMALLOC(NULL, sizeof(trie_t));
+    if (!t) {
+        return NULL;
+    }
+
+    t->mem_usage = sizeof(trie_t);
+    t->flags = flags;
+    t->slabs = NULL;
+    t->slab_count = 0;
+    t->slab_alloc = 0;
+    t->slab_cur = 0;
+    t->slab_released = 0;
+    t->free_nodes = 0;
+    t->epoch = 0;
+    memset(t->readers, 0, sizeof(t->readers));
+    memset(t->limbo, 0, sizeof(t->limbo));
+    t->ac = NULL;
+    t->shared_count = 0;
+    t->snapshots = 0;
+    t->origin = NULL;
+    t->value_ref = NULL;
+    t->root = NULL;
+    // node 0 is never handed out, as id 0 is NULL. (See Note 11)
+    nd = _trie_slot(t);
+    if (nd) {
+        memset(nd, 0, sizeof(trie_node_t));
+        t->root = NODECREATE(t, (TRIE_CHAR)0, (TRIE_DATA)0); // root is a dummy node
+    }
+    if (!t->root) {
+        if (t->slab_count) {
+            SLABFREE(t, t->slabs[0]);
+        }
+        if (t->slabs) {
+            TRIEFREE(t, &t->slabs[-1]);
+        }
+        TRIEFREE(t, t);
+        return NULL;
+    }
+    t->node_count = 1;
+    t->item_count = 0;
+    t->height = 1;
+    t->version = 0;
+
+    return t;
+}
+
+// Frees sl along with the values, indexes and tails of its nodes. (freed 
+// nodes do not have them, _trie_slot_free clears them)
+void _slab_free(trie_t *t, trie_slab_t *sl, trie_value_free_cbk_t cbk)
+{
+    trie_node_t *nd;
+    trie_ext_t *e;
+    unsigned long i;
+
+    for (i=0;i<sl->used;i++) {
+        nd = &SLAB_NODES(sl)[i];
+        if (sl->ext[i >> 3] & (1 << (i & 7))) {
+            e = (trie_ext_t *)nd;
+            if (e->index) {
+                INDEXFREE(t, e->index);
+            }
+            if (e->tail) {
+                TAILFREE(t, e->tail);
+            }
+        } else if (nd->value && cbk) {
+            cbk(nd->value);
+        }
+    }
+    SLABFREE(t, sl);
+}
+
+// Frees the slab arrays of t, along with the ones they replaced. (See 
+// _trie_slab_entry)
+void _trie_slabs_free(trie_t *t)
+{
+    trie_slab_t **slabs, **prev;
+
+    slabs = t->slabs;
+    while(slabs) {
+        prev = (trie_slab_t **)(void *)slabs[-1];
+        TRIEFREE(t, &slabs[-1]);
+        slabs = prev;
+    }
+    t->slabs = NULL;
+}
+
+// cbk, if not NULL, is called once for every value stored in the trie. A 
+// snapshot holds no values itself, destroying the last snapshot of a trie 
+// releases the values that only the snapshots held. (See Note 9) A trie is 
+// destroyed after its snapshots.
+void trie_destroy(trie_t *t, trie_value_free_cbk_t cbk)
+{
+    unsigned long i, j;
+
+    if (t->origin) {
+        t->origin->snapshots--;
+        if (!t->origin->snapshots) {
+            _trie_thaw(t->origin, cbk);
+        }
+        _trie_ac_drop(t);
+        TRIEFREE(NULL, t);
+        return;
+    }
+    assert(!t->snapshots);
+
+    // nodes live in slabs, so there is no need to walk the trie here. Only 
+    // values, indexes and tails are held separately. Every copy of a shared 
+    // node holds its own. (See Note 9)
+    for (i=0;i<t->slab_count;i++) {
+        if (t->slabs[i]) {
+            _slab_free(t, t->slabs[i], cbk);
+        }
+    }
+    _trie_slabs_free(t);
+    // retired nodes live in slabs, everything else is freed here.
+    for (j=0;j<2;j++) {
+        for (i=0;i<t->limbo[j].count;i++) {
+            if (t->limbo[j].kinds[i] != LIMBO_NODE) {
+                _limbo_free(t, (trie_limbo_kind_t)t->limbo[j].kinds[i], 
+                    t->limbo[j].items[i]);
+            }
+        }
+        if (t->limbo[j].items) {
+            TRIEFREE(t, t->limbo[j].items);
+        }
+    }
+    _trie_ac_drop(t);
+    TRIEFREE(t, t);
+}
+
+// Returns the max. count of the values trie_destroy(t, cbk) passes to cbk, so
+// that a caller can allocate for them before it calls trie_destroy(). Only the
+// last snapshot of a trie releases values, the ones of the shared nodes.
+unsigned long trie_destroy_values_max(trie_t *t)
+{
+    unsigned long k, n;
+    int shared;
+
+    shared = 0;
+    if (t->origin) {
+        if (t->origin->snapshots > 1) {
+            return 0;
+        }
+        t = t->origin;
+        shared = 1;
+    }
+    // _trie_thaw() only visits the slabs with an own bitmap.
+    n = 0;
+    for (k=0;k<t->slab_count;k++) {
+        if (t->slabs[k] && (!shared || t->slabs[k]->own)) {
+            n += t->slabs[k]->used;
+        }
+    }
+    return n;
+}
+
+unsigned long trie_mem_usage(trie_t *t)
+{
+    return t->mem_usage;
+}
+
+// Adds one to h[i], growing h as needed. Returns 0 on allocation failure.
+int _stats_hist_add(unsigned long **h, unsigned long *size, unsigned long i)
+{
+    unsigned long *nh, n;
+
+    if (i >= *size) {
+        n = *size ? *size : 16;
+        while(n <= i) {
+            n *= 2;
+        }
+        nh = (unsigned long *)TRIEMALLOC(NULL, n * sizeof(unsigned long));
+        if (!nh) {
+            return 0;
+        }
+        memset(nh, 0, n * sizeof(unsigned long));
+        if (*h) {
+            memcpy(nh, *h, *size * sizeof(unsigned long));
+            TRIEFREE(NULL, *h);
+        }
+        *h = nh;
+        *size = n;
+    }
+    (*h)[i]++;
+    return 1;
+}
+
+int _stats(trie_t *t, trie_stats_t *st, trie_node_t *p, unsigned long depth)
+{
+    trie_node_t *c;
+    trie_index_t *ix;
+    trie_tail_t *tl;
+    unsigned long n;
+
+    st->nodes++;
+    if (p->value) {
+        st->terminal++;
+    }
+    tl = _node_tail(t, p);
+    if (tl) {
+        st->tails++;
+        st->tail_chars += tl->size;
+        st->blocks++;
+    }
+    ix = _node_index(t, p);
+    if (ix) {
+        st->indexes[ix->type - NODE16]++;
+        st->blocks += ix->wnodes ? 2 : 1;
+    }
+    if (!_stats_hist_add(&st->depth, &st->depth_size, depth)) {
+        return 0;
+    }
+
+    n = 0;
+    for (c=_node_children(t, p);c;c=_node_next(t, c)) {
+        if (!_stats(t, st, c, depth+1)) {
+            return 0;
+        }
+        n++;
+    }
+    return _stats_hist_add(&st->fanout, &st->fanout_size, n);
+}
+
+// Walks the whole trie, so it is not for the hot path. Returns 0 on 
+// allocation failure.
+int trie_stats(trie_t *t, trie_stats_t *st)
+{
+    trie_node_t *nd;
+    unsigned long i;
+
+    memset(st, 0, sizeof(trie_stats_t));
+    if (!_stats(t, st, t->root, 0)) {
+        trie_stats_free(st);
+        return 0;
+    }
+    // only the used part of the histograms is reported.
+    while(st->fanout_size && !st->fanout[st->fanout_size-1]) {
+        st->fanout_size--;
+    }
+    while(st->depth_size && !st->depth[st->depth_size-1]) {
+        st->depth_size--;
+    }
+
+    for (i=0;i<t->slab_count;i++) {
+        if (t->slabs[i]) {
+            st->slabs++;
+            st->slab_nodes += t->slabs[i]->size;
+        }
+    }
+    for (nd=_node_at(t, t->free_nodes);nd;nd=_node_at(t, nd->next)) {
+        st->free_nodes++;
+    }
+    st->retired = t->limbo[0].count + t->limbo[1].count;
+    // every slab is a block for its nodes, and another for their weights if 
+    // t is weighted.
+    st->blocks += st->slabs * ((t->flags & TRIE_WEIGHTED) ? 2 : 1);
+    // a snapshot has no slabs, its nodes are in the slabs of its origin. The
+    // trie_ext_t of the nodes are counted as unused slab nodes.
+    st->overhead = st->blocks * sizeof(unsigned long);
+    if (st->slab_nodes > st->nodes) {
+        st->overhead += (st->slab_nodes - st->nodes) * sizeof(trie_node_t);
+    }
+    st->ac_states = t->ac ? t->ac->count : 0;
+
+    return 1;
+}
+
+void trie_stats_free(trie_stats_t *st)
+{
+    if (st->fanout) {
+        TRIEFREE(NULL, st->fanout);
+    }
+    if (st->depth) {
+        TRIEFREE(NULL, st->depth);
+    }
+    st->fanout = st->depth = NULL;
+    st->fanout_size = st->depth_size = 0;
+}
+
+// Makes sure that the next node_count nodes are allocated from slabs that 
+// are made here at once, instead of slabs growing one after another.
+int trie_reserve(trie_t *t, unsigned long node_count)
+{
+    trie_slab_t *sl;
+    unsigned long i, room, size;
+
+    if (node_count <= TRIE_SLAB_MIN_SIZE) {
+        return 1;
+    }
+    room = 0;
+    for (i=0;i<t->slab_count;i++) {
+        sl = t->slabs[i];
+        if (sl) {
+            room += sl->size - sl->used;
+        }
+    }
+    while(room < node_count) {
+        // a multiple of 8 nodes, for the ext and own bitmaps.
+        size = (node_count - room + 7) & ~7UL;
+        if (size > TRIE_SLAB_MAX_SIZE) {
+            size = TRIE_SLAB_MAX_SIZE;
+        }
+        if (_trie_slab_add(t, size) == TRIE_SLAB_COUNT_MAX) {
+            return 0;
+        }
+        room += size;
+    }
+
+    return 1;
+}
+
+// Renumbers the ids of p and its subtree by map, which maps the slab indexes
+// of t to the ones they get in the trie t is attached to.
+void _trie_remap(trie_t *t, unsigned long *map, trie_node_t *p)
+{
+    trie_node_t *c, *next;
+
+#define REMAP(id) ((id) ? (uint32_t)(map[(id) >> TRIE_SLAB_SHIFT] << \
+    TRIE_SLAB_SHIFT | ((id) & TRIE_SLAB_MASK)) : 0)
+    c = _node_children(t, p);
+    p->id = REMAP(p->id);
+    p->next = REMAP(p->next);
+    p->children = REMAP(p->children);
+    p->ext = REMAP(p->ext);
+    while(c) {
+        next = _node_next(t, c);
+        _trie_remap(t, map, c);
+        c = next;
+    }
+}
+
+// Moves all keys of src to t and destroys src. Children of src's root are 
+// linked to t's root as they are, so no key in t may start with the first 
+// char of a key in src, and src may not hold the empty key. Returns 0 without
+// changing the keys of t if that is not the case. Slabs, indexes and tails of
+// src are owned by t afterwards, the slabs get new indexes in t->slabs so the
+// ids of src's nodes are renumbered. This is how tries built separately (e.g:
+// in parallel, partitioned by the first char) are joined. Snapshots and tries
+// with snapshots cannot be attached. (See Note 9)
+int trie_attach(trie_t *t, trie_t *src)
+{
+    trie_slab_t *sl;
+    trie_node_t *nd, *next;
+    trie_weight_t *w;
+    unsigned long i, j, *map;
+    uint32_t id;
+
+    if (((t->flags ^ src->flags) & ~TRIE_WEIGHTED) || src->root->value || 
+        t->origin || src->origin || src->snapshots || src->shared_count) {
+        return 0;
+    }
+    for (nd=_node_children(src, src->root);nd;nd=_node_next(src, nd)) {
+        if (_trie_child(t, t->root, nd->key)) {
+            return 0;
+        }
+    }
+    if (t->root->children && _node_shared(t, _node_children(t, t->root)) && 
+        !_trie_copy_children(t, t->root)) {
+        return 0;
+    }
+    // either both are weighted or neither.
+    if ((t->flags | src->flags) & TRIE_WEIGHTED) {
+        if (!_trie_weigh(t) || !_trie_weigh(src)) {
+            return 0;
+        }
+    }
+
+    map = (unsigned long *)TRIEMALLOC(NULL, src->slab_count * 
+        sizeof(unsigned long));
+    if (!map) {
+        return 0;
+    }
+    for (i=0;i<src->slab_count;i++) {
+        if (!src->slabs[i]) {
+            continue;
+        }
+        map[i] = _trie_slab_entry(t);
+        if (map[i] == TRIE_SLAB_COUNT_MAX) {
+            // the entries taken so far are left as released ones.
+            while(i-- > 0) {
+                if (src->slabs[i]) {
+                    t->slabs[map[i]] = NULL;
+                    t->slab_released++;
+                }
+            }
+            TRIEFREE(NULL, map);
+            return 0;
+        }
+        // the ids of t do not reach it yet.
+        t->slabs[map[i]] = src->slabs[i];
+    }
+
+    // src has no readers, so what it has retired is freed now, before its 
+    // memory and free nodes are handed over to t. Unused nodes of its slabs
+    // are not wasted, they are freed too.
+    for (j=0;j<2;j++) {
+        for (i=0;i<src->limbo[j].count;i++) {
+            _limbo_free(src, (trie_limbo_kind_t)src->limbo[j].kinds[i], 
+                src->limbo[j].items[i]);
+        }
+        if (src->limbo[j].items) {
+            TRIEFREE(src, src->limbo[j].items);
+        }
+    }
+    for (i=0;i<src->slab_count;i++) {
+        sl = src->slabs[i];
+        while(sl && sl->used < sl->size) {
+            sl->used++;
+            _trie_slot_free(src, (uint32_t)(i << TRIE_SLAB_SHIFT | 
+                (sl->used - 1)));
+        }
+    }
+
+    _trie_remap(src, map, src->root);
+    for (id=src->free_nodes;id;) {
+        nd = _node_at(src, id);
+        id = nd->next;
+        nd->next = REMAP(nd->next);
+    }
+    src->free_nodes = REMAP(src->free_nodes);
+    // node 0 of src is not reserved in t.
+    _trie_slot_free(t, (uint32_t)(map[0] << TRIE_SLAB_SHIFT));
+#undef REMAP
+    TRIEFREE(NULL, map);
+    _trie_slabs_free(src);
+    t->mem_usage += src->mem_usage - sizeof(trie_t);
+
+    nd = _node_children(t, src->root);
+    while(nd) {
+        next = _node_next(t, nd);
+        _trie_link(t, t->root, nd);
+        nd = next;
+    }
+    w = _node_weight(t, t->root);
+    if (w && _node_weight(t, src->root)->max_weight > w->max_weight) {
+        w->max_weight = _node_weight(t, src->root)->max_weight;
+    }
+    t->root->count += src->root->count;
+    src->root->children = 0;
+    NODEFREE(t, src->root);
+
+    if (src->free_nodes) {
+        for (nd=_node_at(t, src->free_nodes);nd->next;nd=_node_at(t, nd->next))
+            ;
+        nd->next = t->free_nodes;
+        t->free_nodes = src->free_nodes;
+    }
+
+    t->node_count += src->node_count - 1;
+    t->item_count += src->item_count;
+    if (src->height > t->height) {
+        t->height = src->height;
+    }
+    t->version++;
+    _trie_ac_drop(t);
+    _trie_ac_drop(src);
+    TRIEFREE(NULL, src);
+
+    return 1;
+}
+
+// Returns a snapshot of t, NULL on allocation failure. (See Note 9) ref is 
+// called for the value of a node whenever the node is copied. A snapshot is
+// destroyed by trie_destroy() before t, and builders of t shall be reset 
+// after a snapshot is taken.
+trie_t *trie_snapshot(trie_t *t, trie_value_ref_cbk_t ref)
+{
+    trie_t *s;
+    trie_slab_t *sl;
+    trie_node_t *root;
+    trie_limbo_t *lb;
+    unsigned long i, k;
+    uint32_t id;
+
+    s = (trie_t *)TRIEMALLOC(NULL, sizeof(trie_t));
+    if (!s) {
+        return NULL;
+    }
+    memset(s, 0, sizeof(trie_t));
+    s->mem_usage = sizeof(trie_t);
+    s->flags = t->flags;
+    s->root = t->root;
+    s->node_count = t->node_count;
+    s->item_count = t->item_count;
+    s->height = t->height;
+    // the slabs are t's, the ones made later are never reached by s.
+    s->slabs = t->slabs;
+    // a snapshot of a snapshot shares the nodes that are shared already.
+    if (t->origin) {
+        s->origin = t->origin;
+        s->origin->snapshots++;
+        return s;
+    }
+    s->origin = t;
+
+    // slabs made after the last snapshot have no own bitmap, all their nodes
+    // are owned.
+    for (k=0;k<t->slab_count;k++) {
+        sl = t->slabs[k];
+        if (sl && !sl->own) {
+            sl->own = (unsigned char *)TRIEMALLOC(t, sl->size / 8);
+            if (!sl->own) {
+                if (!t->snapshots) {
+                    _trie_thaw(t, NULL);
+                }
+                TRIEFREE(NULL, s);
+                return NULL;
+            }
+            memset(sl->own, 0xFF, sl->size / 8);
+            t->shared_count++;
+        }
+    }
+    for (k=0;k<t->slab_count;k++) {
+        sl = t->slabs[k];
+        if (sl) {
+            memset(sl->own, 0, sl->size / 8);
+        }
+    }
+
+    // every used node is shared now, except the ones t has freed already.
+    for (id=t->free_nodes;id;id=_node_at(t, id)->next) {
+        _node_own(t, id);
+    }
+    for (k=0;k<2;k++) {
+        lb = &t->limbo[k];
+        for (i=0;i<lb->count;i++) {
+            if (lb->kinds[i] == LIMBO_NODE) {
+                _node_own(t, ((trie_node_t *)lb->items[i])->id);
+            }
+        }
+    }
+
+    root = NODECREATE(t, t->root->key, t->root->value);
+    if (!root) {
+        // the shared state is harmless, a node is only copied once more.
+        if (!t->snapshots) {
+            _trie_thaw(t, NULL);
+        }
+        TRIEFREE(NULL, s);
+        return NULL;
+    }
+    root->count = t->root->count;
+    _node_copy_weight(t, root, t->root);
+    root->children = t->root->children;
+    _node_set_index(t, root, _index_from_list(t, root));
+    if (root->value && ref) {
+        ref(root->value);
+    }
+
+    t->value_ref = ref;
+    t->snapshots++;
+    _trie_ac_drop(t);
+    TRIE_STORE_RELEASE(&t->root, root);
+
+    return s;
+}
+
+// Moves one char down from the position (p, *pending). Returns NULL if there 
+// is no such path. (See Note 5)
+trie_node_t *_trie_step(trie_t *t, trie_node_t *p, unsigned long *pending, 
+    TRIE_CHAR ch)
+{
+    trie_tail_t *tl;
+
+    TRIE_COUNTER_INC(steps);
+    if (*pending) {
+        tl = _node_tail(t, p);
+        if (tl->s[tl->size - *pending] != ch) {
+            return NULL;
+        }
+        (*pending)--;
+        return p;
+    }
+
+    p = _trie_child(t, p, ch);
+    if (p && p->ext) {
+        tl = _node_tail(t, p);
+        *pending = tl ? tl->size : 0;
+    }
+    return p;
+}
+
+// Writes the edge of p (key + tail) to key starting from index. Returns the 
+// index right after the edge.
+unsigned long _key_write_edge(trie_t *t, trie_key_t *key, unsigned long index, 
+    trie_node_t *p)
+{
+    trie_tail_t *tl;
+    unsigned long i;
+
+    KEY_CHAR_WRITE(key, index++, p->key);
+    tl = _node_tail(t, p);
+    if (tl) {
+        for (i=0;i<tl->size;i++) {
+            KEY_CHAR_WRITE(key, index++, tl->s[i]);
+        }
+    }
+    return index;
+}
+
+// Appends the last pending chars of p's tail to key.
+void _key_write_pending(trie_t *t, trie_key_t *key, trie_node_t *p, 
+    unsigned long pending)
+{
+    trie_tail_t *tl;
+    unsigned long i;
+
+    tl = _node_tail(t, p);
+    for (i=tl ? tl->size-pending : 0;pending > 0;i++,pending--) {
+        KEY_CHAR_WRITE(key, key->size, tl->s[i]);
+        key->size++;
+    }
+}
+
+// Splits the compressed edge of nd after the j'th char of its tail. nd keeps 
+// the chars before and its single new child gets the rest along with nd's 
+// value and children.
+int _trie_split(trie_t *t, trie_node_t *nd, unsigned long j)
+{
+    trie_node_t *c;
+    trie_tail_t *tl, *ctl;
+    trie_ext_t *e;
+
+    e = _node_ext(t, nd);
+    tl = e->tail;
+    c = NODECREATE(t, tl->s[j], nd->value);
+    if (!c) {
+        return 0;
+    }
+    ctl = NULL;
+    if (j+1 < tl->size) {
+        ctl = TAILCREATE(t, tl->size-j-1);
+        if (!ctl) {
+            NODEFREE(t, c);
+            return 0;
+        }
+        memcpy(ctl->s, &tl->s[j+1], ctl->size*sizeof(TRIE_CHAR));
+    }
+    if ((ctl || e->index) && !_node_ext_make(t, c)) {
+        if (ctl) {
+            TAILFREE(t, ctl);
+        }
+        NODEFREE(t, c);
+        return 0;
+    }
+    _node_set_tail(t, c, ctl);
+    _node_set_index(t, c, e->index);
+    c->children = nd->children;
+    _node_copy_weight(t, c, nd);
+    c->count = nd->count;
+
+    nd->children = c->id;
+    e->index = NULL;
+    nd->value = 0;
+    if (j) {
+        tl->size = j;
+    } else {
+        TAILFREE(t, tl);
+        e->tail = NULL;
+    }
+    t->node_count++;
+
+    return 1;
+}
+
+// Merges nd with its only child. Reverse of _trie_split().
+int _trie_merge(trie_t *t, trie_node_t *nd)
+{
+    trie_node_t *c;
+    trie_tail_t *tl, *ntl, *ctl;
+    trie_ext_t *e, *ce;
+    unsigned long i;
+
+    c = _node_children(t, nd);
+    ntl = _node_tail(t, nd);
+    ctl = _node_tail(t, c);
+    i = (ntl ? ntl->size : 0);
+    tl = TAILCREATE(t, i + 1 + (ctl ? ctl->size : 0));
+    if (!tl) {
+        return 0;
+    }
+    e = _node_ext_make(t, nd);
+    if (!e) {
+        TAILFREE(t, tl);
+        return 0;
+    }
+    if (ntl) {
+        memcpy(tl->s, ntl->s, i*sizeof(TRIE_CHAR));
+        TAILFREE(t, ntl);
+    }
+    tl->s[i] = c->key;
+    if (ctl) {
+        memcpy(&tl->s[i+1], ctl->s, ctl->size*sizeof(TRIE_CHAR));
+    }
+    e->tail = tl;
+    nd->value = c->value;
+    _node_copy_weight(t, nd, c);
+    nd->count = c->count;
+    nd->children = c->children;
+    if (e->index) {
+        INDEXFREE(t, e->index);
+    }
+    ce = _node_ext(t, c);
+    e->index = ce ? ce->index : NULL;
+
+    if (ce) {
+        ce->index = NULL;
+    }
+    NODEFREE(t, c);
+    t->node_count--;
+
+    return 1;
+}
+
+// max. weight in the subtree of p, computed from its children.
+TRIE_WEIGHT _node_max_weight(trie_t *t, trie_node_t *p)
+{
+    TRIE_WEIGHT m;
+    trie_node_t *c;
+
+    m = p->value ? _node_get_weight(t, p) : TRIE_WEIGHT_NONE;
+    for (c=_node_children(t, p);c;c=_node_next(t, c)) {
+        if (_node_get_max_weight(t, c) > m) {
+            m = _node_get_max_weight(t, c);
+        }
+    }
+    return m;
+}
+
+// Recomputes max_weight of the nodes on the path of key, bottom-up, after the
+// weight of key is decreased or key is deleted. Stops at the first node whose 
+// max. does not change, except the last node on the path whose max. might be 
+// set already (e.g: by _trie_merge). Out of memory only leaves max_weight 
+// bigger, which is allowed.
+void _trie_weight_fix(trie_t *t, trie_key_t *key)
+{
+    trie_node_t **path, *p;
+    unsigned long i, n, pending;
+    TRIE_CHAR ch;
+    TRIE_WEIGHT m;
+
+    path = (trie_node_t **)TRIEMALLOC(t, (key->size+1)*sizeof(trie_node_t *));
+    if (!path) {
+        return;
+    }
+    p = path[0] = t->root;
+    n = 1;
+    pending = 0;
+    for (i=0;i<key->size;i++) {
+        KEY_CHAR_READ(key, i, &ch);
+        p = _trie_step(t, p, &pending, ch);
+        if (!p) {
+            break; // the rest of the path is removed
+        }
+        if (p != path[n-1]) {
+            path[n++] = p;
+        }
+    }
+
+    for (i=n;i--;) {
+        m = _node_max_weight(t, path[i]);
+        if (m == _node_weight(t, path[i])->max_weight && i+1 < n) {
+            break;
+        }
+        _node_weight(t, path[i])->max_weight = m;
+    }
+    TRIEFREE(t, path);
+}
+
+// Adds n to the key counts of the nodes on the path of the first size chars 
+// of key, including the root. Stops where the path ends.
+void _trie_count_path(trie_t *t, trie_key_t *key, unsigned long size, long n)
+{
+    trie_node_t *p, *prev;
+    unsigned long i, pending;
+    TRIE_CHAR ch;
+
+    p = t->root;
+    p->count += n;
+    pending = 0;
+    for (i=0;i<size;i++) {
+        KEY_CHAR_READ(key, i, &ch);
+        prev = p;
+        p = _trie_step(t, p, &pending, ch);
+        if (!p) {
+            return;
+        }
+        if (p != prev) {
+            p->count += n;
+        }
+    }
+}
+
+// Copies the shared nodes on the path of key and the children of the last 
+// node on it, which is everything that adding or deleting key changes. (See 
+// Note 9) Returns 0 on allocation failure.
+int _trie_cow_path(trie_t *t, trie_key_t *key)
+{
+    trie_node_t *p;
+    unsigned long i, pending;
+    TRIE_CHAR ch;
+
+    p = t->root;
+    pending = 0;
+    i = 0;
+    while(1) {
+        // children of an edge belong to its last char. (See Note 5)
+        if (!pending && p->children && _node_shared(t, _node_children(t, p))
+            && !_trie_copy_children(t, p)) {
+            return 0;
+        }
+        if (i == key->size) {
+            break;
+        }
+        KEY_CHAR_READ(key, i, &ch);
+        i++;
+        p = _trie_step(t, p, &pending, ch);
+        if (!p) {
+            break;
+        }
+    }
+    return 1;
+}
+
+// Unlinks c from its parent p by a single store and retires it along with the
+// chain of nodes below it. Called by trie_del() when the chain has no values
+// left. (See Note 7)
+static void _trie_unlink(trie_t *t, trie_node_t *p, trie_node_t *c)
+{
+    trie_node_t *prev, *next;
+
+    _trie_index_del(t, p, c);
+    if (p->children == c->id) {
+        TRIE_STORE_RELEASE(&p->children, c->next);
+    } else {
+        for (prev=_node_children(t, p);prev->next != c->id;
+            prev=_node_next(t, prev))
+            ;
+        TRIE_STORE_RELEASE(&prev->next, c->next);
+    }
+    while(c) {
+        next = _node_children(t, c);
+        _trie_retire(t, LIMBO_NODE, c);
+        t->node_count--;
+        c = next;
+    }
+}
+
+// Returns the child of state s whose key is ch, 0 if there is none. (the root
+// is never a child)
+static uint32_t _ac_goto(trie_ac_t *ac, uint32_t s, TRIE_CHAR ch)
+{
+    trie_ac_state_t *st;
+    uint32_t lo, hi, mid;
+
+    if (!s && ch <= 0xFF) {
+        return ac->root[ch];
+    }
+    st = &ac->states[s];
+    lo = st->children;
+    hi = lo + st->child_count;
+    while(lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (ac->states[mid].key < ch) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < st->children + st->child_count && ac->states[lo].key == ch) {
+        return lo;
+    }
+    return 0;
+}
+
+// Char width specialized kernels, see trie_kernels.h.
+#define KEY_T uint8_t
+#define KERNEL(name) name##_1
+#include "trie_kernels.h"
+#undef KEY_T
+#undef KERNEL
+
+#define KEY_T uint16_t
+#define KERNEL(name) name##_2
+#include "trie_kernels.h"
+#undef KEY_T
+#undef KERNEL
+
+#define KEY_T uint32_t
+#define KERNEL(name) name##_4
+#include "trie_kernels.h"
+#undef KEY_T
+#undef KERNEL
+
+// Walks key starting from the position (p, *pending).
+trie_node_t *_trie_walk(trie_t *t, trie_node_t *p, unsigned long *pending, 
+    trie_key_t *key)
+{
+    TRIE_COUNTER_INC(walks);
+    // empty keys may not have a char_size.
+    if (!key->size) {
+        return p;
+    }
+    switch(key->char_size)
+    {
+        case 1:
+            return _trie_walk_1(t, p, pending, key);
+        case 2:
+            return _trie_walk_2(t, p, pending, key);
+        case 4:
+            return _trie_walk_4(t, p, pending, key);
+        default:
+            assert(0 == 1); // unsupported char_size
+            return NULL;
+    }
+}
+
+// Returns the node that key ends on. Key shall not end in the middle of a 
+// compressed edge.
+trie_node_t *_trie_prefix(trie_t *t, trie_node_t *p, trie_key_t *key)
+{
+    unsigned long pending;
+
+    pending = 0;
+    p = _trie_walk(t, p, &pending, key);
+    if (pending) {
+        return NULL;
+    }
+
+    return p;
+}
+
+// Matches the stored keys against the start of key[offset:], without 
+// collecting every match as trie_prefixes() does. (e.g: for tokenizing a text
+// by the longest match at every position)
+trie_node_t *trie_prefix_match(trie_t *t, trie_key_t *key, unsigned long offset,
+    int longest, unsigned long *length)
+{
+    switch(offset < key->size ? key->char_size : 1)
+    {
+        case 1:
+            return _trie_prefix_match_1(t, key, offset, longest, length);
+        case 2:
+            return _trie_prefix_match_2(t, key, offset, longest, length);
+        case 4:
+            return _trie_prefix_match_4(t, key, offset, longest, length);
+        default:
+            assert(0 == 1); // unsupported char_size
+            return NULL;
+    }
+}
+
+// Count of the keys that start with key. A single descent, as every node 
+// keeps the count of its subtree.
+unsigned long trie_count_suffixes(trie_t *t, trie_key_t *key)
+{
+    trie_node_t *p;
+    unsigned long pending;
+
+    pending = 0;
+    p = _trie_walk(t, t->root, &pending, key);
+    return p ? p->count : 0;
+}
+
+// Writes the smallest key in the subtree of p to out, which holds the key of 
+// p already. Children are sorted, so it is the leftmost path down to a value.
+// Subtrees that have no keys left are skipped by their counts.
+trie_node_t *_trie_min(trie_t *t, trie_node_t *p, trie_key_t *out)
+{
+    trie_node_t *c;
+
+    while(!p->value) {
+        for (c=_node_children(t, p);c && !c->count;c=_node_next(t, c))
+            ;
+        if (!c) {
+            return NULL;
+        }
+        out->size = _key_write_edge(t, out, out->size, c);
+        p = c;
+    }
+    return p;
+}
+
+// Same as above for the largest key: the rightmost path down to a leaf.
+trie_node_t *_trie_max(trie_t *t, trie_node_t *p, trie_key_t *out)
+{
+    trie_node_t *c, *last;
+
+    while(1) {
+        last = NULL;
+        for (c=_node_children(t, p);c;c=_node_next(t, c)) {
+            if (c->count) {
+                last = c;
+            }
+        }
+        if (!last) {
+            return p->value ? p : NULL;
+        }
+        out->size = _key_write_edge(t, out, out->size, last);
+        p = last;
+    }
+}
+
+// out shall have room for t->height chars.
+trie_node_t *trie_first(trie_t *t, trie_key_t *out)
+{
+    out->size = 0;
+    return t->root->count ? _trie_min(t, t->root, out) : NULL;
+}
+
+trie_node_t *trie_last(trie_t *t, trie_key_t *out)
+{
+    out->size = 0;
+    return t->root->count ? _trie_max(t, t->root, out) : NULL;
+}
+
+// Writes key[:depth] + the edge of p + the min/max key under p to out.
+trie_node_t *_trie_neighbour(trie_t *t, trie_node_t *p, trie_key_t *key, 
+    unsigned long depth, int max, trie_key_t *out)
+{
+    out->size = out->alloc_size;
+    KEYCPY(out, key, 0, 0, depth);
+    out->size = _key_write_edge(t, out, depth, p);
+    return max ? _trie_max(t, p, out) : _trie_min(t, p, out);
+}
+
+// Finds the smallest key > key (>= if inclusive) with a single descent: the 
+// answer is the min of the deepest subtree on the right of the path of key.
+// out shall not be key and have room for max(t->height, key->size) chars.
+trie_node_t *trie_successor(trie_t *t, trie_key_t *key, int inclusive, 
+    trie_key_t *out)
+{
+    trie_node_t *p, *c, *nd, *cand;
+    trie_tail_t *tl;
+    unsigned long i, j, start, depth;
+    TRIE_CHAR ch;
+
+    p = t->root;
+    cand = NULL;
+    depth = 0;
+    i = 0;
+    while(1) {
+        if (i == key->size) {
+            if (inclusive && p->value) {
+                out->size = out->alloc_size;
+                KEYCPY(out, key, 0, 0, key->size);
+                out->size = key->size;
+                return p;
+            }
+            // every key below p is an extension of key.
+            for (c=_node_children(t, p);c && !c->count;c=_node_next(t, c))
+                ;
+            if (c) {
+                cand = c;
+                depth = i;
+            }
+            break;
+        }
+
+        KEY_CHAR_READ(key, i, &ch);
+        for (c=_node_children(t, p);c && (c->key <= ch || !c->count);
+            c=_node_next(t, c))
+            ;
+        if (c) {
+            cand = c;
+            depth = i;
+        }
+        nd = _trie_child(t, p, ch);
+        if (!nd) {
+            break;
+        }
+        start = i++;
+        tl = _node_tail(t, nd);
+        if (tl) {
+            for (j=0;j<tl->size && i<key->size;j++,i++) {
+                KEY_CHAR_READ(key, i, &ch);
+                if (ch != tl->s[j]) {
+                    break;
+                }
+            }
+            if (j < tl->size) {
+                // key ends in the edge or diverges from it.
+                if ((i == key->size || ch < tl->s[j]) && nd->count) {
+                    cand = nd;
+                    depth = start;
+                }
+                break;
+            }
+        }
+        p = nd;
+    }
+
+    return cand ? _trie_neighbour(t, cand, key, depth, 0, out) : NULL;
+}
+
+// Finds the largest key < key (<= if inclusive): either a key on the path of 
+// key or the max of the deepest subtree on the left of it.
+trie_node_t *trie_predecessor(trie_t *t, trie_key_t *key, int inclusive, 
+    trie_key_t *out)
+{
+    trie_node_t *p, *c, *nd, *cand, *last;
+    trie_tail_t *tl;
+    unsigned long i, j, start, depth;
+    TRIE_CHAR ch;
+    int self;
+
+    p = t->root;
+    cand = NULL;
+    depth = 0;
+    self = 0;
+    i = 0;
+    while(1) {
+        if (i == key->size) {
+            if (inclusive && p->value) {
+                cand = p;
+                depth = i;
+                self = 1;
+            }
+            break;
+        }
+        if (p->value) {
+            // a proper prefix of key
+            cand = p;
+            depth = i;
+            self = 1;
+        }
+
+        KEY_CHAR_READ(key, i, &ch);
+        last = NULL;
+        for (c=_node_children(t, p);c && c->key < ch;c=_node_next(t, c)) {
+            if (c->count) {
+                last = c;
+            }
+        }
+        if (last) {
+            cand = last;
+            depth = i;
+            self = 0;
+        }
+        nd = _trie_child(t, p, ch);
+        if (!nd) {
+            break;
+        }
+        start = i++;
+        tl = _node_tail(t, nd);
+        if (tl) {
+            for (j=0;j<tl->size && i<key->size;j++,i++) {
+                KEY_CHAR_READ(key, i, &ch);
+                if (ch != tl->s[j]) {
+                    break;
+                }
+            }
+            if (j < tl->size) {
+                if (i < key->size && ch > tl->s[j] && nd->count) {
+                    cand = nd;
+                    depth = start;
+                    self = 0;
+                }
+                break;
+            }
+        }
+        p = nd;
+    }
+
+    if (!cand) {
+        return NULL;
+    }
+    if (self) {
+        out->size = out->alloc_size;
+        KEYCPY(out, key, 0, 0, depth);
+        out->size = depth;
+        return cand;
+    }
+    return _trie_neighbour(t, cand, key, depth, 1, out);
+}
+
+trie_node_t *trie_search(trie_t *t, trie_key_t *key)
+{
+    trie_node_t *r;
+
+    r = _trie_prefix(t, t->root, key);
+    if (r && !r->value)
+    {
+        return NULL;
+    }
+
+    return r;
+}
+
+int _key_cmp(trie_key_t *a, trie_key_t *b)
+{
+    unsigned long i, n;
+    TRIE_CHAR ca, cb;
+    int r;
+
+    n = a->size < b->size ? a->size : b->size;
+    // byte order is the char order for 1-byte chars.
+    if (a->char_size == 1 && b->char_size == 1) {
+        r = memcmp(a->s, b->s, n);
+        if (r) {
+            return r;
+        }
+        n = 0;
+    }
+    for (i=0;i<n;i++) {
+        KEY_CHAR_READ(a, i, &ca);
+        KEY_CHAR_READ(b, i, &cb);
+        if (ca != cb) {
+            return ca < cb ? -1 : 1;
+        }
+    }
+    return (a->size > b->size) - (a->size < b->size);
+}
+
+int _key_ptr_cmp(const void *a, const void *b)
+{
+    return _key_cmp(*(trie_key_t **)a, *(trie_key_t **)b);
+}
+
+// Searches count keys, out[i] is the result of trie_search(t, &keys[i]). Keys
+// are searched in sorted order if sort is set, and every key only descends 
+// from where it diverges from the previous one, so the common prefixes are 
+// walked once. Returns 0 if there is no memory. 
+int trie_search_many(trie_t *t, trie_key_t *keys, unsigned long count, 
+    trie_node_t **out, int sort)
+{
+    trie_key_t **order, *key, *prev;
+    trie_node_t **path, *p;
+    unsigned long *pending, i, j, valid, alloc;
+
+    order = (trie_key_t **)TRIEMALLOC(NULL, count*sizeof(trie_key_t *));
+    if (!order) {
+        return 0;
+    }
+    alloc = 0;
+    for (i=0;i<count;i++) {
+        order[i] = &keys[i];
+        if (keys[i].size > alloc) {
+            alloc = keys[i].size;
+        }
+    }
+    if (sort) {
+        qsort(order, count, sizeof(trie_key_t *), _key_ptr_cmp);
+    }
+
+    // (path[d], pending[d]) is the position of the first d chars of prev, it 
+    // is known for d <= valid.
+    path = (trie_node_t **)TRIEMALLOC(NULL, (alloc+1)*sizeof(trie_node_t *));
+    pending = (unsigned long *)TRIEMALLOC(NULL, (alloc+1)*sizeof(unsigned long));
+    if (!path || !pending) {
+        if (path) {
+            TRIEFREE(NULL, path);
+        }
+        if (pending) {
+            TRIEFREE(NULL, pending);
+        }
+        TRIEFREE(NULL, order);
+        return 0;
+    }
+    path[0] = t->root;
+    pending[0] = 0;
+    valid = 0;
+    prev = NULL;
+
+    for (i=0;i<count;i++) {
+        key = order[i];
+
+        switch(key->char_size)
+        {
+            case 1:
+                p = _trie_search_path_1(t, key, prev, valid, path, pending, 
+                    &j);
+                break;
+            case 2:
+                p = _trie_search_path_2(t, key, prev, valid, path, pending, 
+                    &j);
+                break;
+            case 4:
+                p = _trie_search_path_4(t, key, prev, valid, path, pending, 
+                    &j);
+                break;
+            default:
+                assert(0 == 1); // unsupported char_size
+                p = NULL;
+                j = 0;
+        }
+        valid = j;
+        prev = key;
+
+        if (p && (pending[j] || !p->value)) {
+            p = NULL;
+        }
+        out[key - keys] = p;
+    }
+
+    TRIEFREE(NULL, path);
+    TRIEFREE(NULL, pending);
+    TRIEFREE(NULL, order);
+    return 1;
+}
+
+// Adds key with value. Weight of the key is set if set_weight is given, 
+// otherwise an existing key keeps its weight and a new one gets 0.
+int _trie_add(trie_t *t, trie_key_t *key, TRIE_DATA value, TRIE_WEIGHT weight, 
+    int set_weight)
+{
+    if (t->origin) {
+        return 0; // snapshots are read-only
+    }
+    _trie_reclaim(t);
+    if (set_weight && weight != 0 && !_trie_weigh(t)) {
+        return 0;
+    }
+    if (t->shared_count && !_trie_cow_path(t, key)) {
+        return 0;
+    }
+    switch(key->char_size)
+    {
+        case 1:
+            return _trie_add_1(t, key, value, weight, set_weight);
+        case 2:
+            return _trie_add_2(t, key, value, weight, set_weight);
+        case 4:
+            return _trie_add_4(t, key, value, weight, set_weight);
+        default:
+            assert(0 == 1); // unsupported char_size
+            return 0;
+    }
+}
+
+int trie_add(trie_t *t, trie_key_t *key, TRIE_DATA value)
+{
+    return _trie_add(t, key, value, 0, 0);
+}
+
+int trie_add_weighted(trie_t *t, trie_key_t *key, TRIE_DATA value, 
+    TRIE_WEIGHT weight)
+{
+    return _trie_add(t, key, value, weight, 1);
+}
+
+int trie_del(trie_t *t, trie_key_t *key, TRIE_DATA *old)
+{
+    if (t->origin) {
+        return 0;
+    }
+    _trie_reclaim(t);
+    // the path is not copied for a key that is not found.
+    if (t->shared_count && (!trie_search(t, key) || !_trie_cow_path(t, key))) {
+        return 0;
+    }
+    switch(key->char_size)
+    {
+        case 1:
+            return trie_del_1(t, key, old);
+        case 2:
+            return trie_del_2(t, key, old);
+        case 4:
+            return trie_del_4(t, key, old);
+        default:
+            assert(0 == 1); // unsupported char_size
+            return 0;
+    }
+}
+
+// Retires nd and every node below it. Returns the count of nodes removed.
+unsigned long _trie_retire_tree(trie_t *t, trie_node_t *nd)
+{
+    trie_node_t *c, *next;
+    unsigned long n;
+
+    n = 1;
+    for (c=_node_children(t, nd);c;c=next) {
+        next = _node_next(t, c);
+        n += _trie_retire_tree(t, c);
+    }
+    // a copy might still have shared nodes below it, those are retired once 
+    // the last snapshot is destroyed. (See _trie_thaw)
+    if (!_node_shared(t, nd)) {
+        _trie_retire(t, LIMBO_NODE, nd);
+    }
+    t->node_count--;
+    return n;
+}
+
+// Recomputes the max. weight of p from its children, if t is weighted.
+void _trie_compact_weight(trie_t *t, trie_node_t *p)
+{
+    trie_weight_t *w;
+
+    w = _node_weight(t, p);
+    if (w) {
+        w->max_weight = _node_max_weight(t, p);
+    }
+}
+
+// Unlinks the dead children of p, each by a single store (See Note 7), and
+// compacts the live ones. max_weight of p is recomputed on the way up. 
+// Children shared with a snapshot are left as they are, their subtrees are 
+// shared too. (See Note 9)
+unsigned long _trie_compact(trie_t *t, trie_node_t *p)
+{
+    trie_node_t *c, *prev, *next;
+    unsigned long n;
+
+    n = 0;
+    if (p->children && _node_shared(t, _node_children(t, p))) {
+        _trie_compact_weight(t, p);
+        return 0;
+    }
+    prev = NULL;
+    for (c=_node_children(t, p);c;c=next) {
+        next = _node_next(t, c);
+        if (c->count) {
+            n += _trie_compact(t, c);
+            prev = c;
+            continue;
+        }
+        _trie_index_del(t, p, c);
+        if (prev) {
+            TRIE_STORE_RELEASE(&prev->next, _node_id(next));
+        } else {
+            TRIE_STORE_RELEASE(&p->children, _node_id(next));
+        }
+        n += _trie_retire_tree(t, c);
+    }
+
+    // no need to check the result, an uncompressed edge is still valid.
+    if ((t->flags & TRIE_COMPRESSED) && p != t->root && !p->value &&
+        p->children && !_node_children(t, p)->next && _trie_merge(t, p)) {
+        n++;
+    }
+    _trie_compact_weight(t, p);
+    return n;
+}
+
+// 1 if every node handed out from sl is on the free-list.
+int _slab_empty(trie_slab_t *sl)
+{
+    return sl->used && sl->free == sl->used;
+}
+
+// Releases the slabs whose nodes are all on the free-list, except the first 
+// one that holds node 0. Readers are not on those nodes, they are freed after
+// the readers are done. (See Note 7) The free-list is made again from the 
+// free nodes of the slabs kept, which are told by their id of 0, so that the 
+// list is not followed node by node. Slabs are kept while t has snapshots, 
+// they might reach the nodes.
+// Complexity: O(nodes of the slabs kept + slabs)
+void _trie_release_slabs(trie_t *t)
+{
+    trie_slab_t *sl;
+    trie_node_t *nd;
+    unsigned long i, k, n;
+    uint32_t *link;
+
+    if (t->snapshots || t->shared_count) {
+        return;
+    }
+    n = 0;
+    for (k=1;k<t->slab_count;k++) {
+        if (t->slabs[k] && _slab_empty(t->slabs[k])) {
+            n++;
+        }
+    }
+    if (!n) {
+        return;
+    }
+
+    for (k=1;k<t->slab_count;k++) {
+        sl = t->slabs[k];
+        if (sl && _slab_empty(sl)) {
+            SLABFREE(t, sl);
+            t->slabs[k] = NULL;
+            t->slab_released++;
+        }
+    }
+    if (!t->slabs[t->slab_cur]) {
+        t->slab_cur = 0;
+    }
+    link = &t->free_nodes;
+    for (k=0;k<t->slab_count;k++) {
+        sl = t->slabs[k];
+        if (!sl || !sl->free) {
+            continue;
+        }
+        for (i=k ? 0 : 1;i<sl->used;i++) {
+            nd = &SLAB_NODES(sl)[i];
+            if (!nd->id) {
+                *link = (uint32_t)(k << TRIE_SLAB_SHIFT | i);
+                link = &nd->next;
+            }
+        }
+    }
+    *link = 0;
+}
+
+// Reclaims the dead nodes left by lazy deletes and fixes their max. weights 
+// in a single walk. (See Note 10) Then the slabs left with no used nodes are
+// released, in a trie with eager deletes too. Returns the count of nodes 
+// reclaimed.
+// Complexity: O(n)
+unsigned long trie_compact(trie_t *t)
+{
+    unsigned long n;
+
+    if (t->origin) {
+        return 0;
+    }
+    _trie_reclaim(t);
+    n = _trie_compact(t, t->root);
+    // iterators of t might be on the dead nodes.
+    if (n) {
+        t->version++;
+        _trie_ac_drop(t);
+    }
+    _trie_release_slabs(t);
+    return n;
+}
+
+typedef struct ac_pos_s {
+    trie_node_t *nd;
+    unsigned long j; // tail chars of nd consumed (See Note 5)
+} ac_pos_t;
+
+// Appends a state for the position (nd, j) reached by ch. Returns 0 on 
+// allocation failure.
+int _ac_append(trie_t *t, trie_ac_t *ac, ac_pos_t **pos, unsigned long *alloc, 
+    trie_node_t *nd, unsigned long j, TRIE_CHAR ch)
+{
+    trie_ac_state_t *states;
+    ac_pos_t *npos;
+    trie_ac_state_t *st;
+    unsigned long n;
+
+    if (ac->count == *alloc) {
+        n = *alloc * 2;
+        if (n > UINT32_MAX) {
+            n = UINT32_MAX;
+        }
+        if (n == *alloc) {
+            return 0;
+        }
+        states = (trie_ac_state_t *)TRIEMALLOC(t, n * sizeof(trie_ac_state_t));
+        npos = (ac_pos_t *)TRIEMALLOC(NULL, n * sizeof(ac_pos_t));
+        if (!states || !npos) {
+            if (states) {
+                TRIEFREE(t, states);
+            }
+            if (npos) {
+                TRIEFREE(NULL, npos);
+            }
+            return 0;
+        }
+        memcpy(states, ac->states, ac->count * sizeof(trie_ac_state_t));
+        memcpy(npos, *pos, ac->count * sizeof(ac_pos_t));
+        TRIEFREE(t, ac->states);
+        TRIEFREE(NULL, *pos);
+        ac->states = states;
+        *pos = npos;
+        *alloc = n;
+    }
+
+    st = &ac->states[ac->count];
+    st->key = ch;
+    st->children = st->child_count = st->fail = st->out = st->depth = 0;
+    st->node = NULL;
+    if (nd->value && (!_node_tail(t, nd) || j == _node_tail(t, nd)->size)) {
+        st->node = nd;
+    }
+    (*pos)[ac->count].nd = nd;
+    (*pos)[ac->count].j = j;
+    ac->count++;
+    return 1;
+}
+
+// Builds the automaton of the keys, if it is not built yet. (See Note 8) 
+// States are laid out breadth first, so the fail link of a state is known 
+// before its children need it. Returns 0 on allocation failure.
+int trie_ac_compile(trie_t *t)
+{
+    trie_ac_t *ac;
+    trie_ac_state_t *st, *c;
+    trie_node_t *p, *nd;
+    trie_tail_t *tl;
+    ac_pos_t *pos;
+    unsigned long i, j, k, alloc;
+    uint32_t f, g;
+
+    if (t->ac) {
+        return 1;
+    }
+    ac = (trie_ac_t *)TRIEMALLOC(t, sizeof(trie_ac_t));
+    if (!ac) {
+        return 0;
+    }
+    memset(ac->root, 0, sizeof(ac->root));
+    alloc = t->node_count + 1;
+    ac->states = (trie_ac_state_t *)TRIEMALLOC(t, alloc * 
+        sizeof(trie_ac_state_t));
+    pos = (ac_pos_t *)TRIEMALLOC(NULL, alloc * sizeof(ac_pos_t));
+    if (!ac->states || !pos) {
+        goto fail;
+    }
+
+    // the empty key is not matched, the root has no node.
+    ac->count = 0;
+    _ac_append(t, ac, &pos, &alloc, t->root, 0, 0);
+    ac->states[0].node = NULL;
+    for (i=0;i<ac->count;i++) {
+        p = pos[i].nd;
+        j = pos[i].j;
+        k = ac->count;
+        tl = _node_tail(t, p);
+        if (tl && j < tl->size) {
+            if (!_ac_append(t, ac, &pos, &alloc, p, j+1, tl->s[j])) {
+                goto fail;
+            }
+        } else {
+            for (nd=_node_children(t, p);nd;nd=_node_next(t, nd)) {
+                if (nd->count && !_ac_append(t, ac, &pos, &alloc, nd, 0, 
+                    nd->key)) {
+                    goto fail;
+                }
+            }
+        }
+        st = &ac->states[i];
+        st->children = (uint32_t)k;
+        st->child_count = (uint32_t)(ac->count - k);
+        for (;k<ac->count;k++) {
+            ac->states[k].depth = st->depth + 1;
+            if (!i && ac->states[k].key <= 0xFF) {
+                ac->root[ac->states[k].key] = (uint32_t)k;
+            }
+        }
+    }
+    TRIEFREE(NULL, pos);
+    pos = NULL;
+
+    for (i=0;i<ac->count;i++) {
+        st = &ac->states[i];
+        for (k=st->children;k<st->children+st->child_count;k++) {
+            c = &ac->states[k];
+            g = 0;
+            if (i) {
+                f = st->fail;
+                while(1) {
+                    g = _ac_goto(ac, f, c->key);
+                    if (g || !f) {
+                        break;
+                    }
+                    f = ac->states[f].fail;
+                }
+            }
+            c->fail = g;
+            c->out = ac->states[g].node ? g : ac->states[g].out;
+        }
+    }
+
+    t->ac = ac;
+    return 1;
+
+fail:
+    if (pos) {
+        TRIEFREE(NULL, pos);
+    }
+    if (ac->states) {
+        TRIEFREE(t, ac->states);
+    }
+    TRIEFREE(t, ac);
+    return 0;
+}
+
+// Calls cbk(start, end, value) for every occurrence of a key in text, in the
+// order of their ends. Stops if cbk returns 0. Returns 0 if the automaton 
+// cannot be built or cbk has stopped it.
+int trie_ac_find_all(trie_t *t, trie_key_t *text, trie_match_cbk_t cbk, 
+    void *cbk_arg)
+{
+    if (!trie_ac_compile(t)) {
+        return 0;
+    }
+    if (!text->size) {
+        return 1;
+    }
+    switch(text->char_size)
+    {
+        case 1:
+            return _trie_ac_scan_1(t->ac, text, cbk, cbk_arg);
+        case 2:
+            return _trie_ac_scan_2(t->ac, text, cbk, cbk_arg);
+        case 4:
+            return _trie_ac_scan_4(t->ac, text, cbk, cbk_arg);
+        default:
+            assert(0 == 1); // unsupported char_size
+            return 0;
+    }
+}
+
+int _builder_grow(trie_builder_t *b, unsigned long size)
+{
+    trie_node_t **path;
+    TRIE_CHAR *last;
+    unsigned long alloc;
+
+    alloc = b->alloc ? b->alloc : 32;
+    while(alloc < size) {
+        alloc *= 2;
+    }
+    path = (trie_node_t **)TRIEMALLOC(b->t, (alloc+1)*sizeof(trie_node_t *));
+    if (!path) {
+        return 0;
+    }
+    last = (TRIE_CHAR *)TRIEMALLOC(b->t, alloc*sizeof(TRIE_CHAR));
+    if (!last) {
+        TRIEFREE(b->t, path);
+        return 0;
+    }
+    if (b->path) {
+        memcpy(path, b->path, (b->size+1)*sizeof(trie_node_t *));
+        memcpy(last, b->last, b->size*sizeof(TRIE_CHAR));
+        TRIEFREE(b->t, b->path);
+        TRIEFREE(b->t, b->last);
+    }
+    b->path = path;
+    b->last = last;
+    b->alloc = alloc;
+
+    return 1;
+}
+
+trie_builder_t *trie_builder_init(trie_t *t)
+{
+    trie_builder_t *b;
+
+    b = (trie_builder_t *)TRIEMALLOC(t, sizeof(trie_builder_t));
+    if (!b) {
+        return NULL;
+    }
+    b->t = t;
+    b->path = NULL;
+    b->last = NULL;
+    b->size = 0;
+    b->alloc = 0;
+    if (!_builder_grow(b, t->height)) {
+        TRIEFREE(t, b);
+        return NULL;
+    }
+    b->path[0] = t->root;
+
+    return b;
+}
+
+// Forgets the path of the last key. Must be called if the trie might be 
+// changed by anything other than the builder since the last add.
+void trie_builder_reset(trie_builder_t *b)
+{
+    b->size = 0;
+    b->path[0] = b->t->root; // replaced by trie_snapshot()
+}
+
+void trie_builder_deinit(trie_builder_t *b)
+{
+    trie_t *t;
+
+    t = b->t;
+    TRIEFREE(t, b->path);
+    TRIEFREE(t, b->last);
+    TRIEFREE(t, b);
+}
+
+// Same as trie_add, but only descends from where key diverges from the last 
+// added key. Once a node is created, there is no need to search the children 
+// of it, so for sorted keys, every node is created without a lookup except the
+// first one. The replaced value, if any, is written to old.
+// Compressed tries may split the nodes on the path, so trie_add is used for 
+// them.
+int trie_builder_add(trie_builder_t *b, trie_key_t *key, TRIE_DATA value, 
+    TRIE_DATA *old)
+{
+    unsigned long i;
+    int r;
+    trie_t *t;
+    trie_node_t *parent;
+    trie_weight_t *w;
+
+    t = b->t;
+    if (t->origin) {
+        return 0;
+    }
+    _trie_reclaim(t);
+    if (t->flags & TRIE_COMPRESSED) {
+        parent = trie_search(t, key);
+        *old = parent ? parent->value : 0;
+        return trie_add(t, key, value);
+    }
+
+    if (key->size > b->alloc && !_builder_grow(b, key->size)) {
+        return 0;
+    }
+    // the nodes of the last path are t's own already, unless a snapshot is 
+    // taken since. (See trie_builder_reset)
+    if (t->shared_count && !_trie_cow_path(t, key)) {
+        return 0;
+    }
+
+    switch(key->char_size)
+    {
+        case 1:
+            r = _trie_builder_path_1(b, key);
+            break;
+        case 2:
+            r = _trie_builder_path_2(b, key);
+            break;
+        case 4:
+            r = _trie_builder_path_4(b, key);
+            break;
+        default:
+            assert(0 == 1); // unsupported char_size
+            r = 0;
+    }
+    if (!r) {
+        return 0;
+    }
+    parent = b->path[key->size];
+
+    *old = parent->value;
+    if (!parent->value) {
+        t->item_count++;
+        t->version++;
+        _trie_ac_drop(t);
+        // new keys weigh 0, existing ones keep their weight.
+        w = _node_weight(t, parent);
+        if (w) {
+            w->weight = 0;
+        }
+        for (i=0;i<=key->size;i++) {
+            w = _node_weight(t, b->path[i]);
+            if (w && w->max_weight < 0) {
+                w->max_weight = 0;
+            }
+            b->path[i]->count++;
+        }
+    }
+
+    if (key->size > t->height) {
+        t->height = key->size;
+    }
+
+    parent->value = value;
+    return 1;
+}
+
+trie_dl_t *DLCREATE(trie_t *t, trie_key_t *key, unsigned long max_dist)
+{
+    trie_dl_t *dl;
+    unsigned long j, cells;
+
+    dl = (trie_dl_t *)TRIEMALLOC(t, sizeof(trie_dl_t));
+    if (!dl) {
+        return NULL;
+    }
+    // a path longer than size+max_dist is always farther than max_dist.
+    dl->size = key->size;
+    dl->max_dist = max_dist;
+    dl->alloc = key->size + max_dist + 1;
+    cells = dl->alloc * (dl->size+1);
+    dl->query = (TRIE_CHAR *)TRIEMALLOC(t, (dl->size ? dl->size : 1) * 
+        sizeof(TRIE_CHAR));
+    dl->rows = (unsigned long *)TRIEMALLOC(t, cells * sizeof(unsigned long));
+    dl->last = (unsigned long *)TRIEMALLOC(t, cells * sizeof(unsigned long));
+    if (!dl->query || !dl->rows || !dl->last) {
+        if (dl->query) {
+            TRIEFREE(t, dl->query);
+        }
+        if (dl->rows) {
+            TRIEFREE(t, dl->rows);
+        }
+        if (dl->last) {
+            TRIEFREE(t, dl->last);
+        }
+        TRIEFREE(t, dl);
+        return NULL;
+    }
+
+    for (j=0;j<dl->size;j++) {
+        KEY_CHAR_READ(key, j, &dl->query[j]);
+    }
+    // row 0 is the distance of the empty path.
+    for (j=0;j<=dl->size;j++) {
+        dl->rows[j] = j;
+        dl->last[j] = 0;
+    }
+
+    return dl;
+}
+
+void DLFREE(trie_t *t, trie_dl_t *dl)
+{
+    TRIEFREE(t, dl->query);
+    TRIEFREE(t, dl->rows);
+    TRIEFREE(t, dl->last);
+    TRIEFREE(t, dl);
+}
+
+iter_t * ITERATORCREATE(trie_t *t, trie_key_t *key, unsigned long max_depth, 
+    unsigned long alloc_size, unsigned long stack_size1, unsigned long stack_size2)
+{
+    iter_t *r;
+    iter_stack_t *k0,*k1;
+    trie_key_t *kp;
+
+    // alloc a key that can hold size + max_depth chars.
+    kp = KEYCREATE(t, alloc_size, sizeof(TRIE_CHAR));
+    if (!kp) {
+        return NULL;
+    }
+
+    KEYCPY(kp, key, 0, 0, key->size);
+    kp->size = key->size;
+
+    // allocate stacks
+    k0 = STACKCREATE(t, stack_size1);
+    if (!k0) {
+        KEYFREE(t, kp);
+        return NULL;
+    }
+    k1 = STACKCREATE(t, stack_size2);
+    if (!k1) {
+        KEYFREE(t, kp);
+        STACKFREE(t, k0);
+        return NULL;
+    }
+
+    // alloc iterator obj
+    r = (iter_t *)TRIEMALLOC(t, sizeof(iter_t));
+    if (!r) {
+        KEYFREE(t, kp);
+        STACKFREE(t, k0);
+        STACKFREE(t, k1);
+        return NULL;
+    }
+
+    r->first = 1;
+    r->last = 0;
+    r->fail = 0;
+    r->fail_reason = UNDEFINED;
+    r->key = kp;
+    r->stack0 = k0;
+    r->stack1 = k1;
+    r->max_depth = max_depth;
+    r->trie = t;
+    r->version = t->version;
+    r->dl = NULL;
+    r->value = 0;
+
+    return r;
+}
+
+void ITERATORFREE(trie_t *t, iter_t *iter)
+{
+    KEYFREE(t, iter->key);
+    STACKFREE(t, iter->stack0);
+    STACKFREE(t, iter->stack1);
+    if (iter->dl) {
+        DLFREE(t, iter->dl);
+    }
+    TRIEFREE(t, iter);
+}
+
+void iterator_deinit(iter_t *iter)
+{
+    assert(iter != NULL);
+
+    ITERATORFREE(iter->trie, iter);
+}
+
+void _suffixes(trie_t *t, trie_node_t *p, trie_key_t *key, unsigned long index, 
+    trie_enum_cbk_t cbk, void* cbk_arg)
+{
+    if (p->value) {
+        cbk(key, cbk_arg);
+    }
+    
+    if (index == key->alloc_size) {
+        return;
+    }
+    p = _node_children(t, p);
+    while(p){
+        // skip the edges that do not fit in max_depth
+        if (index+EDGE_SIZE(t, p) <= key->alloc_size) {
+            key->size = _key_write_edge(t, key, index, p);
+
+            _suffixes(t, p, key, key->size, cbk, cbk_arg);
+        }
+      
+        p = _node_next(t, p);
+    }
+}
+
+void trie_suffixes(trie_t *t, trie_key_t *key, unsigned long max_depth, 
+    trie_enum_cbk_t cbk, void* cbk_arg)
+{
+    trie_key_t *kp;
+    trie_node_t *prefix;
+    unsigned long pending;
+
+    // first search key
+    pending = 0;
+    prefix = _trie_walk(t, t->root, &pending, key);
+    if (!prefix || pending > max_depth) {
+        return;
+    }
+
+    // alloc a key that can hold size + max_depth chars.
+    kp = KEYCREATE(NULL, (key->size + max_depth), sizeof(TRIE_CHAR));
+    if (!kp) {
+        return;
+    }
+    KEYCPY(kp, key, 0, 0, key->size);
+    kp->size = key->size;
+
+    // key may end in the middle of an edge, complete it.
+    _key_write_pending(t, kp, prefix, pending);
+
+    _suffixes(t, prefix, kp, kp->size, cbk, cbk_arg);
+
+    KEYFREE(NULL, kp);
+}
+
+iter_t *trie_itersuffixes_init(trie_t *t, trie_key_t *key, unsigned long max_depth)
+{
+    iter_t *iter;
+    trie_node_t *prefix;
+    unsigned long pending;
+
+    // first search key
+    pending = 0;
+    prefix = _trie_walk(t, t->root, &pending, key);
+    if (!prefix) {
+        return NULL;
+    }
+
+    // create the iterator obj
+    iter = ITERATORCREATE(t, key, max_depth, (key->size + max_depth), 
+        max_depth, 0);
+    if (!iter) {
+        return NULL;
+    }
     trie_itersuffixes_reset(iter);
 
     return iter;
@@ -550,6 +3486,7 @@ iter_t *trie_itersuffixes_reset(iter_t *iter)
 {
     trie_node_t *prefix;
     iter_pos_t ipos;
+    unsigned long pending;
 
     // pop all elems first
     while(POPI(iter->stack0))
@@ -559,11 +3496,16 @@ iter_t *trie_itersuffixes_reset(iter_t *iter)
     iter->key->size = iter->key->alloc_size-iter->max_depth;
 
     // get prefix in the trie
-    prefix = _trie_prefix(iter->trie->root, iter->key);
-    if (!prefix) {
+    pending = 0;
+    prefix = _trie_walk(iter->trie, iter->trie->root, &pending, 
+        iter->key);
+    if (!prefix || pending > iter->max_depth) {
         return NULL;
     }
 
+    // key may end in the middle of an edge, complete it.
+    _key_write_pending(iter->trie, iter->key, prefix, pending);
+
     // push the first iter_pos
     ipos.iptr = prefix;
     ipos.pos = 0;
@@ -574,7 +3516,7 @@ iter_t *trie_itersuffixes_reset(iter_t *iter)
     iter->last = 0;
     iter->fail = 0;
     iter->fail_reason = UNDEFINED;
-    iter->trie->dirty = 0;
+    iter->version = iter->trie->version;
 
     return iter;
 }
@@ -595,7 +3537,7 @@ iter_t *trie_itersuffixes_next(iter_t *iter)
         }
 
         // trie changed during iteration?
-        if (iter->trie->dirty) {
+        if (iter->version != iter->trie->version) {
             iter->fail = 1;
             iter->fail_reason = CHG_WHILE_ITER;
             break;
@@ -612,9 +3554,10 @@ iter_t *trie_itersuffixes_next(iter_t *iter)
         if (iter->first) {
             iter->first = 0;
             val = ip->iptr->value;
-            ip->iptr = ip->iptr->children;
+            ip->iptr = _node_children(iter->trie, ip->iptr);
             ip->op.index++;
             if (val) {
+                iter->value = val;
                 break;
             }
         }
@@ -624,19 +3567,25 @@ iter_t *trie_itersuffixes_next(iter_t *iter)
             continue;
         }
 
-        KEY_CHAR_WRITE(iter->key, ip->op.index, ip->iptr->key);
-        iter->key->size = ip->op.index+1;
+        if (ip->op.index+EDGE_SIZE(iter->trie, ip->iptr) > 
+            iter->key->alloc_size) {
+            ip->pos = 1; // edge does not fit in max_depth, skip it.
+        } else {
+            iter->key->size = _key_write_edge(iter->trie, iter->key, 
+                ip->op.index, ip->iptr);
 
-        if (ip->pos == 0 && ip->iptr->value) {
-            found = 1;
+            if (ip->pos == 0 && ip->iptr->value) {
+                iter->value = ip->iptr->value;
+                found = 1;
+            }
         }
 
         if (ip->pos == 0) {
             ip->pos = 1;
             if (ip->iptr->children) {
-                if (ip->op.index+1 < (iter->key->alloc_size)) {
-                    ipos.iptr = ip->iptr->children;
-                    ipos.op.index = ip->op.index+1;
+                if (iter->key->size < (iter->key->alloc_size)) {
+                    ipos.iptr = _node_children(iter->trie, ip->iptr);
+                    ipos.op.index = iter->key->size;
                     ipos.pos = 0;
                     PUSHI(iter->stack0, &ipos);
                 }
@@ -644,7 +3593,7 @@ iter_t *trie_itersuffixes_next(iter_t *iter)
         } else if (ip->pos == 1) {
             POPI(iter->stack0);
             if (ip->iptr->next) {
-                ipos.iptr = ip->iptr->next;
+                ipos.iptr = _node_next(iter->trie, ip->iptr);
                 ipos.op.index = ip->op.index;
                 ipos.pos = 0;
                 PUSHI(iter->stack0, &ipos);
@@ -655,13 +3604,195 @@ iter_t *trie_itersuffixes_next(iter_t *iter)
     return iter;
 }
 
+// trie_top_suffixes() visits the subtrees best-first. Every visited subtree is
+// an item, and items link to the item of their parent so that keys can be 
+// written without holding a copy per item. A key item stands for the key of 
+// its parent item's node.
+typedef struct top_item_s {
+    trie_node_t *nd;
+    unsigned long parent;
+    unsigned long size; // key size at the end of nd's edge
+    int is_key;
+} top_item_t;
+
+typedef struct top_heap_s {
+    TRIE_WEIGHT w;
+    unsigned long item;
+} top_heap_t;
+
+typedef struct top_s {
+    top_item_t *items;
+    top_heap_t *heap;
+    unsigned long count; // item count
+    unsigned long hsize; // heap size
+    unsigned long alloc;
+} top_t;
+
+// heavier first, then the one that is pushed first.
+#define TOP_BEFORE(a, b) ((a).w > (b).w || ((a).w == (b).w && (a).item < (b).item))
+
+int _top_push(top_t *tp, trie_node_t *nd, unsigned long parent, 
+    unsigned long size, int is_key, TRIE_WEIGHT w)
+{
+    top_item_t *items;
+    top_heap_t *heap, e;
+    unsigned long i, alloc;
+
+    if (tp->count == tp->alloc) {
+        alloc = tp->alloc ? tp->alloc * 2 : 64;
+        items = (top_item_t *)TRIEMALLOC(NULL, alloc*sizeof(top_item_t));
+        heap = (top_heap_t *)TRIEMALLOC(NULL, alloc*sizeof(top_heap_t));
+        if (!items || !heap) {
+            if (items) {
+                TRIEFREE(NULL, items);
+            }
+            if (heap) {
+                TRIEFREE(NULL, heap);
+            }
+            return 0;
+        }
+        if (tp->items) {
+            memcpy(items, tp->items, tp->count*sizeof(top_item_t));
+            memcpy(heap, tp->heap, tp->hsize*sizeof(top_heap_t));
+            TRIEFREE(NULL, tp->items);
+            TRIEFREE(NULL, tp->heap);
+        }
+        tp->items = items;
+        tp->heap = heap;
+        tp->alloc = alloc;
+    }
+
+    tp->items[tp->count].nd = nd;
+    tp->items[tp->count].parent = parent;
+    tp->items[tp->count].size = size;
+    tp->items[tp->count].is_key = is_key;
+    e.w = w;
+    e.item = tp->count++;
+
+    // sift up
+    i = tp->hsize++;
+    while(i > 0 && TOP_BEFORE(e, tp->heap[(i-1)/2])) {
+        tp->heap[i] = tp->heap[(i-1)/2];
+        i = (i-1)/2;
+    }
+    tp->heap[i] = e;
+
+    return 1;
+}
+
+unsigned long _top_pop(top_t *tp)
+{
+    top_heap_t e;
+    unsigned long i, c, r;
+
+    r = tp->heap[0].item;
+    e = tp->heap[--tp->hsize];
+
+    // sift down
+    i = 0;
+    while((c = 2*i+1) < tp->hsize) {
+        if (c+1 < tp->hsize && TOP_BEFORE(tp->heap[c+1], tp->heap[c])) {
+            c++;
+        }
+        if (!TOP_BEFORE(tp->heap[c], e)) {
+            break;
+        }
+        tp->heap[i] = tp->heap[c];
+        i = c;
+    }
+    tp->heap[i] = e;
+
+    return r;
+}
+
+// Enumerates the k heaviest keys starting with key, heaviest first. Only the
+// subtrees that may hold one of them are visited. (See Note 6)
+void trie_top_suffixes(trie_t *t, trie_key_t *key, unsigned long k, 
+    trie_enum_cbk_t cbk, void* cbk_arg)
+{
+    top_t tp;
+    top_item_t *it;
+    trie_key_t *kp;
+    trie_node_t *prefix, *c;
+    unsigned long i, j, pending, height;
+    TRIE_WEIGHT w;
+
+    pending = 0;
+    prefix = _trie_walk(t, t->root, &pending, key);
+    if (!prefix || !k || 
+        _node_get_max_weight(t, prefix) == TRIE_WEIGHT_NONE) {
+        return;
+    }
+
+    // no key is longer than height. Longer keys might be added while we are
+    // enumerating without a lock, they are skipped. (See Note 7)
+    height = t->height;
+    if (height < key->size + pending) {
+        height = key->size + pending;
+    }
+    kp = KEYCREATE(NULL, height, sizeof(TRIE_CHAR));
+    if (!kp) {
+        return;
+    }
+    KEYCPY(kp, key, 0, 0, key->size);
+    kp->size = key->size;
+    _key_write_pending(t, kp, prefix, pending);
+
+    memset(&tp, 0, sizeof(top_t));
+    if (!_top_push(&tp, prefix, 0, kp->size, 0, 
+        _node_get_max_weight(t, prefix))) {
+        goto out;
+    }
+
+    while(k && tp.hsize) {
+        i = _top_pop(&tp);
+        it = &tp.items[i];
+        if (it->is_key) {
+            // write the edges up to the prefix, which is item 0.
+            kp->size = tp.items[it->parent].size;
+            for (j=it->parent;j;j=tp.items[j].parent) {
+                _key_write_edge(t, kp, tp.items[j].size-EDGE_SIZE(t, 
+                    tp.items[j].nd), tp.items[j].nd);
+            }
+            // edges are written bottom-up
+            _key_max_update(kp, tp.items[0].size, kp->size);
+            cbk(kp, cbk_arg);
+            k--;
+            continue;
+        }
+
+        if (it->nd->value) {
+            if (!_top_push(&tp, it->nd, i, it->size, 1, 
+                _node_get_weight(t, it->nd))) {
+                goto out;
+            }
+        }
+        for (c=_node_children(t, tp.items[i].nd);c;c=_node_next(t, c)) {
+            w = _node_get_max_weight(t, c);
+            if (w == TRIE_WEIGHT_NONE || 
+                tp.items[i].size+EDGE_SIZE(t, c) > height) {
+                continue;
+            }
+            if (!_top_push(&tp, c, i, tp.items[i].size+EDGE_SIZE(t, c), 0, w)) {
+                goto out;
+            }
+        }
+    }
+
+out:
+    if (tp.items) {
+        TRIEFREE(NULL, tp.items);
+        TRIEFREE(NULL, tp.heap);
+    }
+    KEYFREE(NULL, kp);
+}
+
 void trie_prefixes(trie_t *t, trie_key_t *key, unsigned long max_depth, 
     trie_enum_cbk_t cbk, void* cbk_arg)
 {
     trie_key_t *kp;
-    trie_key_t k;
     trie_node_t *p;
-    unsigned long i;
+    unsigned long i, pending;
     TRIE_CHAR ch;
 
     if (key->size == 0) {
@@ -669,7 +3800,7 @@ void trie_prefixes(trie_t *t, trie_key_t *key, unsigned long max_depth,
     }
 
     // alloc a key that can hold the key itself
-    kp = KEYCREATE(t, (key->size), sizeof(TRIE_CHAR));
+    kp = KEYCREATE(NULL, (key->size), sizeof(TRIE_CHAR));
     if (!kp) {
         return;
     }
@@ -677,6 +3808,7 @@ void trie_prefixes(trie_t *t, trie_key_t *key, unsigned long max_depth,
     kp->size = 1; // start from first character 
 
     p = t->root;
+    pending = 0;
     for(i=0;i<key->size;i++)
     {
         if (i == max_depth) {
@@ -684,19 +3816,18 @@ void trie_prefixes(trie_t *t, trie_key_t *key, unsigned long max_depth,
         }
 
         KEY_CHAR_READ(kp, i, &ch);
-        k.s = (char *)&ch; k.size = 1; k.char_size = kp->char_size;
-        p = _trie_prefix(p, &k);
+        p = _trie_step(t, p, &pending, ch);
         if (!p) {
             break;
         }
-        if(p->value)
+        if(!pending && p->value)
         {
             cbk(kp, cbk_arg);
         }
         kp->size++;
     }
 
-    KEYFREE(t, kp);
+    KEYFREE(NULL, kp);
     
     return;
 }
@@ -705,7 +3836,7 @@ iter_t *trie_iterprefixes_init(trie_t *t, trie_key_t *key, unsigned long max_dep
 {
     iter_t *iter;
     trie_node_t *prefix;
-    unsigned long real_size;
+    unsigned long real_size, pending;
 
     if (key->size == 0) {
         return NULL;
@@ -714,7 +3845,8 @@ iter_t *trie_iterprefixes_init(trie_t *t, trie_key_t *key, unsigned long max_dep
     // search first char
     real_size = key->size;
     key->size = 1;
-    prefix = _trie_prefix(t->root, key);
+    pending = 0;
+    prefix = _trie_walk(t, t->root, &pending, key);
     if (!prefix) {
         return NULL;
     }
@@ -739,6 +3871,7 @@ iter_t *trie_iterprefixes_reset(iter_t *iter)
 {
     iter_pos_t ipos;
     trie_node_t *prefix;
+    unsigned long pending;
 
     // pop all elems first
     while(POPI(iter->stack0))
@@ -746,7 +3879,9 @@ iter_t *trie_iterprefixes_reset(iter_t *iter)
 
     // search first char
     iter->key->size = 1;
-    prefix = _trie_prefix(iter->trie->root, iter->key);
+    pending = 0;
+    prefix = _trie_walk(iter->trie, iter->trie->root, &pending, 
+        iter->key);
     if (!prefix) {
         return NULL;
     }
@@ -756,6 +3891,7 @@ iter_t *trie_iterprefixes_reset(iter_t *iter)
 
     // push the first iter_pos
     ipos.iptr = prefix;
+    ipos.pending = pending;
     ipos.op.index = 1;
     ipos.pos = 0;
     PUSHI(iter->stack0, &ipos);
@@ -765,7 +3901,7 @@ iter_t *trie_iterprefixes_reset(iter_t *iter)
     iter->last = 0;
     iter->fail = 0;
     iter->fail_reason = UNDEFINED;
-    iter->trie->dirty = 0;
+    iter->version = iter->trie->version;
 
     return iter;
 }
@@ -773,14 +3909,14 @@ iter_t *trie_iterprefixes_reset(iter_t *iter)
 iter_t *trie_iterprefixes_next(iter_t *iter)
 {
     iter_pos_t *ip;
-    trie_key_t k;
     trie_node_t *p;
+    unsigned long pending;
     TRIE_CHAR ch;
 
     while(1)
     {
         // trie changed during iteration?
-        if (iter->trie->dirty) {
+        if (iter->version != iter->trie->version) {
             iter->fail = 1;
             iter->fail_reason = CHG_WHILE_ITER;
             break;
@@ -800,456 +3936,809 @@ iter_t *trie_iterprefixes_next(iter_t *iter)
             iter->first = 0;
         }
 
-        // read and increment index+iptr
-        if (ip->op.index > iter->key->size) {
-            iter->last = 1;
-            break;
+        // read and increment index+iptr
+        if (ip->op.index > iter->key->size) {
+            iter->last = 1;
+            break;
+        }
+
+        if (ip->pos == 0 && !ip->pending && ip->iptr->value)
+        {
+            ip->pos = 1;
+            iter->value = ip->iptr->value;
+            iter->key->size = ip->op.index;
+            PUSHI(iter->stack0, ip);
+            break;
+        }
+
+        if (ip->op.index < iter->key->size) {
+            KEY_CHAR_READ(iter->key, ip->op.index, &ch);
+
+            pending = ip->pending;
+            p = _trie_step(iter->trie, ip->iptr, &pending, ch);
+            if (p) {
+                
+                ip->op.index++;
+                ip->iptr = p;
+                ip->pending = pending;
+                ip->pos = 0;
+                PUSHI(iter->stack0, ip);
+            }
+        }
+    }
+
+    return iter;
+}
+
+// distance of the first d chars of the path to the whole query.
+#define DL_DIST(dl, d) ((dl)->rows[(d)*((dl)->size+1) + (dl)->size])
+
+// Computes row d for the path whose d'th char is ch. Rows before d shall be 
+// computed for the same path. Returns the minimum of the row. 
+// This is the Lowrance-Wagner recurrence, so unlike the restricted (optimal 
+// string alignment) distance, chars may be edited after being transposed.
+unsigned long _dl_row(trie_dl_t *dl, unsigned long d, TRIE_CHAR ch)
+{
+    unsigned long *row, *prev, *last, *plast;
+    unsigned long j, n, db, i1, v, w, min;
+
+    n = dl->size;
+    row = &dl->rows[d*(n+1)];
+    prev = row - (n+1);
+    last = &dl->last[d*(n+1)];
+    plast = last - (n+1);
+
+    row[0] = min = d;
+    last[0] = 0;
+    db = 0; // last column of this row whose query char is ch
+    for (j=1;j<=n;j++) {
+        v = prev[j-1] + (ch != dl->query[j-1]); // change
+        w = row[j-1] + 1; // insert
+        if (w < v) {
+            v = w;
+        }
+        w = prev[j] + 1; // delete
+        if (w < v) {
+            v = w;
+        }
+        i1 = plast[j];
+        if (i1 && db) { // transpose, the chars in between are inserted/deleted
+            w = dl->rows[(i1-1)*(n+1) + db-1] + (d-i1-1) + 1 + (j-db-1);
+            if (w < v) {
+                v = w;
+            }
+        }
+
+        if (ch == dl->query[j-1]) {
+            db = j;
+            last[j] = d;
+        } else {
+            last[j] = plast[j];
+        }
+        row[j] = v;
+        if (v < min) {
+            min = v;
+        }
+    }
+
+    return min;
+}
+
+// Computes the rows of p's edge which starts after index chars. Returns 0 if
+// the edge goes farther than max_dist.
+int _dl_edge(trie_t *t, trie_dl_t *dl, unsigned long index, trie_node_t *p)
+{
+    trie_tail_t *tl;
+    unsigned long i;
+
+    TRIE_COUNTER_INC(dl_edges);
+    if (_dl_row(dl, index+1, p->key) > dl->max_dist) {
+        return 0;
+    }
+    tl = _node_tail(t, p);
+    if (tl) {
+        for (i=0;i<tl->size;i++) {
+            if (_dl_row(dl, index+2+i, tl->s[i]) > dl->max_dist) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// key holds the path to p, which is index chars long.
+void _corrections(trie_t *t, trie_dl_t *dl, trie_node_t *p, trie_key_t *key, 
+    unsigned long index, trie_dist_cbk_t cbk, void* cbk_arg)
+{
+    p = _node_children(t, p);
+    while(p) {
+        if (index+EDGE_SIZE(t, p) <= key->alloc_size && 
+            _dl_edge(t, dl, index, p)) {
+            key->size = _key_write_edge(t, key, index, p);
+            if (p->value && DL_DIST(dl, key->size) <= dl->max_dist) {
+                cbk(key, DL_DIST(dl, key->size), cbk_arg);
+            }
+
+            _corrections(t, dl, p, key, key->size, cbk, cbk_arg);
+        }
+
+        p = _node_next(t, p);
+    }
+}
+
+// Enumerates the keys whose Damerau-Levenshtein distance to key is at most 
+// max_depth, every key once along with its distance.
+void trie_corrections(trie_t *t, trie_key_t *key, unsigned long max_depth,
+    trie_dist_cbk_t cbk, void* cbk_arg)
+{
+    trie_key_t *kp;
+    trie_dl_t *dl;
+
+    // alloc a key that can hold size + max_depth chars.
+    kp = KEYCREATE(NULL, (key->size + max_depth), sizeof(TRIE_CHAR));
+    if (!kp) {
+        return;
+    }
+    dl = DLCREATE(NULL, key, max_depth);
+    if (!dl) {
+        KEYFREE(NULL, kp);
+        return;
+    }
+
+    kp->size = 0;
+    if (t->root->value && DL_DIST(dl, 0) <= max_depth) {
+        cbk(kp, DL_DIST(dl, 0), cbk_arg);
+    }
+    _corrections(t, dl, t->root, kp, 0, cbk, cbk_arg);
+
+    DLFREE(NULL, dl);
+    KEYFREE(NULL, kp);
+}
+
+iter_t *trie_itercorrections_init(trie_t *t, trie_key_t *key, unsigned long max_depth)
+{
+    iter_t *iter;
+
+    // a stack level for every char of the longest path.
+    iter = ITERATORCREATE(t, key, max_depth, (key->size + max_depth), 
+        (key->size + max_depth + 1), 0);
+    if (!iter) {
+        return NULL;
+    }
+    iter->dl = DLCREATE(t, key, max_depth);
+    if (!iter->dl) {
+        ITERATORFREE(t, iter);
+        return NULL;
+    }
+    trie_itercorrections_reset(iter);
+
+    return iter;
+}
+
+void trie_itercorrections_deinit(iter_t *iter)
+{
+    iterator_deinit(iter);
+}
+
+iter_t *trie_itercorrections_reset(iter_t *iter)
+{
+    iter_pos_t ipos;
+
+    // pop all elems first
+    while(POPI(iter->stack0))
+        ;
+
+    // the path starts from root, rows before the current path are kept in dl.
+    iter->key->size = 0;
+    ipos.iptr = iter->trie->root;
+    ipos.pos = 0;
+    ipos.op.index = 0;
+    PUSHI(iter->stack0, &ipos);
+
+    iter->first = 1;
+    iter->last = 0;
+    iter->fail = 0;
+    iter->fail_reason = UNDEFINED;
+    iter->version = iter->trie->version;
+
+    return iter;
+}
+
+// Same walk as _corrections(), every stack level holds the child that is being
+// visited and the path size before its edge.
+iter_t *trie_itercorrections_next(iter_t *iter)
+{
+    iter_pos_t *ip;
+    iter_pos_t ipos;
+    trie_dl_t *dl;
+    trie_node_t *p;
+    int found;
+
+    dl = iter->dl;
+    found = 0;
+    while(1)
+    {
+        // found a candidate?
+        if (found) {
+            break;
+        }
+
+        // trie changed during iteration?
+        if (iter->version != iter->trie->version) {
+            iter->fail = 1;
+            iter->fail_reason = CHG_WHILE_ITER;
+            break;
+        }
+
+        ip = PEEKI(iter->stack0);
+        if (!ip) { // no elem in stack0
+            iter->last = 1;
+            break;
+        }
+
+        // root is the empty key
+        if (iter->first) {
+            iter->first = 0;
+            p = ip->iptr;
+            ip->iptr = _node_children(iter->trie, p);
+            if (p->value && DL_DIST(dl, 0) <= dl->max_dist) {
+                iter->value = p->value;
+                iter->key->size = 0;
+                break;
+            }
+        }
+
+        p = ip->iptr;
+        if (!p) {
+            POPI(iter->stack0);
+            continue;
         }
 
-        if (ip->pos == 0 && ip->iptr->value)
-        {
+        if (ip->pos == 0) {
             ip->pos = 1;
-            iter->key->size = ip->op.index;
-            PUSHI(iter->stack0, ip);
-            break;
-        }
-
-        if (ip->op.index < iter->key->size) {
-            KEY_CHAR_READ(iter->key, ip->op.index, &ch);
-
-            k.s = (char *)&ch; k.size = 1; k.char_size = iter->key->char_size;
-            p = _trie_prefix(ip->iptr, &k);
-            if (p) {
-                
-                ip->op.index++;
-                ip->iptr = p;
-                ip->pos = 0;
-                PUSHI(iter->stack0, ip);
+            if (ip->op.index+EDGE_SIZE(iter->trie, p) <= iter->key->alloc_size
+                && _dl_edge(iter->trie, dl, ip->op.index, p)) {
+                iter->key->size = _key_write_edge(iter->trie, iter->key, 
+                    ip->op.index, p);
+                if (p->value && DL_DIST(dl, iter->key->size) <= dl->max_dist) {
+                    iter->value = p->value;
+                    found = 1;
+                }
+                if (p->children) {
+                    ipos.iptr = _node_children(iter->trie, p);
+                    ipos.op.index = iter->key->size;
+                    ipos.pos = 0;
+                    PUSHI(iter->stack0, &ipos);
+                }
+                continue;
             }
         }
+
+        // done with p and its children, visit the next sibling.
+        ip->iptr = _node_next(iter->trie, p);
+        ip->pos = 0;
     }
 
     return iter;
 }
 
-void _do(trie_key_t *key, iter_op_t *op)
+// Frozen tries (See trie_fheader_t)
+
+typedef struct frozen_pos_s {
+    trie_node_t *nd;
+    unsigned long pending; // unmatched tail chars of nd (see Note 5)
+} frozen_pos_t;
+
+// Count of frozen nodes below p, every edge char is a node. Subtrees with no
+// keys, left by lazy deletes, are not saved. (See Note 10)
+unsigned long _frozen_node_count(trie_t *t, trie_node_t *p)
 {
-    unsigned long ki,kchsize;
-    TRIE_CHAR ch1,ch2;
- 
-    // init. common used vars
-    ki = op->index;
-    kchsize = key->char_size;
+    trie_node_t *c;
+    unsigned long count;
 
-    switch(op->type)
-    {
-    case DELETE:
-        _DPRINT("DO DELETE\n");
-        ki = op->auxindex;
-        KEY_CHAR_READ(key, ki, &op->dch);
-        key->size -= 1;
-        memmove(&key->s[(ki)*kchsize], &key->s[(ki+1) * kchsize], 
-            (key->size-ki)*kchsize);
-        break;
-    case TRANSPOSE:
-        _DPRINT("DO TRANSPOSE\n");
-        KEY_CHAR_READ(key, ki, &ch1);
-        KEY_CHAR_READ(key, ki+1, &ch2);
-        KEY_CHAR_WRITE(key, ki, ch2);
-        KEY_CHAR_WRITE(key, ki+1, ch1);
-        break;
-    case INSERT:
-        _DPRINT("DO INSERT\n");
-        key->size += 1;
-        memmove(&key->s[(ki+1) * kchsize], &key->s[(ki)*kchsize], 
-            (key->size-ki-1)*key->char_size);
-        KEY_CHAR_WRITE(key, ki, op->ich);
-        break;
-    case CHANGE:
-        _DPRINT("DO CHANGE\n");
-        KEY_CHAR_READ(key, ki, &op->dch);
-        KEY_CHAR_WRITE(key, ki, op->ich);
-        break;
-    case INDEXCHG:
-        break; // do nothing
-    default:
-        assert(0 == 1); // unsupported operation
-        break;
-    }
-}
-
-void _undo(trie_key_t *key, iter_op_t *op)
-{
-    unsigned long ki,kchsize;
-    TRIE_CHAR ch1,ch2;
-
-    // init. common used vars
-    ki = op->index;
-    kchsize = key->char_size;
-    
-    switch(op->type)
-    {
-    case DELETE:
-        _DPRINT("UNDO DELETE\n");
-        ki = op->auxindex;
-        key->size += 1;
-        memmove(&key->s[(ki+1) * kchsize], &key->s[(ki)*kchsize], 
-            (key->size-ki)*key->char_size);
-        KEY_CHAR_WRITE(key, ki, op->dch);
-        break;
-    case TRANSPOSE:
-        _DPRINT("UNDO TRANSPOSE\n");
-        KEY_CHAR_READ(key, ki, &ch1);
-        KEY_CHAR_READ(key, ki+1, &ch2);
-        KEY_CHAR_WRITE(key, ki, ch2);
-        KEY_CHAR_WRITE(key, ki+1, ch1);
-        break;
-    case INSERT:
-        _DPRINT("UNDO INSERT\n");
-        key->size -= 1;
-        memmove(&key->s[(ki)*kchsize], &key->s[(ki+1) * kchsize], 
-            (key->size-ki)*kchsize);
-        break;
-    case CHANGE:
-        _DPRINT("UNDO CHANGE\n");
-        KEY_CHAR_WRITE(key, ki, op->dch);
-        break;
-    case INDEXCHG:
-        break; // do nothing
-    default:
-        assert(0 == 1); // unsupported operation
-        break;
-    }
-}
-
-void _corrections(trie_t * t, trie_node_t *pprefix, trie_key_t *key, 
-    unsigned long c_index, unsigned long c_depth, trie_enum_cbk_t cbk, void* cbk_arg)
-{
-    unsigned long ksize,kchsize;
-    trie_key_t pk;
-    trie_node_t *prefix,*p;
-    TRIE_CHAR ch;
-    iter_op_t op;
+    count = 0;
+    for (c=_node_children(t, p);c;c=_node_next(t, c)) {
+        if (c->count) {
+            count += EDGE_SIZE(t, c) + _frozen_node_count(t, c);
+        }
+    }
+    return count;
+}
 
-    // search prefix
-    prefix = pprefix;
-    if (c_index > 0) {
-        if (c_index-1 >= key->size) {
-            return;
+// Lays out the nodes breadth-first, so children of a node are adjacent. 
+// Children lists of t are sorted already, so are the frozen ones. pos[i] is 
+// the position in t that fnodes[i] is created from.
+int _frozen_layout(trie_t *t, trie_fnode_t *fnodes, frozen_pos_t *pos, 
+    unsigned long count)
+{
+    unsigned long i, j, n;
+    uint32_t vid;
+    trie_node_t *c;
+    trie_tail_t *tl;
+    frozen_pos_t *p;
+
+    pos[0].nd = t->root;
+    pos[0].pending = 0;
+    fnodes[0].key = 0;
+    n = 1;
+    vid = 0;
+    for (i=0;i<n;i++) {
+        p = &pos[i];
+        fnodes[i].value = 0;
+        if (!p->pending && p->nd->value) {
+            fnodes[i].value = ++vid;
         }
-        KEY_CHAR_READ(key, c_index-1, &ch);
-        pk.s = (char *)&ch; pk.size = 1; pk.char_size = key->char_size;
-        prefix = _trie_prefix(pprefix, &pk);
-        if (!prefix) {
-            return;
+        fnodes[i].children = (uint32_t)n;
+        if (p->pending) {
+            if (n == count) {
+                return 0;
+            }
+            pos[n].nd = p->nd;
+            pos[n].pending = p->pending - 1;
+            tl = _node_tail(t, p->nd);
+            fnodes[n].key = tl->s[tl->size - p->pending];
+            n++;
+        } else {
+            for (c=_node_children(t, p->nd);c;c=_node_next(t, c)) {
+                if (!c->count) {
+                    continue;
+                }
+                if (n == count) {
+                    return 0;
+                }
+                pos[n].nd = c;
+                pos[n].pending = EDGE_SIZE(t, c) - 1;
+                n++;
+            }
+            for (j=fnodes[i].children;j<n;j++) {
+                fnodes[j].key = pos[j].nd->key;
+            }
         }
+        fnodes[i].child_count = (uint32_t)(n - fnodes[i].children);
     }
+    return n == count;
+}
 
-    // search suffix (which will complete the search for the full key)
-    ksize = key->size;
-    kchsize = key->char_size;
-    pk.s = &key->s[c_index*kchsize]; pk.size = ksize-c_index; 
-    pk.char_size = key->char_size;
-    p = _trie_prefix(prefix, &pk);
-    if (p && p->value) {
-        cbk(key, cbk_arg);
+int _frozen_write(FILE *fp, void *p, unsigned long size)
+{
+    return fwrite(p, 1, size, fp) == size;
+}
+
+// Writes t to path in frozen format. cbk writes a single value to the file and
+// returns the count of bytes written, or -1 on error.
+int trie_save(trie_t *t, const char *path, trie_value_write_cbk_t cbk)
+{
+    FILE *fp;
+    trie_fheader_t h;
+    trie_fnode_t *fnodes;
+    frozen_pos_t *pos;
+    uint64_t *offsets;
+    unsigned long i, count;
+    long size;
+    int r;
+
+    count = 1 + _frozen_node_count(t, t->root);
+    if (count > 0xFFFFFFFFUL) {
+        return 0;
+    }
+    fnodes = (trie_fnode_t *)TRIEMALLOC(t, count*sizeof(trie_fnode_t));
+    pos = (frozen_pos_t *)TRIEMALLOC(t, count*sizeof(frozen_pos_t));
+    offsets = (uint64_t *)TRIEMALLOC(t, (t->item_count+1)*sizeof(uint64_t));
+    fp = NULL;
+    r = 0;
+    if (!fnodes || !pos || !offsets) {
+        goto out;
+    }
+    if (!_frozen_layout(t, fnodes, pos, count)) {
+        goto out;
     }
 
-    // check bounds/depth
-    if ((c_index > ksize) || (c_depth == 0)) {
-        return;
+    fp = fopen(path, "wb");
+    if (!fp) {
+        goto out;
     }
 
-    // deletion
-    if (ksize > 1 && c_index < ksize)
-    {
-        op.type = DELETE; op.index = 0; op.auxindex = c_index;
-        _do(key, &op);
+    memset(&h, 0, sizeof(trie_fheader_t));
+    memcpy(h.magic, TRIE_FROZEN_MAGIC, sizeof(h.magic));
+    h.version = TRIE_FROZEN_VERSION;
+    h.bom = TRIE_FROZEN_BOM;
+    h.char_size = sizeof(TRIE_CHAR);
+    h.node_count = count;
+    h.item_count = t->item_count;
+    h.height = t->height;
+    h.nodes = sizeof(trie_fheader_t);
+    h.data = h.nodes + count*sizeof(trie_fnode_t);
+    if (!_frozen_write(fp, &h, sizeof(trie_fheader_t)) || 
+        !_frozen_write(fp, fnodes, count*sizeof(trie_fnode_t))) {
+        goto out;
+    }
 
-        _corrections(t, t->root, key, 0, c_depth-1, cbk, cbk_arg);
+    // values are written in the order of their indexes.
+    offsets[0] = 0;
+    for (i=0;i<count;i++) {
+        if (fnodes[i].value) {
+            size = cbk(pos[i].nd->value, fp);
+            if (size < 0) {
+                goto out;
+            }
+            offsets[fnodes[i].value] = offsets[fnodes[i].value-1] + size;
+        }
+    }
 
-        _undo(key, &op);
+    // offsets table is 8-byte aligned.
+    h.offsets = h.data + offsets[t->item_count];
+    while(h.offsets % sizeof(uint64_t)) {
+        if (fputc(0, fp) == EOF) {
+            goto out;
+        }
+        h.offsets++;
+    }
+    if (!_frozen_write(fp, offsets, (t->item_count+1)*sizeof(uint64_t))) {
+        goto out;
     }
+    if (fseek(fp, 0, SEEK_SET) || !_frozen_write(fp, &h, sizeof(trie_fheader_t))) {
+        goto out;
+    }
+    r = 1;
 
-    // transposition (prefix + suffix[1] + suffix[0] + suffix[2:])
-    if (ksize != 0 && c_index < ksize-1) 
-    {
-        op.type = TRANSPOSE; op.index = c_index;
-        _do(key, &op);
+out:
+    if (fp && fclose(fp)) {
+        r = 0;
+    }
+    if (fp && !r) {
+        remove(path);
+    }
+    if (fnodes) {
+        TRIEFREE(t, fnodes);
+    }
+    if (pos) {
+        TRIEFREE(t, pos);
+    }
+    if (offsets) {
+        TRIEFREE(t, offsets);
+    }
+    return r;
+}
 
-        _corrections(t, pprefix, key, c_index, c_depth-1, cbk, cbk_arg);
+// 1 if the nodes and the value offsets of f are laid out as trie_save() 
+// writes them, so that reading f never leaves the mapping: children of the 
+// nodes follow each other in node order, each list after its parent, and no
+// node is deeper than the height. Values are indexes into the offsets table, 
+// and offsets grow within the value data.
+// Complexity: O(n)
+int _frozen_valid(trie_frozen_t *f)
+{
+    trie_fheader_t *h;
+    trie_fnode_t *nd;
+    uint64_t i, next, level_end, depth, data_size;
+
+    h = f->header;
+    next = 1;
+    level_end = 1;
+    depth = 0;
+    for (i=0;i<h->node_count;i++) {
+        if (i == level_end) {
+            depth++;
+            level_end = next;
+        }
+        nd = &f->nodes[i];
+        if (nd->children != next || next <= i || 
+            nd->child_count > h->node_count - next || 
+            nd->value > h->item_count) {
+            return 0;
+        }
+        next += nd->child_count;
+    }
+    if (next != h->node_count || depth > h->height) {
+        return 0;
+    }
 
-        _undo(key, &op);
+    data_size = h->offsets - h->data;
+    if (f->offsets[0] != 0) {
+        return 0;
+    }
+    for (i=1;i<=h->item_count;i++) {
+        if (f->offsets[i] < f->offsets[i-1] || f->offsets[i] > data_size) {
+            return 0;
+        }
     }
+    return 1;
+}
 
-    // insertion (prefix + x + suffix[:])
-    p = prefix->children;
-    while(p)
-    {
-        op.type = INSERT; op.index = c_index; op.ich = p->key;
-        _do(key, &op);
+// Maps the file and checks if the sections are inside it. Then every node and
+// value offset is validated once (See _frozen_valid), a corrupt or truncated 
+// file is not opened.
+trie_frozen_t *trie_frozen_open(const char *path)
+{
+    trie_frozen_t *f;
+    trie_fheader_t *h;
+    char *map;
+    size_t size;
+#ifdef __WINDOWS
+    HANDLE fh, mh;
+    LARGE_INTEGER fsize;
+
+    fh = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fh == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    // unsigned long is 32 bits on Windows, size_t holds any size that can be
+    // mapped.
+    if (!GetFileSizeEx(fh, &fsize) || fsize.QuadPart < sizeof(trie_fheader_t) || 
+        (uint64_t)fsize.QuadPart > (size_t)-1) {
+        CloseHandle(fh);
+        return NULL;
+    }
+    size = (size_t)fsize.QuadPart;
+    mh = CreateFileMapping(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(fh);
+    if (!mh) {
+        return NULL;
+    }
+    map = (char *)MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mh); // the view keeps the mapping alive
+    if (!map) {
+        return NULL;
+    }
+#else
+    int fd;
+    struct stat st;
 
-        _corrections(t, pprefix, key, c_index, c_depth-1, cbk, cbk_arg);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) || st.st_size < (off_t)sizeof(trie_fheader_t) || 
+        (uint64_t)st.st_size > (size_t)-1) {
+        close(fd);
+        return NULL;
+    }
+    size = (size_t)st.st_size;
+    map = (char *)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+#endif
 
-        _undo(key, &op);
+    // counts are checked against the size first, so the offsets below do 
+    // not overflow.
+    h = (trie_fheader_t *)map;
+    if (memcmp(h->magic, TRIE_FROZEN_MAGIC, sizeof(h->magic)) || 
+        h->version != TRIE_FROZEN_VERSION || h->bom != TRIE_FROZEN_BOM || 
+        h->char_size != sizeof(TRIE_CHAR) || h->node_count == 0 ||
+        h->node_count > 0xFFFFFFFFUL || h->item_count > 0xFFFFFFFFUL ||
+        h->node_count > size / sizeof(trie_fnode_t) || 
+        h->item_count >= size / sizeof(uint64_t) ||
+        h->nodes != sizeof(trie_fheader_t) || 
+        h->data != h->nodes + h->node_count*sizeof(trie_fnode_t) || 
+        h->offsets < h->data || h->offsets % sizeof(uint64_t) ||
+        h->offsets + (h->item_count+1)*sizeof(uint64_t) != size) {
+        goto err;
+    }
 
-        p = p->next;
+    f = (trie_frozen_t *)TRIEMALLOC(NULL, sizeof(trie_frozen_t));
+    if (!f) {
+        goto err;
+    }
+    f->map = map;
+    f->map_size = size;
+    f->header = h;
+    f->nodes = (trie_fnode_t *)(map + h->nodes);
+    f->data = map + h->data;
+    f->offsets = (uint64_t *)(map + h->offsets);
+    if (!_frozen_valid(f)) {
+        TRIEFREE(NULL, f);
+        goto err;
     }
 
-    // change (prefix + x + suffix[1:])
-    if (c_index < ksize)
-    {
-        p = prefix->children;
-        while(p) 
-        {
-            op.type = CHANGE; op.index = c_index; op.ich = p->key;
-            _do(key, &op);
+    return f;
 
-            _corrections(t, pprefix, key, c_index, c_depth-1, cbk, cbk_arg);
+err:
+#ifdef __WINDOWS
+    UnmapViewOfFile(map);
+#else
+    munmap(map, size);
+#endif
+    return NULL;
+}
 
-            _undo(key, &op);
+void trie_frozen_close(trie_frozen_t *f)
+{
+#ifdef __WINDOWS
+    UnmapViewOfFile(f->map);
+#else
+    munmap(f->map, f->map_size);
+#endif
+    TRIEFREE(NULL, f);
+}
 
-            p = p->next;
+// binary search in the children of p.
+trie_fnode_t *_frozen_child(trie_frozen_t *f, trie_fnode_t *p, TRIE_CHAR ch)
+{
+    trie_fnode_t *c;
+    uint32_t lo, hi, mid;
+
+    c = &f->nodes[p->children];
+    lo = 0;
+    hi = p->child_count;
+    while(lo < hi) {
+        mid = lo + (hi-lo)/2;
+        if (c[mid].key == ch) {
+            return &c[mid];
+        }
+        if (c[mid].key < ch) {
+            lo = mid+1;
+        } else {
+            hi = mid;
         }
     }
-
-    _corrections(t, prefix, key, c_index+1, c_depth, cbk, cbk_arg);
+    return NULL;
 }
 
-void trie_corrections(trie_t *t, trie_key_t *key, unsigned long max_depth,
-    trie_enum_cbk_t cbk, void* cbk_arg)
+trie_fnode_t *_frozen_prefix(trie_frozen_t *f, trie_fnode_t *p, 
+    trie_key_t *key)
 {
-    trie_key_t *kp;
+    unsigned long i;
+    TRIE_CHAR ch;
 
-    // alloc a key that can hold size + max_depth chars.
-    kp = KEYCREATE(t, (key->size + max_depth), sizeof(TRIE_CHAR));
-    if (!kp) {
-        return;
+    for (i=0;i<key->size && p;i++) {
+        KEY_CHAR_READ(key, i, &ch);
+        p = _frozen_child(f, p, ch);
     }
-    KEYCPY(kp, key, 0, 0, key->size);
-    kp->size = key->size;
-    
-    _corrections(t, t->root, kp, 0, max_depth, cbk, cbk_arg);
-
-    KEYFREE(t, kp);
+    return p;
 }
 
-iter_t *trie_itercorrections_init(trie_t *t, trie_key_t *key, unsigned long max_depth)
+trie_fnode_t *trie_frozen_search(trie_frozen_t *f, trie_key_t *key)
 {
-    iter_t *iter;
+    trie_fnode_t *r;
 
-    iter = ITERATORCREATE(t, key, max_depth, (key->size + max_depth), max_depth+1,
-        max_depth);
-    if (!iter) {
+    r = _frozen_prefix(f, f->nodes, key);
+    if (r && !r->value) {
         return NULL;
     }
-    trie_itercorrections_reset(iter);
-
-    return iter;
+    return r;
 }
 
-void trie_itercorrections_deinit(iter_t *iter)
+// Returns the serialized value of nd which is in the mapping.
+char *trie_frozen_value(trie_frozen_t *f, trie_fnode_t *nd, unsigned long *size)
 {
-    iterator_deinit(iter);
+    *size = (unsigned long)(f->offsets[nd->value] - f->offsets[nd->value-1]);
+    return f->data + f->offsets[nd->value-1];
 }
 
-iter_t *trie_itercorrections_reset(iter_t *iter)
+void _frozen_suffixes(trie_frozen_t *f, trie_fnode_t *p, trie_key_t *key, 
+    unsigned long index, trie_enum_cbk_t cbk, void* cbk_arg)
 {
-    iter_pos_t ipos;
+    uint32_t i;
+    trie_fnode_t *c;
 
-    // clear stacks
-    while(POPI(iter->stack0))
-        ;
-    while(POPI(iter->stack1))
-        ;
+    if (p->value) {
+        cbk(key, cbk_arg);
+    }
 
-    // alloc the first iter_pos
-    ipos.pos = 0; ipos.op.type = INDEXCHG; ipos.op.index = 0; 
-    ipos.op.depth = iter->max_depth; ipos.iptr = NULL;
-    ipos.prefix = iter->trie->root;
+    if (index == key->alloc_size) {
+        return;
+    }
+    c = &f->nodes[p->children];
+    for (i=0;i<p->child_count;i++) {
+        KEY_CHAR_WRITE(key, index, c[i].key);
+        key->size = index+1;
 
-    PUSHI(iter->stack0, &ipos);
-    PUSHI(iter->stack1, &ipos);
+        _frozen_suffixes(f, &c[i], key, index+1, cbk, cbk_arg);
+    }
+}
 
-    iter->first = 1;
-    iter->last = 0;
-    iter->fail = 0;
-    iter->fail_reason = UNDEFINED;
-    iter->trie->dirty = 0;
-    iter->keylen_reached = 0;
-    iter->depth_reached = 0;
+void trie_frozen_suffixes(trie_frozen_t *f, trie_key_t *key, 
+    unsigned long max_depth, trie_enum_cbk_t cbk, void* cbk_arg)
+{
+    trie_key_t *kp;
+    trie_fnode_t *prefix;
 
-    return iter;
+    prefix = _frozen_prefix(f, f->nodes, key);
+    if (!prefix) {
+        return;
+    }
+
+    kp = KEYCREATE(NULL, (key->size + max_depth), sizeof(TRIE_CHAR));
+    if (!kp) {
+        return;
+    }
+    KEYCPY(kp, key, 0, 0, key->size);
+    kp->size = key->size;
+
+    _frozen_suffixes(f, prefix, kp, kp->size, cbk, cbk_arg);
+
+    KEYFREE(NULL, kp);
 }
 
-iter_t *trie_itercorrections_next(iter_t *iter)
+void trie_frozen_prefixes(trie_frozen_t *f, trie_key_t *key, 
+    unsigned long max_depth, trie_enum_cbk_t cbk, void* cbk_arg)
 {
-    trie_key_t pk;
-    iter_pos_t *ip;
-    iter_stack_t *k0,*k1;
-    trie_node_t *prefix,*p;
-    iter_pos_t ipos;
-    int found;
+    trie_key_t *kp;
+    trie_fnode_t *p;
+    unsigned long i;
     TRIE_CHAR ch;
 
-    k0 = (iter_stack_t *)iter->stack0;
-    k1 = (iter_stack_t *)iter->stack1;
-    found = 0;
-    while(1)
-    {
-        if (found)
-        {
-            return iter;
-        }
-
-        ip = PEEKI(k0);
-        if (!ip) {
-            iter->last = 1;
-            return iter;
-        }
+    if (key->size == 0) {
+        return;
+    }
 
-        // previous key changes are delayed to this iteration.
-        if (iter->depth_reached)
-        {
-            _undo(iter->key, &ip->op);
-            POPI(k0);
-            iter->depth_reached = 0;
-            continue;
-        }
+    kp = KEYCREATE(NULL, (key->size), sizeof(TRIE_CHAR));
+    if (!kp) {
+        return;
+    }
+    KEYCPY(kp, key, 0, 0, key->size);
+    kp->size = 1; // start from first character 
 
-        if (iter->keylen_reached)
-        {
-            ip = POPI(k1);
-            _undo(iter->key, &ip->op);
-            ip = POPI(k0);
-            _undo(iter->key, &ip->op);
-            iter->keylen_reached = 0; 
-            continue;
+    p = f->nodes;
+    for(i=0;i<key->size && i<max_depth;i++)
+    {
+        KEY_CHAR_READ(kp, i, &ch);
+        p = _frozen_child(f, p, ch);
+        if (!p) {
+            break;
         }
-
-        prefix = ip->prefix;
-        if (ip->op.index > 0) {
-            if (ip->op.index-1 >= iter->key->size) {
-                ip = POPI(k1);
-                _undo(iter->key, &ip->op);
-                ip = POPI(k0);
-                _undo(iter->key, &ip->op);
-                continue;
-            }
-            KEY_CHAR_READ(iter->key, ip->op.index-1, &ch);
-            pk.s = (char *)&ch; pk.size = 1; pk.char_size = iter->key->char_size;
-            prefix = _trie_prefix(ip->prefix, &pk);
-            if (!prefix) {
-                ip = POPI(k1);
-                _undo(iter->key, &ip->op);
-                ip = POPI(k0);
-                _undo(iter->key, &ip->op);
-                continue;
-            }
+        if (p->value) {
+            cbk(kp, cbk_arg);
         }
+        kp->size++;
+    }
 
-        // "only once" operations go under (pos == 0)
-        if (ip->pos == 0)
-        {
-            _do(iter->key, &ip->op); 
+    KEYFREE(NULL, kp);
+}
 
-            pk.s = &iter->key->s[ip->op.index*iter->key->char_size]; 
-            pk.size = iter->key->size-ip->op.index; 
-            pk.char_size = iter->key->char_size;
-            p = _trie_prefix(prefix, &pk);
-            if (p && p->value) {
-                found = 1;
-            }
-        }
+// Same as _corrections(), every frozen node is a single char.
+void _frozen_corrections(trie_frozen_t *f, trie_dl_t *dl, trie_fnode_t *p, 
+    trie_key_t *key, unsigned long index, trie_dist_cbk_t cbk, void* cbk_arg)
+{
+    uint32_t i;
+    trie_fnode_t *c;
 
-        if (ip->op.depth == 0)
-        {
-            iter->depth_reached = 1;
+    if (index == key->alloc_size) {
+        return;
+    }
+    c = &f->nodes[p->children];
+    for (i=0;i<p->child_count;i++) {
+        if (_dl_row(dl, index+1, c[i].key) > dl->max_dist) {
             continue;
         }
-
-        if (ip->op.index > iter->key->size)
-        {
-            iter->keylen_reached = 1;
-            continue;
+        KEY_CHAR_WRITE(key, index, c[i].key);
+        key->size = index+1;
+        if (c[i].value && DL_DIST(dl, index+1) <= dl->max_dist) {
+            cbk(key, DL_DIST(dl, index+1), cbk_arg);
         }
 
-        // hold the doed() but not undoed() non-noop operations in history stack
-        // that is processed first time.(in our current implementation we process 
-        // the same op multiple times so simply check if it was processed before.
-        if (ip->op.type != INDEXCHG && ip->pos == 0)
-        {
-            PUSHI(k1, ip);
-        }
+        _frozen_corrections(f, dl, &c[i], key, index+1, cbk, cbk_arg);
+    }
+}
 
-        if (ip->pos == 0) {
-            ip->pos = 1;
-            if (iter->key->size > 1 && ip->op.index < iter->key->size) {
-                ipos.pos = 0; ipos.op.type = DELETE; ipos.op.index = 0; 
-                ipos.op.auxindex = ip->op.index; ipos.op.depth = ip->op.depth-1; 
-                ipos.iptr = NULL; ipos.prefix = iter->trie->root;
-                PUSHI(k0, &ipos);
-                continue;
-            }
-        }
-        
-        if (ip->pos == 1) {
-            ip->pos = 2;
-            if (iter->key->size != 0 && ip->op.index+1 < iter->key->size)
-            {
-                ipos.pos = 0; ipos.op.type = TRANSPOSE; 
-                ipos.op.index = ip->op.index; ipos.op.depth = ip->op.depth-1; 
-                ipos.iptr = NULL; ipos.prefix = ip->prefix;
-                PUSHI(k0, &ipos);
-                continue;
-            }
-        }
-            
-        if (ip->pos == 2) {
-            if (!ip->iptr) {
-                ip->iptr = prefix->children;
-            } else {
-                ip->iptr = ip->iptr->next;
-            }           
-            
-            if (ip->iptr) {
-                ipos.pos = 0; ipos.op.type = INSERT; ipos.op.index = ip->op.index; 
-                ipos.op.depth = ip->op.depth-1; ipos.iptr = NULL; 
-                ipos.op.ich = ip->iptr->key; ipos.prefix = ip->prefix;
-                PUSHI(k0, &ipos);
-                continue;
-            } 
-
-            ip->pos = 3;
-        }
-        
-        if (ip->pos == 3) {
-            if (ip->op.index < iter->key->size) 
-            {
-                if (!ip->iptr) {
-                    ip->iptr = prefix->children;
-                } else {
-                    ip->iptr = ip->iptr->next;
-                }            
-                
-                if (ip->iptr) {
-                    ipos.pos = 0; ipos.op.type = CHANGE; 
-                    ipos.op.index = ip->op.index; ipos.op.depth = ip->op.depth-1; 
-                    ipos.iptr = NULL; ipos.op.ich = ip->iptr->key;
-                    ipos.prefix = ip->prefix;
-                    PUSHI(k0, &ipos);
-                    continue;
-                }
-            }
-            ip->pos = 4;
-        }
+void trie_frozen_corrections(trie_frozen_t *f, trie_key_t *key, 
+    unsigned long max_depth, trie_dist_cbk_t cbk, void* cbk_arg)
+{
+    trie_key_t *kp;
+    trie_dl_t *dl;
 
-        POPI(k0);
-        ipos.pos = 0; ipos.op.type = INDEXCHG; ipos.op.index = ip->op.index+1; 
-        ipos.op.depth = ip->op.depth; ipos.iptr = NULL;
-        ipos.prefix = prefix;
-        PUSHI(k0, &ipos);
+    // alloc a key that can hold size + max_depth chars.
+    kp = KEYCREATE(NULL, (key->size + max_depth), sizeof(TRIE_CHAR));
+    if (!kp) {
+        return;
+    }
+    dl = DLCREATE(NULL, key, max_depth);
+    if (!dl) {
+        KEYFREE(NULL, kp);
+        return;
+    }
+
+    kp->size = 0;
+    if (f->nodes[0].value && DL_DIST(dl, 0) <= max_depth) {
+        cbk(kp, DL_DIST(dl, 0), cbk_arg);
     }
+    _frozen_corrections(f, dl, f->nodes, kp, 0, cbk, cbk_arg);
+
+    DLFREE(NULL, dl);
+    KEYFREE(NULL, kp);
 }
 
 void trie_debug_print_key(trie_key_t *k)
@@ -5,6 +5,7 @@
 #include "config.h"
 #include "stdio.h"
 #include "stdlib.h"
+#include "math.h"
 
 // Note 1:
 // trie_key_t->char_size <= sizeof(TRIE_CHAR). This is the only requirement. 
@@ -35,23 +36,219 @@ typedef struct trie_key_s {
     unsigned long size; // how many characters (or code points) in encoded string
     unsigned char char_size; // character size of the encoding in bytes
     unsigned long alloc_size; // max allocated size of the string buffer. (in characters)
+    TRIE_CHAR *max_char; // max_char[i] is the max. char of s[:i+1], only kept 
+                         // for keys made by KEYCREATE. (See KEY_CHAR_WRITE)
 } trie_key_t;
 
+// Note 5:
+// A trie can be created with compressed edges. (TRIE_COMPRESSED) In that case,
+// a chain of single-child, valueless nodes is held as a single node: the 
+// first char of the chain is the node's key and the rest is its tail. A node's
+// value and children then belong to the last char of its tail. Every 
+// non-root node in a compressed trie either has a value or at least 2 
+// children. As a key may end in the middle of a tail, a position in the trie
+// is a node plus the count of its tail chars that are not matched yet. (see 
+// _trie_step) Tries that are not compressed never have tails.
+typedef struct trie_tail_s {
+    unsigned long size;
+    TRIE_CHAR s[1]; // size chars
+} trie_tail_t;
+
+// Note 6:
+// Every key has a weight, which is 0 unless it is added with 
+// trie_add_weighted(). A node also has the max. weight of the keys in its
+// subtree (including its own), or TRIE_WEIGHT_NONE if there are none. That is
+// what trie_top_suffixes() uses to visit the heaviest subtrees first. max_weight
+// may be bigger than the real max. (e.g: if an add fails halfway) but never 
+// smaller. Weights are held per slab, and only once a key is given a nonzero 
+// weight (TRIE_WEIGHTED): until then the max. of a node follows from its key 
+// count, so tries that are not weighted do not pay for them.
+#define TRIE_WEIGHT_NONE (-HUGE_VAL)
+
+// Note 11:
+// Nodes are linked by 32-bit ids instead of pointers, so that a node is 32 
+// bytes on 64-bit platforms. Nodes live in slabs (See below) and the id of a 
+// node is the index of its slab in t->slabs followed by its index in the slab,
+// id 0 is NULL. (See _node_at) Indexes and tails are not needed by most nodes,
+// they are held by a trie_ext_t that is allocated from the slabs too, on the 
+// first need of either, and freed with the node.
+// The value stays in every node rather than in a table of terminal nodes only,
+// and the node keeps its own id: readers test p->value lock-free (Note 7), and
+// the id of a node cannot be found from its address without aligning slabs to
+// a power of two. Dropping only one of the two would not shrink the node, as 
+// it is padded to 8 bytes. So a node is as big as it was when it was malloc'ed
+// one by one, and the saving is the malloc header. (mem. about -25%, not half)
 typedef struct trie_node_s {
     TRIE_CHAR key;
+    uint32_t count; // count of the keys in the subtree, including this one
     TRIE_DATA value;
-    struct trie_node_s *next;
-    struct trie_node_s *children;
+    uint32_t next;
+    uint32_t children;
+    uint32_t ext; // trie_ext_t of the node, 0 if it has neither an index nor a tail
+    uint32_t id; // id of the node itself, 0 while it is on the free-list
 } trie_node_t;
 
+typedef struct trie_ext_s {
+    struct trie_index_s *index; // NULL if children are few. (See below)
+    trie_tail_t *tail; // NULL if the edge is a single char.
+} trie_ext_t;
+
+// Children of a node are always linked via next ids in key order, which
+// is what the enumeration functions walk. (so they enumerate keys sorted, and
+// first/last/successor/predecessor are simple descents) Finding a single child on that list is linear
+// though, so nodes with many children additionally hold an index that grows
+// and shrinks with the children count (just like ART does):
+//   <= 4 children : no index, the list is walked.
+//   <= 16 children: NODE16, keys are held in an array and searched together.
+//   > 16 children : NODE48 or NODE256, chars <= 0xFF are found via a 256 
+//                   entry table. Other chars are held in a sorted array and 
+//                   binary searched.
+typedef enum trie_index_type_e {
+    NODE16 = 1,
+    NODE48,
+    NODE256,
+} trie_index_type_t;
+
+typedef struct trie_index_s {
+    trie_index_type_t type;
+    unsigned int seq; // odd while the index is being changed (See Note 7)
+    unsigned int count; // total children count of the node
+    unsigned int wcount; // children count whose char > 0xFF (NODE48/NODE256)
+    unsigned int walloc;
+    TRIE_CHAR *wkeys; // sorted
+    trie_node_t **wnodes;
+} trie_index_t;
+
+typedef struct trie_index16_s {
+    trie_index_t h;
+    TRIE_CHAR keys[16];
+    trie_node_t *nodes[16];
+} trie_index16_t;
+
+typedef struct trie_index48_s {
+    trie_index_t h;
+    unsigned char slots[256]; // 0 means empty, otherwise nodes[slot-1]
+    trie_node_t *nodes[48];
+} trie_index48_t;
+
+typedef struct trie_index256_s {
+    trie_index_t h;
+    trie_node_t *nodes[256];
+} trie_index256_t;
+
+// Weight of a node and the max. weight of its subtree. (See Note 6)
+typedef struct trie_weight_s {
+    TRIE_WEIGHT weight; // weight of the key, if there is a value
+    TRIE_WEIGHT max_weight;
+} trie_weight_t;
+
+// Nodes are not allocated one by one. Every trie owns an array of slabs, each
+// slab is a contiguous array of nodes right after its header. Freed nodes are
+// chained via their next ids to a free-list and reused by later allocations. 
+// trie_compact() releases the slabs whose nodes are all freed, the rest are 
+// released in one go when the trie is destroyed.
+#define TRIE_SLAB_SHIFT 12
+#define TRIE_SLAB_HEADER 64
+
+typedef struct trie_slab_s {
+    void *block; // the allocation the slab is aligned in
+    trie_weight_t *weights; // weights of the nodes, NULL if t is not weighted
+    unsigned char *own; // bit i is set if nodes[i] is not shared with a 
+                        // snapshot, NULL if none is. (See Note 9)
+    unsigned char *ext; // bit i is set if nodes[i] holds a trie_ext_t
+    uint32_t size; // how many nodes this slab can hold
+    uint32_t used; // how many nodes are handed out from this slab so far
+    uint32_t free; // how many of the used ones are on the free-list
+} trie_slab_t;
+
+// Adds keys one after another while remembering the nodes on the path of the
+// last key. See trie_builder_add().
+typedef struct trie_builder_s {
+    struct trie_s *t;
+    trie_node_t **path; // path[i] is the node reached by the first i chars
+    TRIE_CHAR *last; // chars of the last key
+    unsigned long size; // size of the last key, path has size+1 valid nodes
+    unsigned long alloc;
+} trie_builder_t;
+
+// Note 7:
+// Readers of an uncompressed trie may run while a single writer changes it, 
+// without locking. The writer keeps every state that readers can reach valid:
+//   - A node is linked after it is initialized, and unlinked by a single 
+//     store, so a reader on a node can always move on to its next.
+//   - Indexes are changed in place, but a reader does not trust what it finds
+//     in an index if the index's seq has changed meanwhile. It then walks the 
+//     children list. (See _trie_child)
+//   - Nodes, indexes and arrays that are unlinked are retired instead of 
+//     freed: readers enter the current epoch by trie_read_begin(), and things 
+//     retired in an epoch are freed once no reader of that epoch or an earlier 
+//     one is left. The writer moves to the next epoch when the readers of the
+//     previous one are done. (See _trie_reclaim)
+// Compressed tries split and merge nodes in place, so their readers need to be
+// excluded from the writer by the caller.
+typedef enum trie_limbo_kind_e {
+    LIMBO_NODE = 1,
+    LIMBO_INDEX,
+    LIMBO_BLOCK,
+} trie_limbo_kind_t;
+
+typedef struct trie_limbo_s {
+    void **items;
+    unsigned char *kinds;
+    unsigned long count;
+    unsigned long alloc;
+} trie_limbo_t;
+
+// trie_create() flags
+#define TRIE_COMPRESSED 0x01
+#define TRIE_LAZY_DELETE 0x02
+#define TRIE_WEIGHTED 0x04 // set by the trie itself (See Note 6)
+
+// Note 10:
+// A trie can be created with lazy deletes. (TRIE_LAZY_DELETE) trie_del() then
+// only clears the value of the key and decrements the key counts on its path, 
+// once the key is found. Nodes with a count of 0 are left with no keys below 
+// them: they hold no values, and ordered queries skip them already. These dead
+// nodes are reclaimed later, all at once, by trie_compact(). Until then, a 
+// compressed trie might have valueless nodes with a single child (See Note 5),
+// and max_weight might be bigger than the max. of a subtree. (See Note 6)
+
+// Note 9:
+// trie_snapshot() returns a read-only trie that shares every node of t as it
+// is at that moment, so it is O(1) in the size of t. Shared nodes are not 
+// changed or freed while a snapshot is alive: before t changes a key, the 
+// shared nodes on its path are copied along with their siblings (path 
+// copying), so a children list is either all shared or all copied. A copy 
+// holds its own index and tail, and another reference to the value. (see 
+// value_ref) Which nodes are shared is kept per slab, by a bitmap of the nodes
+// that t owns: the ones allocated or freed since the last snapshot. Snapshots
+// of a snapshot share the same nodes. Once the last snapshot is destroyed, 
+// the shared nodes that t does not reach anymore are retired.
+typedef void (*trie_value_ref_cbk_t)(TRIE_DATA value);
+
 typedef struct trie_s {
-    int dirty; // externally reset, internally set. Used to detect if trie  
-               // changed during iteration
+    unsigned int flags;
+    unsigned long version; // incremented on every change of the keys. Used to
+                           // detect if trie changed during iteration
     unsigned long node_count;
     unsigned long item_count;
     unsigned long height; // max height of the trie (max(len(string)))
     unsigned long mem_usage;
     struct trie_node_s *root;
+    trie_slab_t **slabs; // NULL entries are released slabs (See Note 11)
+    unsigned long slab_count;
+    unsigned long slab_alloc;
+    unsigned long slab_released; // NULL entries below slab_count
+    unsigned long slab_cur; // the slab currently allocated from
+    uint32_t free_nodes; // freed nodes waiting to be reused
+    unsigned long epoch; // (See Note 7)
+    unsigned long readers[2]; // reader count of even and odd epochs
+    trie_limbo_t limbo[2]; // retired in even and odd epochs
+    struct trie_ac_s *ac; // NULL if not compiled. (See Note 8)
+    unsigned long shared_count; // slabs that have an own bitmap
+    unsigned long snapshots; // count of the snapshots alive (See Note 9)
+    struct trie_s *origin; // the trie a snapshot is taken from, NULL otherwise
+    trie_value_ref_cbk_t value_ref; // called for the values of copied nodes
 } trie_t;
 
 typedef enum iter_op_type_e {
@@ -68,6 +265,132 @@ typedef enum iter_fail_e {
     CHG_WHILE_ITER
 } iter_fail_t;
 
+// Frozen tries are read-only tries saved to a file by trie_save() and mapped
+// into memory by trie_frozen_open(). The file has no pointers in it, so it can
+// be shared by all processes mapping it:
+//
+//   trie_fheader_t | trie_fnode_t[node_count] | value data | value offsets
+//
+// Every trie_fnode_t holds a single char (compressed edges are expanded) and
+// children of a node are stored next to each other, sorted by key. Node 0 is 
+// the root. Value data is written by the caller, see trie_value_write_cbk_t. 
+// The value offsets table has item_count+1 entries, value n of a node is 
+// data[offsets[n-1]:offsets[n]].
+#define TRIE_FROZEN_MAGIC "TRIEZFRZ"
+#define TRIE_FROZEN_VERSION 1
+#define TRIE_FROZEN_BOM 0x01020304
+
+typedef struct trie_fheader_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t bom; // files are not portable between different byte orders
+    uint32_t char_size; // sizeof(TRIE_CHAR) of the writer
+    uint32_t reserved;
+    uint64_t node_count;
+    uint64_t item_count;
+    uint64_t height;
+    uint64_t nodes; // file offsets of the sections
+    uint64_t data;
+    uint64_t offsets;
+} trie_fheader_t;
+
+typedef struct trie_fnode_s {
+    uint32_t key;
+    uint32_t value; // 1-based index into value offsets, 0 if there is no value
+    uint32_t children; // index of the first child
+    uint32_t child_count;
+} trie_fnode_t;
+
+typedef struct trie_frozen_s {
+    char *map;
+    size_t map_size;
+    trie_fheader_t *header;
+    trie_fnode_t *nodes;
+    char *data;
+    uint64_t *offsets;
+} trie_frozen_t;
+
+// Corrections are found by walking the trie once while computing the 
+// Damerau-Levenshtein distance between the key and the path walked. Row d of 
+// the DP matrix is for the first d chars of the path, so a node only adds a 
+// row to the rows of its parent. A subtree is skipped once every cell of its 
+// row exceeds max_dist, as rows below it can only get bigger.
+typedef struct trie_dl_s {
+    TRIE_CHAR *query; // chars of the key
+    unsigned long size; // query size, rows have size+1 cells
+    unsigned long max_dist;
+    unsigned long alloc; // row count
+    unsigned long *rows; // rows[d][j]: distance of path[:d] to query[:j]
+    unsigned long *last; // last[d][j]: last row r <= d where path[r-1] is 
+                         // query[j-1], 0 if there is none.
+} trie_dl_t;
+
+// Note 8:
+// trie_ac_find_all() finds every key in a text in a single pass with an 
+// Aho-Corasick automaton of the keys, built by trie_ac_compile(). It is a 
+// read-only copy of the shape of the trie laid out like a frozen trie: 
+// compressed edges are expanded to a state per char and children of a state 
+// are stored next to each other, sorted by key, so the trie nodes are not 
+// grown for it. fail is the state of the longest proper suffix of a state 
+// that is a state too, and out is the nearest state with a key on that fail
+// chain, so every key ending at a position is found by following out links.
+// States point to the node holding the value, replacing a value keeps the 
+// automaton valid but adding or deleting a key drops it. State 0 is the root.
+typedef struct trie_ac_state_s {
+    TRIE_CHAR key;
+    uint32_t children; // index of the first child
+    uint32_t child_count;
+    uint32_t fail;
+    uint32_t out; // 0 if there is none
+    uint32_t depth;
+    trie_node_t *node; // node of the key if a key ends here, NULL otherwise
+} trie_ac_state_t;
+
+typedef struct trie_ac_s {
+    trie_ac_state_t *states;
+    unsigned long count;
+    uint32_t root[256]; // children of the root with chars <= 0xFF, 0 if none
+} trie_ac_t;
+
+// Shape and memory statistics of a trie, filled by trie_stats(). The 
+// histograms are allocated there and freed by trie_stats_free().
+typedef struct trie_stats_s {
+    unsigned long nodes; // reachable from the root, including it
+    unsigned long terminal; // nodes with a value
+    unsigned long *fanout; // fanout[n]: count of the nodes with n children
+    unsigned long fanout_size;
+    unsigned long *depth; // depth[d]: count of the nodes d edges below root
+    unsigned long depth_size;
+    unsigned long indexes[3]; // NODE16, NODE48 and NODE256 counts
+    unsigned long tails; // compressed edges (See Note 5)
+    unsigned long tail_chars;
+    unsigned long slabs;
+    unsigned long slab_nodes; // node capacity of the slabs
+    unsigned long free_nodes; // freed nodes waiting to be reused
+    unsigned long retired; // waiting for readers to leave (See Note 7)
+    unsigned long blocks; // TRIEMALLOC blocks held by the nodes and slabs
+    unsigned long overhead; // bytes of unused slab nodes and block headers
+    unsigned long ac_states; // 0 if there is no automaton (See Note 8)
+} trie_stats_t;
+
+// Hot path counters, only kept if built with TRIE_STATS. They are global, as 
+// the lookup functions do not know the trie they walk, and are not atomic: 
+// concurrent readers may lose a few increments.
+#ifdef TRIE_STATS
+typedef struct trie_counters_s {
+    unsigned long walks; // key lookups (_trie_walk)
+    unsigned long steps; // chars walked down
+    unsigned long index_lookups; // children found via an index
+    unsigned long sibling_hops; // children lists walked, one per node
+    unsigned long dl_edges; // edges tried by corrections
+} trie_counters_t;
+
+extern trie_counters_t trie_counters;
+#define TRIE_COUNTER_INC(name) (trie_counters.name++)
+#else
+#define TRIE_COUNTER_INC(name)
+#endif
+
 // iterator related structs
 typedef struct iter_op_s {
     iter_op_type_t type;
@@ -83,6 +406,7 @@ typedef struct iter_pos_s {
     unsigned long pos; // used for simulating multiple recursive calls in the same body.
     trie_node_t *iptr; // used for holding the current processing node.
     trie_node_t *prefix; // hold for not calculating prefix everytime
+    unsigned long pending; // unmatched tail chars of iptr/prefix (see Note 5)
 } iter_pos_t;
 
 // fast, pre-allocated iter_pos_t stack
@@ -97,17 +421,23 @@ typedef struct iter_s {
     int last;
     int fail;
     iter_fail_t fail_reason;
-    int keylen_reached; // flags used for delaying key changes
-    int depth_reached; // flags used for delaying key changes
     trie_t *trie;
     trie_key_t *key;
     trie_node_t *prefix;
     iter_stack_t *stack0;
     iter_stack_t *stack1;
     unsigned long max_depth;
+    trie_dl_t *dl; // only used by corrections
+    TRIE_DATA value; // value of the current key
+    unsigned long version; // version of the trie the iteration started at
 } iter_t;
 
 typedef int (*trie_enum_cbk_t)(trie_key_t *key, void *arg);
+typedef int (*trie_dist_cbk_t)(trie_key_t *key, unsigned long dist, void *arg);
+typedef int (*trie_match_cbk_t)(unsigned long start, unsigned long end, 
+    TRIE_DATA value, void *arg);
+typedef void (*trie_value_free_cbk_t)(TRIE_DATA value);
+typedef long (*trie_value_write_cbk_t)(TRIE_DATA value, FILE *fp);
 typedef iter_t *(*trie_iter_init_func_t)(trie_t *t, trie_key_t *key, 
     unsigned long max_depth);
 typedef iter_t *(*trie_iter_next_func_t)(iter_t *iter);
@@ -115,12 +445,42 @@ typedef iter_t *(*trie_iter_reset_func_t)(iter_t *iter);
 typedef void (*trie_iter_deinit_func_t)(iter_t *iter);
 
 // Basic Trie functions
-trie_t *trie_create(void);
-void trie_destroy(trie_t *t);
+trie_t *trie_create(unsigned int flags);
+void trie_destroy(trie_t *t, trie_value_free_cbk_t cbk);
+unsigned long trie_destroy_values_max(trie_t *t);
 unsigned long trie_mem_usage(trie_t *t);
+int trie_stats(trie_t *t, trie_stats_t *st);
+void trie_stats_free(trie_stats_t *st);
 trie_node_t *trie_search(trie_t *t, trie_key_t *key);
 int trie_add(trie_t *t, trie_key_t *key, TRIE_DATA value);
-int trie_del(trie_t *t, trie_key_t *key);
+int trie_add_weighted(trie_t *t, trie_key_t *key, TRIE_DATA value, 
+    TRIE_WEIGHT weight);
+int trie_del(trie_t *t, trie_key_t *key, TRIE_DATA *old);
+unsigned long trie_compact(trie_t *t);
+int trie_reserve(trie_t *t, unsigned long node_count);
+int trie_search_many(trie_t *t, trie_key_t *keys, unsigned long count, 
+    trie_node_t **out, int sort);
+int trie_attach(trie_t *t, trie_t *src);
+trie_t *trie_snapshot(trie_t *t, trie_value_ref_cbk_t ref);
+unsigned long trie_read_begin(trie_t *t);
+void trie_read_end(trie_t *t, unsigned long epoch);
+TRIE_CHAR trie_key_max_char(trie_key_t *k);
+trie_node_t *trie_prefix_match(trie_t *t, trie_key_t *key, unsigned long offset,
+    int longest, unsigned long *length);
+unsigned long trie_count_suffixes(trie_t *t, trie_key_t *key);
+trie_node_t *trie_first(trie_t *t, trie_key_t *out);
+trie_node_t *trie_last(trie_t *t, trie_key_t *out);
+trie_node_t *trie_successor(trie_t *t, trie_key_t *key, int inclusive, 
+    trie_key_t *out);
+trie_node_t *trie_predecessor(trie_t *t, trie_key_t *key, int inclusive, 
+    trie_key_t *out);
+
+// Bulk add functions
+trie_builder_t *trie_builder_init(trie_t *t);
+int trie_builder_add(trie_builder_t *b, trie_key_t *key, TRIE_DATA value, 
+    TRIE_DATA *old);
+void trie_builder_reset(trie_builder_t *b);
+void trie_builder_deinit(trie_builder_t *b);
 
 // Enumeration functions
 // Suffix
@@ -130,6 +490,8 @@ iter_t *trie_itersuffixes_init(trie_t *t, trie_key_t *key, unsigned long max_dep
 iter_t *trie_itersuffixes_next(iter_t *iter);
 iter_t *trie_itersuffixes_reset(iter_t *iter);
 void trie_itersuffixes_deinit(iter_t *iter);
+void trie_top_suffixes(trie_t *t, trie_key_t *key, unsigned long k, 
+    trie_enum_cbk_t cbk, void* cbk_arg);
 // Prefix
 void trie_prefixes(trie_t *t, trie_key_t *key, unsigned long max_depth, 
     trie_enum_cbk_t cbk, void* cbk_arg);
@@ -139,12 +501,30 @@ iter_t *trie_iterprefixes_reset(iter_t *iter);
 void trie_iterprefixes_deinit(iter_t *iter);
 // Correct
 void trie_corrections(trie_t *t, trie_key_t *key, unsigned long max_depth,
-    trie_enum_cbk_t cbk, void* cbk_arg);
+    trie_dist_cbk_t cbk, void* cbk_arg);
 iter_t *trie_itercorrections_init(trie_t *t, trie_key_t *key, unsigned long max_depth);
 iter_t *trie_itercorrections_next(iter_t *iter);
 iter_t *trie_itercorrections_reset(iter_t *iter);
 void trie_itercorrections_deinit(iter_t *iter);
 
+// Aho-Corasick
+int trie_ac_compile(trie_t *t);
+int trie_ac_find_all(trie_t *t, trie_key_t *text, trie_match_cbk_t cbk, 
+    void *cbk_arg);
+
+// Frozen trie functions
+int trie_save(trie_t *t, const char *path, trie_value_write_cbk_t cbk);
+trie_frozen_t *trie_frozen_open(const char *path);
+void trie_frozen_close(trie_frozen_t *f);
+trie_fnode_t *trie_frozen_search(trie_frozen_t *f, trie_key_t *key);
+char *trie_frozen_value(trie_frozen_t *f, trie_fnode_t *nd, unsigned long *size);
+void trie_frozen_suffixes(trie_frozen_t *f, trie_key_t *key, 
+    unsigned long max_depth, trie_enum_cbk_t cbk, void* cbk_arg);
+void trie_frozen_prefixes(trie_frozen_t *f, trie_key_t *key, 
+    unsigned long max_depth, trie_enum_cbk_t cbk, void* cbk_arg);
+void trie_frozen_corrections(trie_frozen_t *f, trie_key_t *key, 
+    unsigned long max_depth, trie_dist_cbk_t cbk, void* cbk_arg);
+
 // Debug functions 
 void trie_debug_print_key(trie_key_t *k);
 
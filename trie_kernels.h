@@ -0,0 +1,413 @@
+
+// Char width specialized versions of the functions that walk a key. trie.c 
+// includes this file once for every char_size of trie_key_t, with KEY_T 
+// defined as the char type of that size and KERNEL(name) giving the function
+// name for it. The public functions pick one of them by key->char_size, so the
+// loops below read key chars without KEY_CHAR_READ. (See Note 3)
+// No include guards, on purpose.
+
+// Walks key starting from the position (p, *pending).
+trie_node_t *KERNEL(_trie_walk)(trie_t *t, trie_node_t *p, unsigned long *pending,
+    trie_key_t *key)
+{
+    const KEY_T *s;
+    TRIE_CHAR ch;
+    unsigned long i;
+
+    if (!p){
+        return NULL;
+    }
+    s = (const KEY_T *)key->s;
+    for (i=0;i<key->size;i++)
+    {
+        ch = s[i];
+
+        p = _trie_step(t, p, pending, ch);
+        if (!p) {
+            return NULL;
+        }
+    }
+
+    return p;
+}
+
+// Walks key from offset and returns the node of the longest (or the shortest)
+// key that is a prefix of key[offset:], *length is set to its length. The
+// empty key matches too. NULL if there is no such key.
+trie_node_t *KERNEL(_trie_prefix_match)(trie_t *t, trie_key_t *key, 
+    unsigned long offset, int longest, unsigned long *length)
+{
+    const KEY_T *s;
+    trie_node_t *p, *match;
+    unsigned long i, pending;
+
+    p = t->root;
+    match = NULL;
+    if (p->value) {
+        match = p;
+        *length = 0;
+        if (!longest) {
+            return match;
+        }
+    }
+    s = (const KEY_T *)key->s;
+    pending = 0;
+    for (i=offset;i<key->size;i++) {
+        p = _trie_step(t, p, &pending, s[i]);
+        if (!p) {
+            break;
+        }
+        if (!pending && p->value) {
+            match = p;
+            *length = i - offset + 1;
+            if (!longest) {
+                break;
+            }
+        }
+    }
+
+    return match;
+}
+
+// Adds key with value. Weight of the key is set if set_weight is given, 
+// otherwise an existing key keeps its weight and a new one gets 0.
+int KERNEL(_trie_add)(trie_t *t, trie_key_t *key, TRIE_DATA value, TRIE_WEIGHT weight, 
+    int set_weight)
+{
+    const KEY_T *s;
+    TRIE_CHAR ch;
+    unsigned long i, j, n;
+    trie_node_t *curr, *parent, *path[TRIE_COUNT_PATH];
+    trie_tail_t *tl;
+    trie_weight_t *pw;
+    TRIE_WEIGHT w, oldw;
+
+    s = (const KEY_T *)key->s;
+
+    // max_weight may only grow on the way down. (See Note 6) Key counts are 
+    // only incremented once key is known to be new, the first 
+    // TRIE_COUNT_PATH nodes on the path are remembered for that.
+    w = set_weight ? weight : 0;
+    i = 0;
+    parent = t->root;
+    pw = _node_weight(t, parent);
+    if (pw && w > pw->max_weight) {
+        pw->max_weight = w;
+    }
+    path[0] = parent;
+    n = 1;
+    while(i < key->size)
+    {
+        ch = s[i];
+        i++;
+        
+        curr = _trie_child(t, parent, ch);
+        if (!curr) {
+            curr = NODECREATE(t, ch, (TRIE_DATA)0);
+            if (!curr){
+                return 0;
+            }
+
+            // rest of the key is the tail of the new node if compressed.
+            if ((t->flags & TRIE_COMPRESSED) && i < key->size) {
+                tl = TAILCREATE(t, key->size-i);
+                if (tl) {
+                    for (j=0;i<key->size;i++,j++) {
+                        tl->s[j] = s[i];
+                    }
+                }
+                if (!tl || !_node_set_tail(t, curr, tl)) {
+                    if (tl) {
+                        TAILFREE(t, tl);
+                    }
+                    NODEFREE(t, curr);
+                    return 0;
+                }
+            }
+
+            _trie_link(t, parent, curr);
+            t->node_count++;
+        } else if ((tl = _node_tail(t, curr)) != NULL) {
+            // split the edge if key diverges from, or ends in the tail.
+            for (j=0;j<tl->size && i<key->size;j++,i++) {
+                ch = s[i];
+                if (ch != tl->s[j]) {
+                    break;
+                }
+            }
+            if (j < tl->size && !_trie_split(t, curr, j)) {
+                return 0;
+            }
+        }
+        pw = _node_weight(t, curr);
+        if (pw && w > pw->max_weight) {
+            pw->max_weight = w;
+        }
+        if (n < TRIE_COUNT_PATH) {
+            path[n] = curr;
+        }
+        n++;
+        parent = curr;
+    }
+
+    pw = _node_weight(t, parent);
+    if (!parent->value) {
+        if (n <= TRIE_COUNT_PATH) {
+            for (j=0;j<n;j++) {
+                path[j]->count++;
+            }
+        } else {
+            _trie_count_path(t, key, key->size, 1);
+        }
+        t->item_count++;
+        t->version++;
+        _trie_ac_drop(t);
+        if (pw) {
+            pw->weight = w;
+        }
+    }
+    if (parent->value && set_weight && pw) {
+        oldw = pw->weight;
+        pw->weight = weight;
+        if (oldw > weight && oldw == pw->max_weight) {
+            _trie_weight_fix(t, key);
+        }
+    }
+
+    if (key->size > t->height) {
+        t->height = key->size;
+    }
+
+    parent->value = value;
+    return 1;
+}
+
+// Algorithm: Traverse the key once without changing anything, remembering the
+// deepest node that stays after the key is removed. Then the chain of nodes 
+// below it that is left with no values is unlinked by a single store. (See 
+// Note 7) In a compressed trie, a node left with no value and a single child
+// is merged with that child. If the key was the heaviest of a subtree, 
+// max_weight is recomputed bottom-up until it stops changing. Lazy deletes 
+// unlink nothing and leave max_weight as it is. (See Note 10) The value of key
+// is set to old.
+// Complexity: O(m)
+int KERNEL(trie_del)(trie_t *t, trie_key_t *key, TRIE_DATA *old)
+{
+    unsigned long i, j, n;
+    int fix, merged;
+    trie_node_t *curr, *nd, *b, *c, *path[TRIE_COUNT_PATH];
+    trie_tail_t *tl;
+    trie_weight_t *pw;
+    const KEY_T *s;
+    TRIE_CHAR ch;
+
+    s = (const KEY_T *)key->s;
+
+    // b is the deepest node on the path that stays when key is removed: the
+    // root, or a node with a value or other children. c is its child on the 
+    // path. Nothing is changed while descending, not even the key counts, 
+    // which are decremented once key is found. The first TRIE_COUNT_PATH 
+    // nodes on the path are remembered for that.
+    b = curr = t->root;
+    c = NULL;
+    path[0] = curr;
+    n = 1;
+    i = 0;
+    while(i < key->size)
+    {
+        ch = s[i];
+        nd = _trie_child(t, curr, ch);
+        if (!nd) {
+            return 0;
+        }
+        if (curr == t->root || curr->value || curr->children != nd->id || 
+            nd->next) {
+            b = curr;
+            c = nd;
+        }
+        curr = nd;
+        if (n < TRIE_COUNT_PATH) {
+            path[n] = curr;
+        }
+        n++;
+        i++;
+
+        // key shall match the whole tail
+        tl = _node_tail(t, curr);
+        if (tl) {
+            for (j=0;j<tl->size && i<key->size;j++,i++) {
+                ch = s[i];
+                if (ch != tl->s[j]) {
+                    return 0;
+                }
+            }
+            if (j < tl->size) {
+                return 0;
+            }
+        }
+    }
+
+    // key is found, but do we really have added it?
+    if (!curr->value) {
+        return 0;
+    }
+
+    // remove key
+    if (n <= TRIE_COUNT_PATH) {
+        for (j=0;j<n;j++) {
+            path[j]->count--;
+        }
+    } else {
+        _trie_count_path(t, key, key->size, -1);
+    }
+    pw = _node_weight(t, curr);
+    fix = (pw && pw->weight == pw->max_weight);
+    *old = curr->value;
+    curr->value = 0;
+    merged = 0;
+    nd = curr;
+    if (t->flags & TRIE_LAZY_DELETE) {
+        // the nodes stay until trie_compact(), which fixes the weights too.
+        fix = 0;
+    } else if (curr == t->root || curr->children) {
+        // no need to check the result, an uncompressed edge is still valid.
+        if ((t->flags & TRIE_COMPRESSED) && curr != t->root && 
+            !_node_children(t, curr)->next) {
+            merged = _trie_merge(t, curr);
+        }
+    } else {
+        _trie_unlink(t, b, c);
+        nd = b;
+        if ((t->flags & TRIE_COMPRESSED) && b != t->root && !b->value && 
+            b->children && !_node_children(t, b)->next) {
+            merged = _trie_merge(t, b);
+        }
+    }
+
+    // max. weights above nd do not change if the max. of nd does not.
+    if (fix && (merged || 
+        _node_max_weight(t, nd) != _node_weight(t, nd)->max_weight)) {
+        _trie_weight_fix(t, key);
+    }
+    t->item_count--;
+    t->version++;
+    _trie_ac_drop(t);
+
+    return 1;
+}
+
+// Descends key for trie_search_many(). (path[d], pending[d]) is the position
+// of the first d chars of prev and is known for d <= valid, the walk starts 
+// from where key diverges from prev. Keys of another char_size share no 
+// prefix with key here, they only cost a descent from the root. *depth is set
+// to the count of the chars walked, the node reached is returned.
+trie_node_t *KERNEL(_trie_search_path)(trie_t *t, trie_key_t *key, 
+    trie_key_t *prev, unsigned long valid, trie_node_t **path, 
+    unsigned long *pending, unsigned long *depth)
+{
+    const KEY_T *s, *ps;
+    trie_node_t *p;
+    unsigned long j, n;
+
+    s = (const KEY_T *)key->s;
+    j = 0;
+    if (prev && prev->char_size == key->char_size) {
+        ps = (const KEY_T *)prev->s;
+        n = key->size < valid ? key->size : valid;
+        for (;j<n && s[j] == ps[j];j++)
+            ;
+    }
+
+    p = path[j];
+    for (;j<key->size;j++) {
+        pending[j+1] = pending[j];
+        p = _trie_step(t, p, &pending[j+1], s[j]);
+        if (!p) {
+            break;
+        }
+        path[j+1] = p;
+    }
+    *depth = j;
+    return p;
+}
+
+// Walks key for trie_builder_add() from where it diverges from the last key 
+// added, and creates the nodes missing on the path. b->path and b->last are 
+// set to the path of key. Returns 0 if there is no memory.
+int KERNEL(_trie_builder_path)(trie_builder_t *b, trie_key_t *key)
+{
+    const KEY_T *s;
+    TRIE_CHAR ch;
+    unsigned long i, n;
+    int created;
+    trie_t *t;
+    trie_node_t *curr, *parent;
+
+    t = b->t;
+    s = (const KEY_T *)key->s;
+    n = key->size < b->size ? key->size : b->size;
+    for (i=0;i<n && s[i] == b->last[i];i++)
+        ;
+
+    created = 0;
+    parent = b->path[i];
+    for (;i<key->size;i++) {
+        ch = s[i];
+
+        curr = NULL;
+        if (!created) {
+            curr = _trie_child(t, parent, ch);
+        }
+        if (!curr) {
+            curr = NODECREATE(t, ch, (TRIE_DATA)0);
+            if (!curr) {
+                b->size = i;
+                return 0;
+            }
+            _trie_link(t, parent, curr);
+            t->node_count++;
+            created = 1;
+        }
+        b->last[i] = ch;
+        b->path[i+1] = curr;
+        parent = curr;
+    }
+    b->size = key->size;
+    return 1;
+}
+
+// Scans text with the automaton of t. (See Note 8)
+int KERNEL(_trie_ac_scan)(trie_ac_t *ac, trie_key_t *text, 
+    trie_match_cbk_t cbk, void *cbk_arg)
+{
+    const KEY_T *s;
+    trie_ac_state_t *states;
+    unsigned long i;
+    uint32_t st, g, o;
+    TRIE_CHAR ch;
+
+    s = (const KEY_T *)text->s;
+    states = ac->states;
+    st = 0;
+    for (i=0;i<text->size;i++) {
+        ch = s[i];
+        while(1) {
+            g = _ac_goto(ac, st, ch);
+            if (g || !st) {
+                break;
+            }
+            st = states[st].fail;
+        }
+        st = g;
+
+        o = states[st].node ? st : states[st].out;
+        while(o) {
+            if (!cbk(i + 1 - states[o].depth, i + 1, states[o].node->value, 
+                cbk_arg)) {
+                return 0;
+            }
+            o = states[o].out;
+        }
+    }
+    return 1;
+}
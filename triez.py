@@ -1,4 +1,7 @@
 import _triez
 
 class Trie(_triez.Trie):
+    pass
+
+class FrozenTrie(_triez.FrozenTrie):
     pass
\ No newline at end of file